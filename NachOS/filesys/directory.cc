@@ -1,7 +1,7 @@
 // directory.cc
 //	Routines to manage a directory of file names.
 //
-//	The directory is a table of fixed length entries; each
+//	The directory is a set of fixed length entries; each
 //	entry represents a single file, and contains the file name,
 //	and the location of the file header on disk.  The fixed size
 //	of each directory entry means that we have the restriction
@@ -11,9 +11,9 @@
 //	we use ReadFrom/WriteBack to fetch the contents of the directory
 //	from disk, and to write back any modifications back to disk.
 //
-//	Also, this implementation has the restriction that the size
-//	of the directory cannot expand.  In other words, once all the
-//	entries in the directory are used, no more files can be created.
+//	The entries are kept in a B+tree of nodes inside the directory
+//	file, which grows a node at a time, so a directory never fills
+//	up, and finding a name reads one node per level of the tree.
 //
 // Copyright (c) 1992-1993 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation
@@ -21,9 +21,101 @@
 
 #include "copyright.h"
 #include "utility.h"
+#include "debug.h"
 #include "filehdr.h"
 #include "directory.h"
 #include "filesys.h"
+#include "synch.h"
+
+// Cache of recent path component lookups: the sector of the file or
+// directory called "name" in the directory whose header is at
+// "parent", or -1 for a name known not to be there.  Entries are
+// placed by hash, one per slot, the newest replacing the older.
+
+#define NumDentries 256
+
+class DentryCache
+{
+public:
+	DentryCache() { Clear(); }
+
+	bool Lookup(int parent, char *name, int *sector, bool *isDirectory);
+	void Enter(int parent, char *name, int sector, bool isDirectory);
+	void Forget(int parent, char *name);
+	void Clear();
+
+private:
+	class Dentry
+	{
+	public:
+		int parent; // -1 if the slot is unused
+		char name[FileNameMaxLen + 1];
+		int sector;
+		bool isDirectory;
+	};
+	Dentry slots[NumDentries];
+
+	Dentry *Slot(int parent, char *name);
+};
+
+static DentryCache dentries;
+
+//----------------------------------------------------------------------
+// HashName
+// 	Hash a file name, as far as directory entries keep it.
+//----------------------------------------------------------------------
+
+static unsigned int
+HashName(char *name)
+{
+	unsigned int hash = 0;
+
+	for (int i = 0; i < FileNameMaxLen && name[i] != '\0'; i++)
+		hash = hash * 31 + (unsigned char)name[i];
+	return hash;
+}
+
+DentryCache::Dentry *
+DentryCache::Slot(int parent, char *name)
+{
+	return &slots[(HashName(name) + parent * 17u) % NumDentries];
+}
+
+bool DentryCache::Lookup(int parent, char *name, int *sector, bool *isDirectory)
+{
+	Dentry *d = Slot(parent, name);
+
+	if (d->parent != parent || strncmp(d->name, name, FileNameMaxLen))
+		return FALSE;
+	*sector = d->sector;
+	*isDirectory = d->isDirectory;
+	return TRUE;
+}
+
+void DentryCache::Enter(int parent, char *name, int sector, bool isDirectory)
+{
+	Dentry *d = Slot(parent, name);
+
+	d->parent = parent;
+	strncpy(d->name, name, FileNameMaxLen);
+	d->name[FileNameMaxLen] = '\0';
+	d->sector = sector;
+	d->isDirectory = isDirectory;
+}
+
+void DentryCache::Forget(int parent, char *name)
+{
+	Dentry *d = Slot(parent, name);
+
+	if (d->parent == parent && !strncmp(d->name, name, FileNameMaxLen))
+		d->parent = -1;
+}
+
+void DentryCache::Clear()
+{
+	for (int i = 0; i < NumDentries; i++)
+		slots[i].parent = -1;
+}
 
 //----------------------------------------------------------------------
 // Directory::Directory
@@ -37,14 +129,14 @@
 
 Directory::Directory(int size)
 {
-	table = new DirectoryEntry[size];
-
-	// MP4 mod tag
-	memset(table, 0, sizeof(DirectoryEntry) * size); // dummy operation to keep valgrind happy
-
-	tableSize = size;
-	for (int i = 0; i < tableSize; i++)
-		table[i].inUse = FALSE;
+	table = NULL;
+	hashHeads = hashNext = NULL;
+	tableSize = 0;
+	Resize(size);
+	sector = -1;
+	format = DirNew;
+	dirFile = NULL;
+	stale = FALSE;
 }
 
 //----------------------------------------------------------------------
@@ -55,30 +147,105 @@ Directory::Directory(int size)
 Directory::~Directory()
 {
 	delete[] table;
+	delete[] hashHeads;
+	delete[] hashNext;
+	delete dirFile;
+}
+
+//----------------------------------------------------------------------
+// Directory::Resize
+// 	Replace the table by an empty one of "size" entries (at least
+//	one, as the hash chains are picked modulo the size).
+//----------------------------------------------------------------------
+
+void Directory::Resize(int size)
+{
+	if (size < 1)
+		size = 1;
+	if (size != tableSize)
+	{
+		delete[] table;
+		delete[] hashHeads;
+		delete[] hashNext;
+		table = new DirectoryEntry[size];
+		hashHeads = new int[size];
+		hashNext = new int[size];
+		tableSize = size;
+	}
+	// MP4 mod tag
+	memset(table, 0, sizeof(DirectoryEntry) * size); // dummy operation to keep valgrind happy
+	for (int i = 0; i < tableSize; i++)
+		table[i].inUse = FALSE;
+	Rehash();
 }
 
 //----------------------------------------------------------------------
 // Directory::FetchFrom
-// 	Read the contents of the directory from disk.
+// 	Read the contents of the directory from disk.  For a B+tree, only
+//	node 0 is read now, and the directory opens the file for itself,
+//	to read the other nodes as they are needed.
 //
 //	"file" -- file containing the directory contents
 //----------------------------------------------------------------------
 
 void Directory::FetchFrom(OpenFile *file)
 {
+	int magic = 0;
+
+	delete dirFile;
+	dirFile = NULL;
+	sector = file->getHdrSector();
+	(void)file->ReadAt((char *)&magic, sizeof(int), 0);
+	if (magic == BTreeMagic)
+	{
+		format = DirBTree;
+		dirFile = new OpenFile(sector);
+		(void)dirFile->ReadAt((char *)&super, sizeof(BTreeSuper), 0);
+		stale = TRUE;
+		return;
+	}
+	format = DirTable;
+	Resize(NumDirEntries);
 	(void)file->ReadAt((char *)table, tableSize * sizeof(DirectoryEntry), 0);
+	Rehash();
 }
 
 //----------------------------------------------------------------------
 // Directory::WriteBack
-// 	Write any modifications to the directory back to disk
+// 	Write any modifications to the directory back to disk.  A B+tree
+//	has been written as it was changed; a directory that is not on
+//	disk yet becomes one, holding the entries added so far.  Return
+//	FALSE if the disk had no room for it.
 //
 //	"file" -- file to contain the new directory contents
 //----------------------------------------------------------------------
 
-void Directory::WriteBack(OpenFile *file)
+bool Directory::WriteBack(OpenFile *file)
 {
-	(void)file->WriteAt((char *)table, tableSize * sizeof(DirectoryEntry), 0);
+	int numBytes = tableSize * sizeof(DirectoryEntry);
+
+	if (format == DirTable)
+	{
+		sector = file->getHdrSector();
+		return file->WriteAt((char *)table, numBytes, 0) == numBytes;
+	}
+	else if (format == DirNew)
+	{
+		sector = file->getHdrSector();
+		dirFile = new OpenFile(sector);
+		if (!MakeTree())
+		{
+			delete dirFile;
+			dirFile = NULL;
+			return FALSE;
+		}
+		for (int i = 0; i < tableSize; i++)
+			if (table[i].inUse &&
+				!Insert(table[i].name, table[i].sector, table[i].isDirectory))
+				return FALSE;
+		stale = TRUE;
+	}
+	return TRUE;
 }
 
 //----------------------------------------------------------------------
@@ -86,20 +253,431 @@ void Directory::WriteBack(OpenFile *file)
 // 	Look up file name in directory, and return its location in the table of
 //	directory entries.  Return -1 if the name isn't in the directory.
 //
+//	Only the entries in the hash chain for "name" are looked at.
+//
 //	"name" -- the file name to look up
 //----------------------------------------------------------------------
 
 int Directory::FindIndex(char *name)
 {
-
-	for (int i = 0; i < tableSize; i++){
-		//cout << table[i].name << " " << name << endl;
+	for (int i = hashHeads[HashName(name) % tableSize]; i != -1; i = hashNext[i])
+	{
 		if (table[i].inUse && !strncmp(table[i].name, name, FileNameMaxLen))
 			return i;
 	}
 	return -1; // name not in directory
 }
 
+//----------------------------------------------------------------------
+// Directory::Hash/Unhash/Rehash
+// 	Keep the hash chains of the entries in use up to date: add
+//	table[i] to its chain, take it off again, or rebuild every chain
+//	after the table has been read in.
+//----------------------------------------------------------------------
+
+void Directory::Hash(int i)
+{
+	int bucket = HashName(table[i].name) % tableSize;
+
+	hashNext[i] = hashHeads[bucket];
+	hashHeads[bucket] = i;
+}
+
+void Directory::Unhash(int i)
+{
+	int *link = &hashHeads[HashName(table[i].name) % tableSize];
+
+	while (*link != i)
+	{
+		ASSERT(*link != -1);
+		link = &hashNext[*link];
+	}
+	*link = hashNext[i];
+}
+
+void Directory::Rehash()
+{
+	for (int i = 0; i < tableSize; i++)
+		hashHeads[i] = -1;
+	for (int i = 0; i < tableSize; i++)
+	{
+		if (table[i].inUse)
+			Hash(i);
+	}
+}
+
+//----------------------------------------------------------------------
+// Directory::Snapshot
+// 	Bring "table" up to date with the B+tree, by walking its leaves
+//	from the leftmost one.  The copy stays good until an entry is
+//	added; removing one takes it out of the copy as well.
+//----------------------------------------------------------------------
+
+void Directory::Snapshot()
+{
+	BTreeNode node;
+	int n, i = 0;
+
+	if (format != DirBTree || !stale)
+		return;
+	Resize(super.count);
+	for (n = super.root, ReadNode(n, &node); !node.isLeaf; ReadNode(n, &node))
+		n = node.slots[0].sector;
+	for (;;)
+	{
+		for (int j = 0; j < node.count; j++, i++)
+		{
+			ASSERT(i < tableSize);
+			table[i].inUse = TRUE;
+			table[i].isDirectory = node.slots[j].isDirectory;
+			table[i].sector = node.slots[j].sector;
+			strncpy(table[i].name, node.slots[j].name, FileNameMaxLen + 1);
+		}
+		if (node.next == -1)
+			break;
+		ReadNode(node.next, &node);
+	}
+	ASSERT(i == super.count);
+	Rehash();
+	stale = FALSE;
+}
+
+//----------------------------------------------------------------------
+// Directory::ReadNode/WriteNode/WriteSuper/NewNode
+// 	Move B+tree nodes between memory and the directory file, and
+//	add a node at the end of the file.  A write returns FALSE if it
+//	came up short.
+//----------------------------------------------------------------------
+
+void Directory::ReadNode(int n, BTreeNode *node)
+{
+	int numBytes = dirFile->ReadAt((char *)node, sizeof(BTreeNode), n * BTreeNodeSize);
+
+	ASSERT(numBytes == sizeof(BTreeNode));
+}
+
+bool Directory::WriteNode(int n, BTreeNode *node)
+{
+	return dirFile->WriteAt((char *)node, sizeof(BTreeNode), n * BTreeNodeSize) == sizeof(BTreeNode);
+}
+
+bool Directory::WriteSuper()
+{
+	return dirFile->WriteAt((char *)&super, sizeof(BTreeSuper), 0) == sizeof(BTreeSuper);
+}
+
+int Directory::NewNode()
+{
+	return super.numNodes++;
+}
+
+//----------------------------------------------------------------------
+// Directory::Reserve
+// 	Make the directory file long enough for "nodes" nodes, by writing
+//	zeros after its end.  The new nodes then need no disk space when
+//	they are written, so a change to the tree that has reserved what
+//	it may add cannot fail halfway.  Return FALSE, leaving the file
+//	as it was, if the disk is full.
+//----------------------------------------------------------------------
+
+bool Directory::Reserve(int nodes)
+{
+	int length = dirFile->Length();
+	int numBytes = nodes * BTreeNodeSize - length;
+
+	if (numBytes <= 0)
+		return TRUE;
+	char *zeros = new char[numBytes];
+	memset(zeros, 0, numBytes);
+	bool success = (dirFile->WriteAt(zeros, numBytes, length) == numBytes);
+	delete[] zeros;
+	if (!success)
+	{
+		DEBUG(dbgFile, "No room to grow directory " << sector);
+	}
+	return success;
+}
+
+//----------------------------------------------------------------------
+// Directory::MakeTree
+// 	Start an empty B+tree in dirFile: node 0, and a root that is an
+//	empty leaf.  Return FALSE if they could not be written.
+//----------------------------------------------------------------------
+
+bool Directory::MakeTree()
+{
+	BTreeNode root;
+
+	memset(&root, 0, sizeof(BTreeNode));
+	root.isLeaf = TRUE;
+	root.count = 0;
+	root.next = -1;
+	super.magic = BTreeMagic;
+	super.root = 1;
+	super.numNodes = 2;
+	super.count = 0;
+	if (!WriteNode(super.root, &root) || !WriteSuper())
+		return FALSE;
+	format = DirBTree;
+	stale = TRUE;
+	return TRUE;
+}
+
+//----------------------------------------------------------------------
+// ChildIndex/LeafPosition
+// 	Binary search within a node: the slot of the child of an
+//	interior node whose names may include "name", and the position
+//	of the first entry of a leaf that is not below "name".
+//----------------------------------------------------------------------
+
+static int
+ChildIndex(BTreeNode *node, char *name)
+{
+	int lo = 0, hi = node->count;
+
+	while (lo < hi)
+	{
+		int mid = (lo + hi + 1) / 2;
+		if (strncmp(node->slots[mid].name, name, FileNameMaxLen) <= 0)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	return lo;
+}
+
+static int
+LeafPosition(BTreeNode *node, char *name)
+{
+	int lo = 0, hi = node->count;
+
+	while (lo < hi)
+	{
+		int mid = (lo + hi) / 2;
+		if (strncmp(node->slots[mid].name, name, FileNameMaxLen) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+//----------------------------------------------------------------------
+// Directory::FindLeaf
+// 	Walk from the root down to the leaf where "name" is, or would
+//	go.  Returns the node number, with the node itself in "leaf".
+//----------------------------------------------------------------------
+
+int Directory::FindLeaf(char *name, BTreeNode *leaf)
+{
+	int n = super.root;
+
+	for (ReadNode(n, leaf); !leaf->isLeaf; ReadNode(n, leaf))
+		n = leaf->slots[ChildIndex(leaf, name)].sector;
+	return n;
+}
+
+//----------------------------------------------------------------------
+// Directory::InsertInto
+// 	Add "entry" to the subtree under node n.  A node that overflows
+//	is split in two halves, the upper one going to a new node; the
+//	caller is then given, in "promoted", the key it must add for the
+//	new node, and "*split" is set.  Return FALSE if a node could not
+//	be written.
+//
+//	Leaves and interior nodes are handled alike: both use at most
+//	BTreeSlots slots (an interior node's slot 0 holding only a child),
+//	and the entry for the new child goes right after the slot of the
+//	child that was split.
+//----------------------------------------------------------------------
+
+bool Directory::InsertInto(int n, BTreeSlot *entry, BTreeSlot *promoted, bool *split)
+{
+	BTreeNode node, right;
+	BTreeSlot slots[BTreeSlots + 1];
+	int pos, used, half;
+
+	*split = FALSE;
+	ReadNode(n, &node);
+	if (node.isLeaf)
+	{
+		pos = LeafPosition(&node, entry->name);
+		used = node.count;
+	}
+	else
+	{
+		int child = ChildIndex(&node, entry->name);
+		bool childSplit;
+		if (!InsertInto(node.slots[child].sector, entry, promoted, &childSplit))
+			return FALSE;
+		if (!childSplit)
+			return TRUE;
+		entry = promoted;
+		pos = child + 1;
+		used = node.count + 1;
+	}
+
+	memcpy(slots, node.slots, pos * sizeof(BTreeSlot));
+	slots[pos] = *entry;
+	memcpy(slots + pos + 1, node.slots + pos, (used - pos) * sizeof(BTreeSlot));
+	used++;
+	if (used <= BTreeSlots)
+	{
+		memcpy(node.slots, slots, used * sizeof(BTreeSlot));
+		node.count = node.isLeaf ? used : used - 1;
+		return WriteNode(n, &node);
+	}
+
+	// split: slots[0..half-1] stay, the rest move to a new node
+	memset(&right, 0, sizeof(BTreeNode));
+	right.isLeaf = node.isLeaf;
+	half = used / 2;
+	*promoted = slots[half];
+	promoted->sector = NewNode();
+	memcpy(node.slots, slots, half * sizeof(BTreeSlot));
+	if (node.isLeaf)
+	{
+		memcpy(right.slots, slots + half, (used - half) * sizeof(BTreeSlot));
+		node.count = half;
+		right.count = used - half;
+		right.next = node.next;
+		node.next = promoted->sector;
+	}
+	else
+	{
+		// the middle key moves up; its child starts the new node
+		right.slots[0].sector = slots[half].sector;
+		memcpy(right.slots + 1, slots + half + 1,
+			   (used - half - 1) * sizeof(BTreeSlot));
+		node.count = half - 1;
+		right.count = used - half - 1;
+		right.next = -1;
+	}
+	// the new node first: until n is written, nothing points to it
+	if (!WriteNode(promoted->sector, &right) || !WriteNode(n, &node))
+		return FALSE;
+	DEBUG(dbgFile, "Split directory node " << n << " into " << promoted->sector);
+	*split = TRUE;
+	return TRUE;
+}
+
+//----------------------------------------------------------------------
+// Directory::Insert
+// 	Add an entry to the B+tree, which is one level deeper if the
+//	root had to be split.
+//
+//	Each full node on the way down to the leaf, from the first one
+//	below which all are full, will split into a new node, and a root
+//	that splits adds one more; room for those is reserved before
+//	anything is written.  Return FALSE, with the tree as it was, if
+//	the directory file can't grow.
+//----------------------------------------------------------------------
+
+bool Directory::Insert(char *name, int newSector, bool isDirectory)
+{
+	BTreeSlot entry, promoted;
+	BTreeSuper old = super;
+	BTreeNode node;
+	int levels = 0, splits = 0;
+	bool split;
+
+	// the full nodes at the bottom of the path will split
+	for (ReadNode(super.root, &node);; ReadNode(node.slots[ChildIndex(&node, name)].sector, &node))
+	{
+		levels++;
+		if ((node.isLeaf ? node.count : node.count + 1) == BTreeSlots)
+			splits++;
+		else
+			splits = 0;
+		if (node.isLeaf)
+			break;
+	}
+	if (!Reserve(super.numNodes + splits + (splits == levels ? 1 : 0)))
+		return FALSE;
+
+	memset(&entry, 0, sizeof(BTreeSlot));
+	strncpy(entry.name, name, FileNameMaxLen);
+	entry.sector = newSector;
+	entry.isDirectory = isDirectory;
+	bool success = InsertInto(super.root, &entry, &promoted, &split);
+	if (success && split)
+	{
+		BTreeNode root;
+		memset(&root, 0, sizeof(BTreeNode));
+		root.isLeaf = FALSE;
+		root.count = 1;
+		root.next = -1;
+		root.slots[0].sector = super.root;
+		root.slots[1] = promoted;
+		super.root = NewNode();
+		success = WriteNode(super.root, &root);
+	}
+	if (success)
+	{
+		super.count++;
+		success = WriteSuper();
+	}
+	if (!success)
+		super = old;
+	stale = TRUE;
+	return success;
+}
+
+//----------------------------------------------------------------------
+// Directory::Delete
+// 	Take an entry out of its leaf in the B+tree.  Return FALSE if
+//	there is no such entry.
+//----------------------------------------------------------------------
+
+bool Directory::Delete(char *name)
+{
+	BTreeNode leaf;
+	int n = FindLeaf(name, &leaf);
+	int pos = LeafPosition(&leaf, name);
+
+	if (pos == leaf.count || strncmp(leaf.slots[pos].name, name, FileNameMaxLen))
+		return FALSE;
+	memmove(leaf.slots + pos, leaf.slots + pos + 1,
+			(leaf.count - pos - 1) * sizeof(BTreeSlot));
+	leaf.count--;
+	WriteNode(n, &leaf);
+	super.count--;
+	WriteSuper();
+	return TRUE;
+}
+
+//----------------------------------------------------------------------
+// Directory::Lookup
+// 	Look up file name in directory; if it is there, return TRUE, with
+//	the disk sector number where the file's header is stored and
+//	whether it is a directory.
+//
+//	"name" -- the file name to look up
+//----------------------------------------------------------------------
+
+bool Directory::Lookup(char *name, int *fileSector, bool *isDirectory)
+{
+	if (format == DirBTree)
+	{
+		BTreeNode leaf;
+		(void)FindLeaf(name, &leaf);
+		int pos = LeafPosition(&leaf, name);
+		if (pos == leaf.count || strncmp(leaf.slots[pos].name, name, FileNameMaxLen))
+			return FALSE;
+		*fileSector = leaf.slots[pos].sector;
+		*isDirectory = leaf.slots[pos].isDirectory;
+		return TRUE;
+	}
+
+	int i = FindIndex(name);
+
+	if (i == -1)
+		return FALSE;
+	*fileSector = table[i].sector;
+	*isDirectory = table[i].isDirectory;
+	return TRUE;
+}
+
 //----------------------------------------------------------------------
 // Directory::Find
 // 	Look up file name in directory, and return the disk sector number
@@ -111,10 +689,11 @@ int Directory::FindIndex(char *name)
 
 int Directory::Find(char *name)
 {
-	int i = FindIndex(name);
+	int found;
+	bool isDirectory;
 
-	if (i != -1)
-		return table[i].sector;
+	if (Lookup(name, &found, &isDirectory))
+		return found;
 	return -1;
 }
 
@@ -122,28 +701,64 @@ int Directory::Find(char *name)
 // Directory::Add
 // 	Add a file into the directory.  Return TRUE if successful;
 //	return FALSE if the file name is already in the directory, or if
-//	the directory is completely full, and has no more space for
+//	a directory not yet written to disk has no more space for
 //	additional file names.
 //
+//	An old table directory that is full is first turned into a B+tree
+//	holding the same entries.  Adding to a B+tree may make the
+//	directory file longer, taking sectors from the free map on disk;
+//	FALSE is also returned, with the directory as it was, if the disk
+//	is full.
+//
 //	"name" -- the name of the file being added
 //	"newSector" -- the disk sector containing the added file's header
 //----------------------------------------------------------------------
 
 bool Directory::Add(char *name, int newSector, bool Directory)
 {
-	if (FindIndex(name) != -1)
+	int found;
+	bool isDirectory;
+
+	if (Lookup(name, &found, &isDirectory))
 		return FALSE; // name is in Directory
 
-	for (int i = 0; i < tableSize; i++)
-		if (!table[i].inUse)
+	if (sector == -1)
+		dentries.Clear(); // don't know which entry to drop
+	else
+		dentries.Forget(sector, name);
+
+	if (format != DirBTree)
+	{
+		for (int i = 0; i < tableSize; i++)
+			if (!table[i].inUse)
+			{
+				table[i].inUse = TRUE;
+				strncpy(table[i].name, name, FileNameMaxLen);
+				table[i].sector = newSector;
+				table[i].isDirectory = Directory;
+				Hash(i);
+				return TRUE;
+			}
+		if (format == DirNew)
+			return FALSE; // no space until written to disk
+
+		// the table is overwritten, so first make room for all the
+		// tree will need: leaves are at least half full, and each
+		// level above has fewer nodes than the one below
+		DEBUG(dbgFile, "Converting directory " << sector << " to a B+tree");
+		dirFile = new OpenFile(sector);
+		if (!Reserve(4 + 2 * (divRoundUp(tableSize + 1, BTreeSlots / 2) + 1)) ||
+			!MakeTree())
 		{
-			table[i].inUse = TRUE;
-			strncpy(table[i].name, name, FileNameMaxLen);
-			table[i].sector = newSector;
-			table[i].isDirectory = Directory;
-			return TRUE;
+			delete dirFile; // still the old table, on disk too
+			dirFile = NULL;
+			return FALSE;
 		}
-	return FALSE; // no space.  Fix when we have extensible files.
+		for (int i = 0; i < tableSize; i++)
+			if (!Insert(table[i].name, table[i].sector, table[i].isDirectory))
+				return FALSE;
+	}
+	return Insert(name, newSector, Directory);
 }
 
 //----------------------------------------------------------------------
@@ -156,11 +771,26 @@ bool Directory::Add(char *name, int newSector, bool Directory)
 
 bool Directory::Remove(char *name)
 {
-	int i = FindIndex(name);
+	int found;
+	bool isDirectory;
 
-	if (i == -1)
+	if (!Lookup(name, &found, &isDirectory))
 		return FALSE; // name not in directory
-	table[i].inUse = FALSE;
+
+	int i = (format == DirBTree && stale) ? -1 : FindIndex(name);
+	if (i != -1)
+	{
+		Unhash(i);
+		table[i].inUse = FALSE;
+	}
+	if (format == DirBTree)
+		(void)Delete(name);
+	// a directory's sector may be reused, and with it the cached
+	// lookups below it, so drop those (all of them) too
+	if (sector == -1 || isDirectory)
+		dentries.Clear();
+	else
+		dentries.Forget(sector, name);
 	return TRUE;
 }
 
@@ -173,6 +803,7 @@ void Directory::List()
 {
 	int counter = 0;
 	char type;
+	Snapshot();
 	for (int i = 0; i < tableSize; i++)
 		if (table[i].inUse)
 		{
@@ -192,6 +823,7 @@ void Directory::RecursiveList()
 
 	int counter = 0;
 	char type;
+	Snapshot();
 	for (int i = 0; i < tableSize; i++)
 		if (table[i].inUse)
 		{
@@ -203,13 +835,15 @@ void Directory::RecursiveList()
 			if (table[i].isDirectory)
 			{
 				file_tem = new OpenFile(table[i].sector); // go to next directory
+				file_tem->InodeLock()->AcquireRead();
 				subDirectory->FetchFrom(file_tem);
 				subDirectory->RecursiveList();
+				file_tem->InodeLock()->ReleaseRead();
+				delete file_tem;
 			}
 			counter++;
 		}
-	//delete subDirectory;
-	//delete file_tem;
+	delete subDirectory;
 }
 
 //----------------------------------------------------------------------
@@ -223,6 +857,9 @@ void Directory::Print()
 	FileHeader *hdr = new FileHeader;
 
 	printf("Directory contents:\n");
+	if (format == DirBTree)
+		printf("B+tree of %d nodes, root %d\n", super.numNodes, super.root);
+	Snapshot();
 	for (int i = 0; i < tableSize; i++)
 		if (table[i].inUse)
 		{
@@ -234,70 +871,80 @@ void Directory::Print()
 	delete hdr;
 }
 
+//----------------------------------------------------------------------
+// Directory::FindPath
+// 	Look up an absolute path, such as "/t0/bb/f1", starting from this
+//	directory (the root), and return the sector of the header of the
+//	file or directory it names, or -1 if there is no such thing.
+//
+//	Each component is first looked for in the dentry cache; only on
+//	a miss is its parent directory read in, and the answer, found or
+//	not, is cached for next time.  The parent is read afresh, and
+//	locked for reading until the answer is cached, so that a change
+//	to it cannot come in between and leave a stale answer behind.
+//	A component too long for any entry names nothing.
+//
+//	"name" -- the path to look up
+//----------------------------------------------------------------------
+
 int Directory::FindPath(char *name)
 {
+	char component[FileNameMaxLen + 2];
+	int parent = sector;
+	int found = DirectorySector; // "/" is the root itself
+	bool isDirectory = TRUE;
+	char *p = name;
 
-	char rootPath[256];
-	char restPath[256];
-
-	if (name[1] == '\0')
-	{
-		return 1; // root, return directory sector
-	}
-	else
+	while (*p == '/' && p[1] != '\0')
 	{
-		bool LastLevel = true;
-		int split = 0;
-		// -> /t0/bb
-		for (int i = 1; name[i] != '\0'; i++)
+		int length = 1;
+		while (p[length] != '\0' && p[length] != '/')
+			length++;
+		if (length > FileNameMaxLen + 1)
+			return -1; // too long to be any entry, with its '/'
+		strncpy(component, p, length); // keep the leading '/', as
+		component[length] = '\0';	   // the entries do
+		p += length;
+
+		if (!isDirectory)
+			return -1; // a file in the middle of the path
+		if (parent == -1 || !dentries.Lookup(parent, component, &found, &isDirectory))
 		{
-			if (name[i] == '/')
+			Directory *directory = this;
+			OpenFile *file = NULL;
+			if (parent != -1)
 			{
-				strncpy(rootPath, name, i); // copy ith words
-				rootPath[i] = '\0';			// rootPath -> /t0
-				LastLevel = false;
-				split = i;
-				break;
+				file = new OpenFile(parent);
+				file->InodeLock()->AcquireRead();
+				directory = new Directory(NumDirEntries);
+				directory->FetchFrom(file);
 			}
-		}
-		if (LastLevel)
-		{
-			strcpy(rootPath, name);
-			strcat(rootPath, "\0");
-			return Find(rootPath);
-		}
-		else
-		{
-			int sector = Find(rootPath);
-			if (sector == -1)
-				return -1;
-			Directory *directory = new Directory(DirectoryFileSize); // 9+1
-			OpenFile *directoryFile = new OpenFile(sector);
-			directory->FetchFrom(directoryFile);
-			/*for(int i = 0; name[split+i] != '\0'; i++)
-				restPath[i] = name[split+i];
-			*/
-			for (int i = 1; i < strlen(name); i++)
+			if (!directory->Lookup(component, &found, &isDirectory))
+			{
+				found = -1;
+				isDirectory = FALSE;
+			}
+			if (parent != -1)
 			{
-				if (name[i] == '/')
-				{
-					for (int j = 0; j < strlen(name) - i + 1; j++)
-						restPath[j] = name[j + i];
-					break;
-				}
+				dentries.Enter(parent, component, found, isDirectory);
+				file->InodeLock()->ReleaseRead();
+				delete directory;
+				delete file;
 			}
-			sector = directory->FindPath(restPath);
-			delete directory;
-			delete directoryFile;
-			return sector;
 		}
+		if (found == -1)
+			return -1;
+		parent = found;
 	}
+	return found;
 }
 
 bool Directory::IsDirectory(char *name)
 {
-	int i = FindIndex(name);
-	if (i != -1)
-		return table[i].isDirectory;
+	int found;
+	bool isDirectory;
+
+	if (Lookup(name, &found, &isDirectory))
+		return isDirectory;
 	return -1;
 }
@@ -1,12 +1,20 @@
 // directory.h
 //	Data structures to manage a UNIX-like directory of file names.
 //
-//      A directory is a table of pairs: <file name, sector #>,
+//      A directory is a set of pairs: <file name, sector #>,
 //	giving the name of each file in the directory, and
 //	where to find its file header (the data structure describing
 //	where to find the file's data blocks) on disk.
 //
-//      We assume mutual exclusion is provided by the caller.
+//	On disk, the pairs are kept in a B+tree inside the directory
+//	file, so a directory grows as entries are added to it.
+//	Directories written before that are a fixed table of
+//	entries; they are still read, and are turned into a B+tree the
+//	first time they fill up.
+//
+//      We assume mutual exclusion is provided by the caller, which
+//	locks the directory file (OpenFile::InodeLock) for reading or
+//	writing around its use of a Directory.
 //
 // Copyright (c) 1992-1993 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation
@@ -40,6 +48,45 @@ public:
                                  // the trailing '\0'
 };
 
+// The B+tree is made of fixed size nodes; node n is at offset
+// n * BTreeNodeSize in the directory file.  Node 0 only holds the
+// BTreeSuper, which locates the root.  A leaf holds up to BTreeSlots
+// entries, sorted by name, and the sector of the next leaf.  An interior
+// node holds in slots[0].sector its leftmost child, and in slots[i]
+// (1 <= i <= count) a key and the child holding the names >= that key.
+//
+// Removing an entry never merges nodes; they just get emptier.
+
+#define BTreeMagic 0x65725442 // "BTre"; an old table starts with a bool
+#define BTreeNodeSize 512
+#define BTreeSlots 31
+
+class BTreeSlot
+{
+public:
+  int sector;                    // header of the file, or the child node
+  bool isDirectory;
+  char name[FileNameMaxLen + 1];
+};
+
+class BTreeNode
+{
+public:
+  int isLeaf;
+  int count; // entries in a leaf; keys in an interior node
+  int next;  // next leaf, or -1
+  BTreeSlot slots[BTreeSlots];
+};
+
+class BTreeSuper
+{
+public:
+  int magic;    // BTreeMagic
+  int root;     // node number of the root
+  int numNodes; // nodes in the file, including this one
+  int count;    // entries in the directory
+};
+
 // The following class defines a UNIX-like "directory".  Each entry in
 // the directory describes a file, and where to find it on disk.
 //
@@ -49,6 +96,17 @@ public:
 // The constructor initializes a directory structure in memory; the
 // FetchFrom/WriteBack operations shuffle the directory information
 // from/to disk.
+//
+// A B+tree directory is read a node at a time, as it is searched, and
+// every change is written through to the file at once.  "table" then
+// only holds a copy of the entries, in name order, made when the caller
+// asks for it (getTable).
+//
+// In memory, the entries of the table are also chained into a hash table by
+// name, so lookups within a directory do not scan the whole table.
+// Path lookups (FindPath) go through a cache of recent results, keyed
+// by the sector of the parent directory and the name, so a warm path
+// costs no directory reads at all.
 
 class Directory
 {
@@ -58,11 +116,14 @@ public:
   ~Directory();        // De-allocate the directory
 
   void FetchFrom(OpenFile *file); // Init directory contents from disk
-  void WriteBack(OpenFile *file); // Write modifications to
+  bool WriteBack(OpenFile *file); // Write modifications to
                                   // directory contents back to disk
 
   int Find(char *name); // Find the sector number of the
                         // FileHeader for file: "name"
+  bool Lookup(char *name, int *fileSector, bool *isDirectory);
+                        // Find both the sector and the kind
+                        // of the entry called "name"
 
   bool Add(char *, int, bool); // Add a file name into the directory
 
@@ -77,8 +138,9 @@ public:
 
   bool IsDirectory(char *name);
   void RecursiveList();
-  int getTableSize() { return tableSize; }
+  int getTableSize() { Snapshot(); return tableSize; }
   DirectoryEntry *getTable() { 
+    Snapshot();
     return table; }
 
 private:
@@ -93,8 +155,40 @@ private:
   DirectoryEntry *table; // Table of pairs:
                          // <file name, file header location>
 
+  int sector;            // Where the directory's header is, once
+                         //  read or written; -1 before that
+  enum { DirNew, DirTable, DirBTree } format;
+                         // Not on disk yet, an old fixed table,
+                         //  or a B+tree
+  OpenFile *dirFile;     // The directory file, if a B+tree
+  BTreeSuper super;      // Its node 0
+  bool stale;            // "table" is out of date with the tree?
+  int *hashHeads;        // First entry in use in each hash chain
+  int *hashNext;         // Next entry in the same chain
+
   int FindIndex(char *name); // Find the index into the directory
                              //  table corresponding to "name"
+  void Hash(int i);          // Enter table[i] in its hash chain
+  void Unhash(int i);        // Take table[i] out of its chain
+  void Rehash();             // Rebuild the chains from the table
+  void Resize(int size);     // Make room for "size" table entries
+  void Snapshot();           // Copy the tree's entries into "table"
+
+  bool MakeTree();           // Write an empty B+tree to dirFile
+  void ReadNode(int n, BTreeNode *node);
+  bool WriteNode(int n, BTreeNode *node);
+  bool WriteSuper();
+  int NewNode();             // Number of a node added to the file
+  bool Reserve(int nodes);   // Grow dirFile to hold "nodes" nodes
+  int FindLeaf(char *name, BTreeNode *leaf);
+                             // Leaf that would hold "name"
+  bool InsertInto(int n, BTreeSlot *entry, BTreeSlot *promoted,
+                  bool *split);
+                             // Add "entry" below node n; "split" if
+                             //  n was split, with "promoted" the
+                             //  key and node of its new sibling
+  bool Insert(char *name, int newSector, bool isDirectory);
+  bool Delete(char *name);
 };
 
 #endif // DIRECTORY_H
@@ -32,6 +32,7 @@
 #define Limit2 NumDirect *SectorSize
 #define Limit3 NumDirect *NumDirect *SectorSize
 #define Limit4 NumDirect *NumDirect *NumDirect *SectorSize
+#define Limit5 NumDirect *NumDirect *NumDirect *NumDirect *SectorSize
 //----------------------------------------------------------------------
 // MP4 mod tag
 // FileHeader::FileHeader
@@ -44,18 +45,20 @@ FileHeader::FileHeader()
 	numBytes = -1;
 	numSectors = -1;
 	memset(dataSectors, -1, sizeof(dataSectors));
+	for (int i = 0; i < (int)NumDirect; i++)
+		children[i] = NULL;
+	numCached = 0;
 }
 
 //----------------------------------------------------------------------
 // MP4 mod tag
 // FileHeader::~FileHeader
-//	Currently, there is not need to do anything in destructor function.
-//	However, if you decide to add some "in-core" data in header
-//	Always remember to deallocate their space or you will leak memory
+//	Free the in-core copies of the child headers (and, through their
+//	destructors, everything loaded below them).
 //----------------------------------------------------------------------
 FileHeader::~FileHeader()
 {
-	// nothing to do now
+	ForgetChildren();
 }
 
 //----------------------------------------------------------------------
@@ -65,11 +68,67 @@ FileHeader::~FileHeader()
 //	Return FALSE if there are not enough free blocks to accomodate
 //	the new file.
 //
+//	The file is stored as extents if possible, as a (possibly
+//	indirect) table of sectors otherwise.
+//
 //	"freeMap" is the bit map of free disk sectors
 //	"fileSize" is the bit map of free disk sectors
 //----------------------------------------------------------------------
 
 bool FileHeader::Allocate(PersistentBitmap *freeMap, int fileSize)
+{
+	if (freeMap->NumClear() < divRoundUp(fileSize, SectorSize))
+		return FALSE; // not enough space
+	if (AllocateExtents(freeMap, fileSize))
+		return TRUE;
+	DEBUG(dbgFile, "Free space too fragmented for extents, using an index");
+	return AllocateIndexed(freeMap, fileSize);
+}
+
+//----------------------------------------------------------------------
+// FileHeader::AllocateExtents
+// 	Allocate the data blocks as at most MaxExtents runs of consecutive
+//	sectors, each found best-fit in the free map.  If the file does
+//	not fit in that many runs, give the runs back and return FALSE.
+//----------------------------------------------------------------------
+
+bool FileHeader::AllocateExtents(PersistentBitmap *freeMap, int fileSize)
+{
+	int left = divRoundUp(fileSize, SectorSize);
+	int i;
+
+	numBytes = fileSize;
+	numSectors = ExtentHeader;
+	for (i = 0; i < (int)MaxExtents; i++)
+	{
+		dataSectors[2 * i] = -1;
+		dataSectors[2 * i + 1] = 0;
+	}
+	for (i = 0; left > 0 && i < (int)MaxExtents; i++)
+	{
+		int found;
+		int start = freeMap->FindAndSetRun(left, &found);
+		ASSERT(start >= 0); // we checked there was enough free space
+		dataSectors[2 * i] = start;
+		dataSectors[2 * i + 1] = found;
+		left -= found;
+	}
+	if (left > 0)
+	{
+		Deallocate(freeMap);
+		return FALSE;
+	}
+	DEBUG(dbgFile, "Allocated " << numBytes << " bytes as " << i << " extents");
+	return TRUE;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::AllocateIndexed
+// 	Allocate the data blocks one sector at a time, building indirect
+//	headers for files that do not fit in a single table.
+//----------------------------------------------------------------------
+
+bool FileHeader::AllocateIndexed(PersistentBitmap *freeMap, int fileSize)
 {
 	numBytes = fileSize;
 	numSectors = divRoundUp(fileSize, SectorSize); // total # of sectors
@@ -90,11 +149,12 @@ bool FileHeader::Allocate(PersistentBitmap *freeMap, int fileSize)
 				dataSectors[i] = freeMap->FindAndSet();
 				FileHeader *subhdr = new FileHeader;
 				if (fileSize > Limit4)
-					subhdr->Allocate(freeMap, Limit4);
+					subhdr->AllocateIndexed(freeMap, Limit4);
 				else
-					subhdr->Allocate(freeMap, fileSize);
+					subhdr->AllocateIndexed(freeMap, fileSize);
 				fileSize -= Limit4;
 				subhdr->WriteBack(dataSectors[i]);
+				delete subhdr;
 				i++;
 			}
 		}
@@ -108,11 +168,12 @@ bool FileHeader::Allocate(PersistentBitmap *freeMap, int fileSize)
 				dataSectors[i] = freeMap->FindAndSet();
 				FileHeader *subhdr = new FileHeader;
 				if (fileSize > Limit3)
-					subhdr->Allocate(freeMap, Limit3);
+					subhdr->AllocateIndexed(freeMap, Limit3);
 				else
-					subhdr->Allocate(freeMap, fileSize);
+					subhdr->AllocateIndexed(freeMap, fileSize);
 				fileSize -= Limit3;
 				subhdr->WriteBack(dataSectors[i]);
+				delete subhdr;
 				i++;
 			}
 		}
@@ -126,11 +187,12 @@ bool FileHeader::Allocate(PersistentBitmap *freeMap, int fileSize)
 				dataSectors[i] = freeMap->FindAndSet();
 				FileHeader *subhdr = new FileHeader;
 				if (fileSize > Limit2)
-					subhdr->Allocate(freeMap, Limit2);
+					subhdr->AllocateIndexed(freeMap, Limit2);
 				else
-					subhdr->Allocate(freeMap, fileSize);
+					subhdr->AllocateIndexed(freeMap, fileSize);
 				fileSize -= Limit2;
 				subhdr->WriteBack(dataSectors[i]);
+				delete subhdr;
 				i++;
 			}
 		}
@@ -155,48 +217,58 @@ bool FileHeader::Allocate(PersistentBitmap *freeMap, int fileSize)
 //----------------------------------------------------------------------
 // FileHeader::Deallocate
 // 	De-allocate all the space allocated for data blocks for this file.
+//	Child headers already in memory are reused; the others are read
+//	in one at a time and dropped again once freed.
 //
 //	"freeMap" is the bit map of free disk sectors
 //----------------------------------------------------------------------
 
 void FileHeader::Deallocate(PersistentBitmap *freeMap)
 {
-	// 1st level
-	if (numBytes > Limit4)
+	// inline: the data is in the header, nothing else to free
+	if (IsInline())
+		return;
+	// extents
+	else if (IsExtent())
 	{
-		for (int i = 0; i < divRoundUp(numSectors, NumDirect); i++)
+		for (int i = 0; i < (int)MaxExtents; i++)
 		{
-			FileHeader *subhdr = new FileHeader;
-			subhdr->FetchFrom(dataSectors[i]);
-			subhdr->Deallocate(freeMap);
-		}
-	}
-	// 2nd level
-	else if (numBytes > Limit3)
-	{
-		for (int i = 0; i < divRoundUp(numSectors, NumDirect); i++)
-		{
-			FileHeader *subhdr = new FileHeader;
-			subhdr->FetchFrom(dataSectors[i]);
-			subhdr->Deallocate(freeMap);
+			if (dataSectors[2 * i] == -1)
+				continue; // hole
+			for (int j = 0; j < dataSectors[2 * i + 1]; j++)
+			{
+				ASSERT(freeMap->Test(dataSectors[2 * i] + j));
+				freeMap->Clear(dataSectors[2 * i] + j);
+			}
 		}
 	}
-	// 3rd level
-	else if (numBytes > Limit2)
+	// indirect header: free what each child points to, then the child
+	else if (EntrySpan() > SectorSize)
 	{
-		for (int i = 0; i < divRoundUp(numSectors, NumDirect); i++)
+		for (int i = 0; i < NumEntries(); i++)
 		{
-			FileHeader *subhdr = new FileHeader;
-
-			subhdr->FetchFrom(dataSectors[i]);
+			if (dataSectors[i] == -1)
+				continue; // hole
+			FileHeader *subhdr = children[i];
+			if (subhdr == NULL)
+			{
+				subhdr = new FileHeader;
+				subhdr->FetchFrom(dataSectors[i]);
+			}
 			subhdr->Deallocate(freeMap);
+			if (subhdr != children[i])
+				delete subhdr;
+			ASSERT(freeMap->Test((int)dataSectors[i]));
+			freeMap->Clear((int)dataSectors[i]);
 		}
 	}
-	// 4th level
+	// direct header
 	else
 	{
 		for (int i = 0; i < numSectors; i++)
 		{
+			if (dataSectors[i] == -1)
+				continue; // hole
 			ASSERT(freeMap->Test((int)dataSectors[i])); // ought to be marked!
 			freeMap->Clear((int)dataSectors[i]);
 		}
@@ -205,40 +277,41 @@ void FileHeader::Deallocate(PersistentBitmap *freeMap)
 
 //----------------------------------------------------------------------
 // FileHeader::FetchFrom
-// 	Fetch contents of file header from disk.
+// 	Fetch contents of file header from disk.  Only the disk part of
+//	the header is read; any children loaded for the old contents are
+//	dropped.
 //
 //	"sector" is the disk sector containing the file header
 //----------------------------------------------------------------------
 
 void FileHeader::FetchFrom(int sector)
 {
-	kernel->synchDisk->ReadSector(sector, (char *)this);
+	char buf[SectorSize];
 
-	/*
-		MP4 Hint:
-		After you add some in-core informations, you will need to rebuild the header's structure
-	*/
+	kernel->synchDisk->ReadSector(sector, buf);
+	memcpy(&numBytes, buf, sizeof(numBytes));
+	memcpy(&numSectors, buf + sizeof(numBytes), sizeof(numSectors));
+	memcpy(dataSectors, buf + 2 * sizeof(int), sizeof(dataSectors));
+	ForgetChildren();
 }
 
 //----------------------------------------------------------------------
 // FileHeader::WriteBack
 // 	Write the modified contents of the file header back to disk.
+//	Only the disk part is written; the in-core children are not.
 //
 //	"sector" is the disk sector to contain the file header
 //----------------------------------------------------------------------
 
 void FileHeader::WriteBack(int sector)
 {
-	kernel->synchDisk->WriteSector(sector, (char *)this);
-
-	/*
-		MP4 Hint:
-		After you add some in-core informations, you may not want to write all fields into disk.
-		Use this instead:
-		char buf[SectorSize];
-		memcpy(buf + offset, &dataToBeWritten, sizeof(dataToBeWritten));
-		...
-	*/
+	char buf[SectorSize];
+
+	memset(buf, 0, SectorSize);
+	memcpy(buf, &numBytes, sizeof(numBytes));
+	memcpy(buf + sizeof(numBytes), &numSectors, sizeof(numSectors));
+	memcpy(buf + 2 * sizeof(int), dataSectors, sizeof(dataSectors));
+	kernel->synchDisk->WriteSector(sector, buf);
 }
 
 //----------------------------------------------------------------------
@@ -248,41 +321,565 @@ void FileHeader::WriteBack(int sector)
 //	offset in the file) to a physical address (the sector where the
 //	data at the offset is stored).
 //
+//	Child headers are loaded on first use and kept in memory, so
+//	later lookups are pure array indexing.  The cache is bounded by
+//	MaxCachedIndexBlocks: once that many blocks are loaded, they are
+//	all dropped before the next lookup and reloaded as needed.
+//
 //	"offset" is the location within the file of the byte in question
 //----------------------------------------------------------------------
 
 int FileHeader::ByteToSector(int offset)
 {
-	// 1st level
-	if (numBytes > Limit4)
+	if (numCached >= MaxCachedIndexBlocks)
 	{
-		int which = -1;
-		which = divRoundDown(offset, Limit4);
-		FileHeader *subhdr = new FileHeader;
-		subhdr->FetchFrom(dataSectors[which]);
-		subhdr->ByteToSector(offset - Limit4 * which);
+		DEBUG(dbgFile, "Dropping " << numCached << " cached index blocks");
+		ForgetChildren();
 	}
-	// 2nd level
-	else if (numBytes > Limit3)
+	return Lookup(offset, &numCached);
+}
+
+//----------------------------------------------------------------------
+// FileHeader::Lookup
+// 	Translate "offset" (relative to the part of the file this header
+//	covers) into a disk sector, descending through the child headers.
+//
+//	"loaded" counts the child headers read in from disk on the way
+//----------------------------------------------------------------------
+
+int FileHeader::Lookup(int offset, int *loaded)
+{
+	if (IsInline())
+		return -1; // no data sectors; see ReadInline
+	if (IsExtent())
+	{
+		int sector = offset / SectorSize;
+		for (int i = 0; i < (int)MaxExtents; i++)
+		{
+			if (sector < dataSectors[2 * i + 1])
+			{
+				if (dataSectors[2 * i] == -1)
+					return -1; // hole
+				return dataSectors[2 * i] + sector;
+			}
+			sector -= dataSectors[2 * i + 1];
+		}
+		return -1; // past the last extent
+	}
+
+	int span = EntrySpan();
+	int which = offset / span;
+
+	if (span == SectorSize || dataSectors[which] == -1)
+		return dataSectors[which];
+	return Child(which, loaded)->Lookup(offset - which * span, loaded);
+}
+
+//----------------------------------------------------------------------
+// FileHeader::Child
+// 	Return the in-core copy of child header "which", reading it from
+//	disk the first time it is asked for.
+//
+//	"loaded" is incremented when the child has to be read in
+//----------------------------------------------------------------------
+
+FileHeader *
+FileHeader::Child(int which, int *loaded)
+{
+	ASSERT(which >= 0 && which < NumEntries());
+	if (children[which] == NULL)
 	{
-		int which = -1;
-		which = divRoundDown(offset, Limit3);
-		FileHeader *subhdr = new FileHeader;
-		subhdr->FetchFrom(dataSectors[which]);
-		subhdr->ByteToSector(offset - Limit3 * which);
+		children[which] = new FileHeader;
+		children[which]->FetchFrom(dataSectors[which]);
+		(*loaded)++;
 	}
-	// 3rd level
+	return children[which];
+}
+
+//----------------------------------------------------------------------
+// FileHeader::ForgetChildren
+// 	Free every child header held in memory.
+//----------------------------------------------------------------------
+
+void FileHeader::ForgetChildren()
+{
+	for (int i = 0; i < (int)NumDirect; i++)
+	{
+		if (children[i] != NULL)
+		{
+			delete children[i];
+			children[i] = NULL;
+		}
+	}
+	numCached = 0;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::EntrySpan
+// 	Return how many bytes of the file each entry of dataSectors
+//	covers: one sector for a direct header, or the whole span of a
+//	child header for an indirect one.
+//----------------------------------------------------------------------
+
+int FileHeader::EntrySpan()
+{
+	if (numBytes > Limit4)
+		return Limit4;
+	else if (numBytes > Limit3)
+		return Limit3;
 	else if (numBytes > Limit2)
+		return Limit2;
+	return SectorSize;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::NumEntries
+// 	Return how many entries of dataSectors are in use.
+//----------------------------------------------------------------------
+
+int FileHeader::NumEntries()
+{
+	return divRoundUp(numBytes, EntrySpan());
+}
+
+//----------------------------------------------------------------------
+// FileHeader::Initialize
+// 	Initialize a fresh file header for a file of "fileSize" bytes
+//	that has no disk space yet: every sector is a hole, to be
+//	allocated when it is first written.  A file small enough is made
+//	inline instead, with its bytes (all zeros) in the header.
+//----------------------------------------------------------------------
+
+void FileHeader::Initialize(int fileSize)
+{
+	ForgetChildren();
+	numBytes = fileSize;
+	if (fileSize <= MaxInlineSize)
 	{
-		int which = -1;
-		which = divRoundDown(offset, Limit2);
-		FileHeader *subhdr = new FileHeader;
-		subhdr->FetchFrom(dataSectors[which]);
-		subhdr->ByteToSector(offset - Limit2 * which);
+		numSectors = InlineHeader;
+		memset(dataSectors, 0, sizeof(dataSectors));
+		return;
+	}
+	numSectors = ExtentHeader;
+	for (int i = 0; i < (int)MaxExtents; i++)
+	{
+		dataSectors[2 * i] = -1;
+		dataSectors[2 * i + 1] = 0;
 	}
-	// 4th level
-	else
-		return (dataSectors[offset / SectorSize]);
+}
+
+//----------------------------------------------------------------------
+// FileHeader::Extend
+// 	Make the file "fileSize" bytes long.  The new part of the file is
+//	a hole; an indexed header may need index blocks (and levels) of
+//	its own, which are allocated here.
+//
+//	An inline file stays inline while it fits; past that, its bytes
+//	are moved out to a data sector first.
+//
+//	Return FALSE if the file would be too large, or the disk is full.
+//----------------------------------------------------------------------
+
+bool FileHeader::Extend(PersistentBitmap *freeMap, int fileSize)
+{
+	if (fileSize <= numBytes)
+		return TRUE;
+	if (fileSize > Limit5)
+		return FALSE;
+	if (IsInline())
+	{
+		if (fileSize <= MaxInlineSize)
+		{
+			numBytes = fileSize; // the bytes past the end are zeros
+			return TRUE;
+		}
+		if (!Promote(freeMap))
+			return FALSE;
+	}
+	if (IsExtent())
+	{
+		numBytes = fileSize; // the extents need not cover the end
+		return TRUE;
+	}
+	return Grow(freeMap, fileSize, &numCached);
+}
+
+//----------------------------------------------------------------------
+// FileHeader::AllocateRange
+// 	Allocate disk sectors for every hole among "count" sectors of the
+//	file, starting at file sector "firstSector".  Each hole is given
+//	sectors as contiguous as the free map allows.
+//
+//	Return FALSE if the disk is full.
+//----------------------------------------------------------------------
+
+bool FileHeader::AllocateRange(PersistentBitmap *freeMap, int firstSector, int count)
+{
+	int end = firstSector + count;
+	int i = firstSector;
+
+	ASSERT(!IsInline()); // growing it would have promoted it
+
+	while (i < end)
+	{
+		if (ByteToSector(i * SectorSize) != -1)
+		{
+			i++;
+			continue;
+		}
+		int holeEnd = i + 1;
+		while (holeEnd < end && ByteToSector(holeEnd * SectorSize) == -1)
+			holeEnd++;
+		if (!FillHole(freeMap, i, holeEnd - i))
+			return FALSE;
+		i = holeEnd;
+	}
+	return TRUE;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::FillHole
+// 	Allocate "length" sectors for the hole at file sector "fileSector".
+//	Sectors right after the one before the hole are preferred, so that
+//	a file written sequentially stays contiguous; otherwise a free run
+//	is found best-fit for the rest of the file.
+//----------------------------------------------------------------------
+
+bool FileHeader::FillHole(PersistentBitmap *freeMap, int fileSector, int length)
+{
+	while (length > 0)
+	{
+		int prev = -1, disk, found = 0;
+
+		if (fileSector > 0)
+			prev = ByteToSector((fileSector - 1) * SectorSize);
+		if (prev != -1)
+		{
+			disk = prev + 1;
+			while (found < length && disk + found < NumSectors &&
+				   !freeMap->Test(disk + found))
+				found++;
+		}
+		if (found == 0)
+		{
+			int rest = divRoundUp(numBytes, SectorSize) - fileSector;
+			disk = freeMap->FindRun(max(length, rest), &found);
+			if (disk == -1)
+				return FALSE; // disk full
+			found = min(found, length);
+		}
+		for (int i = disk; i < disk + found; i++)
+			freeMap->Mark(i);
+
+		if (IsExtent() && !PlaceRun(fileSector, disk, found))
+		{
+			DEBUG(dbgFile, "Out of extents, converting to an index");
+			if (!ConvertToIndexed(freeMap))
+				return FALSE;
+		}
+		if (!IsExtent())
+		{
+			for (int i = 0; i < found; i++)
+			{
+				if (!MapSector(freeMap, (fileSector + i) * SectorSize,
+							   disk + i, &numCached))
+				{
+					for (; i < found; i++)
+						freeMap->Clear(disk + i);
+					return FALSE;
+				}
+			}
+		}
+		fileSector += found;
+		length -= found;
+	}
+	return TRUE;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::ReadInline/WriteInline
+// 	Copy "numBytes" bytes of an inline file, from "position", out of
+//	or into the header.  A write past the end makes the file longer;
+//	it must still fit in MaxInlineSize.  Writing the header back to
+//	disk is left to the caller.
+//----------------------------------------------------------------------
+
+void FileHeader::ReadInline(char *into, int numBytes, int position)
+{
+	ASSERT(IsInline() && position + numBytes <= this->numBytes);
+	memcpy(into, (char *)dataSectors + position, numBytes);
+}
+
+void FileHeader::WriteInline(char *from, int numBytes, int position)
+{
+	ASSERT(IsInline() && position + numBytes <= MaxInlineSize);
+	memcpy((char *)dataSectors + position, from, numBytes);
+	this->numBytes = max(this->numBytes, position + numBytes);
+}
+
+//----------------------------------------------------------------------
+// FileHeader::Promote
+// 	Turn an inline header into an extent header for the same bytes,
+//	moving them to a data sector of their own (an empty file just
+//	gets no extents).  Return FALSE, changing nothing, if the disk
+//	is full.
+//----------------------------------------------------------------------
+
+bool FileHeader::Promote(PersistentBitmap *freeMap)
+{
+	char data[SectorSize];
+	int sector = -1;
+
+	if (numBytes > 0)
+	{
+		sector = freeMap->FindAndSet();
+		if (sector == -1)
+			return FALSE; // disk full
+		memset(data, 0, SectorSize);
+		memcpy(data, dataSectors, numBytes);
+		kernel->synchDisk->WriteSector(sector, data);
+	}
+	DEBUG(dbgFile, "Moving " << numBytes << " inline bytes to sector " << sector);
+	numSectors = ExtentHeader;
+	for (int i = 0; i < (int)MaxExtents; i++)
+	{
+		dataSectors[2 * i] = -1;
+		dataSectors[2 * i + 1] = 0;
+	}
+	if (sector != -1)
+	{
+		dataSectors[0] = sector;
+		dataSectors[1] = 1;
+	}
+	return TRUE;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::NumExtents
+// 	Return how many extents are in use.  The extents in use are packed
+//	at the front, and the last one is never a hole.
+//----------------------------------------------------------------------
+
+int FileHeader::NumExtents()
+{
+	int n = 0;
+
+	while (n < (int)MaxExtents && dataSectors[2 * n + 1] > 0)
+		n++;
+	return n;
+}
+
+//----------------------------------------------------------------------
+// AppendRun
+// 	Add a run to a list of extents, merging it into the previous one
+//	when both are holes or the two are contiguous on disk.
+//----------------------------------------------------------------------
+
+static void
+AppendRun(int *start, int *length, int *count, int runStart, int runLength)
+{
+	int n = *count;
+
+	if (runLength == 0)
+		return;
+	if (n > 0 && ((runStart == -1 && start[n - 1] == -1) ||
+				  (runStart != -1 && start[n - 1] != -1 &&
+				   start[n - 1] + length[n - 1] == runStart)))
+	{
+		length[n - 1] += runLength;
+		return;
+	}
+	start[n] = runStart;
+	length[n] = runLength;
+	*count = n + 1;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::PlaceRun
+// 	Record that file sectors "fileSector" .. "fileSector"+"length"-1,
+//	so far a hole, are now stored at disk sectors from "diskSector".
+//	The hole extent is split around the new run, and the run merged
+//	with its neighbours when they are contiguous.
+//
+//	Return FALSE, changing nothing, if the result would need more
+//	than MaxExtents extents.
+//----------------------------------------------------------------------
+
+bool FileHeader::PlaceRun(int fileSector, int diskSector, int length)
+{
+	int start[MaxExtents + 3], runLength[MaxExtents + 3];
+	int count = 0, base = 0, i;
+	bool placed = FALSE;
+
+	for (i = 0; i < NumExtents(); i++)
+	{
+		int s = dataSectors[2 * i], l = dataSectors[2 * i + 1];
+		if (!placed && fileSector < base + l)
+		{
+			ASSERT(s == -1 && fileSector + length <= base + l);
+			AppendRun(start, runLength, &count, -1, fileSector - base);
+			AppendRun(start, runLength, &count, diskSector, length);
+			AppendRun(start, runLength, &count, -1,
+					  base + l - fileSector - length);
+			placed = TRUE;
+		}
+		else
+			AppendRun(start, runLength, &count, s, l);
+		base += l;
+	}
+	if (!placed)
+	{
+		AppendRun(start, runLength, &count, -1, fileSector - base);
+		AppendRun(start, runLength, &count, diskSector, length);
+	}
+	if (count > (int)MaxExtents)
+		return FALSE;
+
+	for (i = 0; i < (int)MaxExtents; i++)
+	{
+		dataSectors[2 * i] = (i < count) ? start[i] : -1;
+		dataSectors[2 * i + 1] = (i < count) ? runLength[i] : 0;
+	}
+	return TRUE;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::ConvertToIndexed
+// 	Turn an extent header into an indexed one describing the same
+//	sectors, for a file too fragmented to fit in MaxExtents extents.
+//	Only fails if there is no room left for the index blocks.
+//----------------------------------------------------------------------
+
+bool FileHeader::ConvertToIndexed(PersistentBitmap *freeMap)
+{
+	int total = divRoundUp(numBytes, SectorSize);
+	int *sectors = new int[total];
+	bool success = TRUE;
+	int i;
+
+	for (i = 0; i < total; i++)
+		sectors[i] = ByteToSector(i * SectorSize);
+	numSectors = total;
+	memset(dataSectors, -1, sizeof(dataSectors));
+	for (i = 0; i < total && success; i++)
+	{
+		if (sectors[i] != -1)
+			success = MapSector(freeMap, i * SectorSize, sectors[i],
+								&numCached);
+	}
+	delete[] sectors;
+	return success;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::MapSector
+// 	Enter "sector" in the table as the disk sector holding byte
+//	"offset" of the file, allocating the child headers on the way
+//	down if they are holes.  Changed children are written back here;
+//	writing back this header is left to the caller.
+//
+//	"loaded" counts the child headers brought into memory
+//----------------------------------------------------------------------
+
+bool FileHeader::MapSector(PersistentBitmap *freeMap, int offset, int sector,
+						   int *loaded)
+{
+	int span = EntrySpan();
+	int which = offset / span;
+
+	if (span == SectorSize)
+	{
+		dataSectors[which] = sector;
+		return TRUE;
+	}
+	if (dataSectors[which] == -1)
+	{
+		int hdrSector = freeMap->FindAndSet();
+		if (hdrSector == -1)
+			return FALSE; // disk full
+		FileHeader *child = new FileHeader;
+		child->numBytes = min(span, numBytes - which * span);
+		child->numSectors = divRoundUp(child->numBytes, SectorSize);
+		child->WriteBack(hdrSector);
+		dataSectors[which] = hdrSector;
+		children[which] = child;
+		(*loaded)++;
+	}
+	FileHeader *child = Child(which, loaded);
+	if (!child->MapSector(freeMap, offset - which * span, sector, loaded))
+		return FALSE;
+	child->WriteBack(dataSectors[which]);
+	return TRUE;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::Grow
+// 	Raise the length of an indexed header to "fileSize".  While the
+//	table is too small, it is filled up to its capacity and pushed down
+//	a level: its contents move to a new child header, which becomes
+//	entry 0 of this one.
+//----------------------------------------------------------------------
+
+bool FileHeader::Grow(PersistentBitmap *freeMap, int fileSize, int *loaded)
+{
+	int i;
+
+	while (fileSize > EntrySpan() * (int)NumDirect)
+	{
+		int capacity = EntrySpan() * NumDirect;
+		bool empty = TRUE;
+
+		if (!GrowWithin(freeMap, capacity, loaded))
+			return FALSE;
+		for (i = 0; i < NumEntries(); i++)
+			empty = empty && (dataSectors[i] == -1);
+		if (!empty)
+		{
+			int hdrSector = freeMap->FindAndSet();
+			if (hdrSector == -1)
+				return FALSE; // disk full
+			FileHeader *child = new FileHeader;
+			child->numBytes = numBytes;
+			child->numSectors = numSectors;
+			memcpy(child->dataSectors, dataSectors, sizeof(dataSectors));
+			memcpy(child->children, children, sizeof(children));
+			child->WriteBack(hdrSector);
+			memset(dataSectors, -1, sizeof(dataSectors));
+			for (i = 0; i < (int)NumDirect; i++)
+				children[i] = NULL;
+			dataSectors[0] = hdrSector;
+			children[0] = child;
+			(*loaded)++;
+		}
+		numBytes = capacity + 1; // one level up, entry 0 full
+	}
+	return GrowWithin(freeMap, fileSize, loaded);
+}
+
+//----------------------------------------------------------------------
+// FileHeader::GrowWithin
+// 	Raise the length of an indexed header to "fileSize", which must
+//	fit at its current level.  Only the last entry in use can be
+//	partly filled; if it is a child header, that child grows too.
+//----------------------------------------------------------------------
+
+bool FileHeader::GrowWithin(PersistentBitmap *freeMap, int fileSize, int *loaded)
+{
+	int span = EntrySpan();
+	int last = NumEntries() - 1;
+
+	if (span > SectorSize && last >= 0 && dataSectors[last] != -1)
+	{
+		FileHeader *child = Child(last, loaded);
+		if (!child->Grow(freeMap, min(span, fileSize - last * span), loaded))
+			return FALSE;
+		child->WriteBack(dataSectors[last]);
+	}
+	for (int i = last + 1; i < (int)NumDirect; i++)
+		dataSectors[i] = -1;
+	numBytes = fileSize;
+	numSectors = divRoundUp(fileSize, SectorSize);
+	return TRUE;
 }
 
 //----------------------------------------------------------------------
@@ -304,40 +901,66 @@ int FileHeader::FileLength()
 void FileHeader::Print()
 {
 	printf("FileHeader contents.  File size: %d.  File blocks:\n", numBytes);
-	// 4th level
-	if (numBytes > Limit4)
+	// inline
+	if (IsInline())
 	{
-		for (int i = 0; i < numSectors / NumDirect; i++)
+		char *data = (char *)dataSectors;
+		printf("(inline)\nFile contents:\n");
+		for (int k = 0; k < numBytes; k++)
 		{
-			printf("first level hdr: %d\n", dataSectors[i]);
-			OpenFile *openfile = new OpenFile(dataSectors[i]);
-			FileHeader *subhdr = openfile->getHdr();
-			subhdr->Print();
+			if ('\040' <= data[k] && data[k] <= '\176')
+				printf("%c", data[k]);
+			else
+				printf("\\%x", (unsigned char)data[k]);
 		}
+		printf("\n");
 	}
-	// 3rd level
-	else if (numBytes > Limit3)
+	// extents
+	else if (IsExtent())
 	{
-		for (int i = 0; i < numSectors / NumDirect; i++)
+		char *data = new char[SectorSize];
+		int i, j, k;
+		for (i = 0; i < (int)MaxExtents && dataSectors[2 * i + 1] > 0; i++)
+			printf("%d-%d ", dataSectors[2 * i],
+				   dataSectors[2 * i] + dataSectors[2 * i + 1] - 1);
+		printf("\nFile contents:\n");
+		for (i = k = 0; k < numBytes; i++)
 		{
-			printf("first level hdr: %d\n", dataSectors[i]);
-			OpenFile *openfile = new OpenFile(dataSectors[i]);
-			FileHeader *subhdr = openfile->getHdr();
-			subhdr->Print();
+			if (ByteToSector(k) == -1)
+				memset(data, 0, SectorSize); // hole
+			else
+				kernel->synchDisk->ReadSector(ByteToSector(k), data);
+			for (j = 0; (j < SectorSize) && (k < numBytes); j++, k++)
+			{
+				if ('\040' <= data[j] && data[j] <= '\176')
+					printf("%c", data[j]);
+				else
+					printf("\\%x", (unsigned char)data[j]);
+			}
+			printf("\n");
 		}
+		delete[] data;
 	}
-	// 2nd level hdr
-	else if (numBytes > Limit2)
+	// indirect header
+	else if (EntrySpan() > SectorSize)
 	{
-		for (int i = 0; i < numSectors / NumDirect; i++)
+		for (int i = 0; i < NumEntries(); i++)
 		{
 			printf("first level hdr: %d\n", dataSectors[i]);
-			OpenFile *openfile = new OpenFile(dataSectors[i]);
-			FileHeader *subhdr = openfile->getHdr();
+			if (dataSectors[i] == -1)
+				continue; // hole
+			FileHeader *subhdr = children[i];
+			if (subhdr == NULL)
+			{
+				subhdr = new FileHeader;
+				subhdr->FetchFrom(dataSectors[i]);
+			}
 			subhdr->Print();
+			if (subhdr != children[i])
+				delete subhdr;
 		}
 	}
-	// 1st level header
+	// direct header
 	else
 	{
 		char *data = new char[SectorSize];
@@ -347,7 +970,10 @@ void FileHeader::Print()
 		printf("\nFile contents:\n");
 		for (i = k = 0; i < numSectors; i++)
 		{
-			kernel->synchDisk->ReadSector(dataSectors[i], data);
+			if (dataSectors[i] == -1)
+				memset(data, 0, SectorSize); // hole
+			else
+				kernel->synchDisk->ReadSector(dataSectors[i], data);
 			for (j = 0; (j < SectorSize) && (k < numBytes); j++, k++)
 			{
 				if ('\040' <= data[j] && data[j] <= '\176')
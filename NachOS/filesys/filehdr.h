@@ -20,6 +20,28 @@
 #define NumDirect ((SectorSize - 2 * sizeof(int)) / sizeof(int))
 #define MaxFileSize (NumDirect * SectorSize)
 
+// How many index blocks (child headers) an open file may keep in memory
+// at once.  When a lookup finds the limit reached, the cached blocks
+// are dropped and reloaded as needed.
+#define MaxCachedIndexBlocks 32
+
+// An extent header keeps (first sector, number of sectors) pairs in
+// dataSectors instead of one entry per sector, and is told apart from
+// the indexed kind by this value in numSectors.
+#define ExtentHeader (-2)
+#define MaxExtents (NumDirect / 2)
+
+// An inline header keeps the contents of a small file in dataSectors
+// itself, so the file needs no data sectors at all.
+#define InlineHeader (-3)
+#define MaxInlineSize ((int)(NumDirect * sizeof(int)))
+
+// The most sectors Extend can allocate: one to move an inline file's
+// bytes out, and a child header for each level a table is pushed down,
+// at the top (up to three levels) and along the path to its last entry.
+// With this many free, Extend cannot run out of space halfway.
+#define MaxExtendSectors 16
+
 // The following class defines the Nachos "file header" (in UNIX terms,
 // the "i-node"), describing where on disk to find all of the data in the file.
 // The file header is organized as a simple table of pointers to
@@ -34,6 +56,29 @@
 // There is no constructor; rather the file header can be initialized
 // by allocating blocks for the file (if it is a new file), or by
 // reading it from disk.
+//
+// Large files use indirect headers: the entries of a header then point
+// to the sectors of child headers, each covering a fixed span of the
+// file, up to four levels deep.  Children are brought into memory the
+// first time they are needed and kept there, so that after the first
+// touch ByteToSector costs one array index per level instead of one
+// disk read per level.
+//
+// New files are laid out as a few contiguous extents where the free
+// map allows it, and only fall back to the indexed layout when the
+// free space is too fragmented to fit in MaxExtents runs.
+//
+// Files can also be created empty (Initialize) and grow as they are
+// written: Extend raises the length, and AllocateRange gives sectors
+// to the parts of the file that are written.  Parts never written are
+// holes -- a sector number of -1, or a gap between extents -- and
+// read back as zeros.
+//
+// Files of up to MaxInlineSize bytes are created inline: their bytes
+// live in the header sector, where reading the header reads the data
+// too.  OpenFile reads and writes them through ReadInline/WriteInline.
+// Growing such a file past MaxInlineSize moves its bytes to a data
+// sector of their own, and the header becomes an extent header.
 
 class FileHeader
 {
@@ -47,6 +92,14 @@ public:
 														   //  on disk for the file data
 	void Deallocate(PersistentBitmap *bitMap);			   // De-allocate this file's
 														   //  data blocks
+	void Initialize(int fileSize);						   // Initialize a file header
+														   //  for a file of all holes
+	bool Extend(PersistentBitmap *freeMap, int fileSize);  // Grow the file to
+														   //  "fileSize" bytes
+	bool AllocateRange(PersistentBitmap *freeMap, int firstSector, int count);
+														   // Give disk sectors to the
+														   //  holes among "count" file
+														   //  sectors from "firstSector"
 
 	void FetchFrom(int sectorNumber); // Initialize file header from disk
 	void WriteBack(int sectorNumber); // Write modifications to file header
@@ -54,11 +107,17 @@ public:
 
 	int ByteToSector(int offset); // Convert a byte offset into the file
 								  // to the disk sector containing
-								  // the byte
+								  // the byte (-1 for a hole)
 
 	int FileLength(); // Return the length of the file
 					  // in bytes
 
+	bool IsInline() { return numSectors == InlineHeader; }
+	void ReadInline(char *into, int numBytes, int position);
+	void WriteInline(char *from, int numBytes, int position);
+								// Copy bytes of an inline file; a
+								//  write may make the file longer
+
 	void Print(); // Print the contents of the file.
 
 private:
@@ -73,13 +132,54 @@ private:
 		
 		Disk Part - numBytes, numSectors, dataSectors occupy exactly 128 bytes and will be
 		written to a sector on disk.
-		In-core part - none
+		In-core part - children, numCached
 		
 	*/
 
 	int numBytes;				// Number of bytes in the file
 	int numSectors;				// Number of data sectors in the file
 	int dataSectors[NumDirect]; // Disk sector numbers for each data
+								// block, or for each child header
+
+	FileHeader *children[NumDirect]; // In-core copies of the child
+									 // headers, NULL until loaded
+	int numCached;					 // Index blocks loaded below this
+									 // header (kept at the top level)
+
+	int EntrySpan();			// Bytes of the file covered by each
+								// entry of dataSectors
+	int NumEntries();			// Entries of dataSectors in use
+	FileHeader *Child(int which, int *loaded);
+								// Child header "which", loaded into
+								// memory if it is not there yet
+	void ForgetChildren();		// Drop the in-core child headers
+	int Lookup(int offset, int *loaded);
+								// ByteToSector, one level at a time
+
+	bool IsExtent() { return numSectors == ExtentHeader; }
+	bool AllocateExtents(PersistentBitmap *freeMap, int fileSize);
+								// Lay out the file as contiguous runs
+	bool AllocateIndexed(PersistentBitmap *freeMap, int fileSize);
+								// Lay out the file as a table of
+								// sectors (and of child headers)
+
+	int NumExtents();			// Extents in use
+	bool PlaceRun(int fileSector, int diskSector, int length);
+								// Record a new run in the extents
+	bool ConvertToIndexed(PersistentBitmap *freeMap);
+								// Turn the extents into a table
+	bool Promote(PersistentBitmap *freeMap);
+								// Move inline bytes to a data sector
+	bool FillHole(PersistentBitmap *freeMap, int fileSector, int length);
+								// Allocate sectors for one hole
+	bool MapSector(PersistentBitmap *freeMap, int offset, int sector,
+				   int *loaded);
+								// Enter a data sector in the table,
+								// adding child headers as needed
+	bool Grow(PersistentBitmap *freeMap, int fileSize, int *loaded);
+	bool GrowWithin(PersistentBitmap *freeMap, int fileSize, int *loaded);
+								// Raise the length of a table, adding
+								// levels (or not) on the way
 };
 
 #endif // FILEHDR_H
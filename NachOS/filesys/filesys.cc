@@ -28,16 +28,30 @@
 //	modified part of the directory and/or bitmap, we simply discard
 //	the changed version, without writing it back to disk.
 //
+//	The bitmap is also kept in memory, as long as the file system is
+//	up; writing it back only writes the sectors of the bitmap file
+//	whose bits have changed, and discarding changes reads just those
+//	sectors back in (PersistentBitmap::Undo).
+//
+//	Each operation that modifies the file system runs as a journal
+//	transaction (see journal.h), so that a crash in the middle of it
+//	is undone when the disk is next mounted: the metadata sectors it
+//	wrote reach the disk only after the whole group they were
+//	committed in has been logged.
+//
+//	Those transactions also keep changes from running at the same
+//	time.  Every file, directories included, has a reader/writer lock
+//	(see openfile.h): a directory is locked for writing while it is
+//	changed, and for reading while a path is looked up in it.
+//
 // 	Our implementation at this point has the following restrictions:
 //
-//	   there is no synchronization for concurrent accesses
 //	   files have a fixed size, set when the file is created
 //	   files cannot be bigger than about 3KB in size
 //	   there is no hierarchical directory structure, and only a limited
 //	     number of files can be added to the system
-//	   there is no attempt to make the system robust to failures
-//	    (if Nachos exits in the middle of an operation that modifies
-//	    the file system, it may corrupt the disk)
+//	   the contents of files are not journaled, so data written
+//	    just before a crash may be lost, or read back stale
 //
 // Copyright (c) 1992-1993 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation
@@ -51,6 +65,9 @@
 #include "directory.h"
 #include "filehdr.h"
 #include "filesys.h"
+#include "synchdisk.h"
+#include "journal.h"
+#include "main.h"
 
 // Sectors containing the file headers for the bitmap of free sectors,
 // and the directory of files.  These file headers are placed in well-known
@@ -72,8 +89,14 @@
 //	an empty directory, and a bitmap of free sectors (with almost but
 //	not all of the sectors marked as free).
 //
-//	If format = FALSE, we just have to open the files
-//	representing the bitmap and the directory.
+//	Formatting starts by erasing the disk, so that every sector reads
+//	as zeros.  The free part of the bitmap is all zeros already, so
+//	only the file headers, the empty directory and the used prefix of
+//	the bitmap have to be written.  The journal's sectors are set
+//	aside, and an empty journal is started.
+//
+//	If format = FALSE, we just have to replay the journal, then open
+//	the files representing the bitmap and the directory.
 //
 //	"format" -- should we initialize the disk?
 //----------------------------------------------------------------------
@@ -81,19 +104,25 @@
 FileSystem::FileSystem(bool format)
 {
 	DEBUG(dbgFile, "Initializing the file system.");
+	journal = new Journal;
 	if (format)
 	{
-		PersistentBitmap *freeMap = new PersistentBitmap(NumSectors);
+		int startTicks = kernel->stats->totalTicks;
+		double startTime = WallClock();
+		freeMap = new PersistentBitmap(NumSectors);
 		Directory *directory = new Directory(NumDirEntries);
 		FileHeader *mapHdr = new FileHeader;
 		FileHeader *dirHdr = new FileHeader;
 
 		DEBUG(dbgFile, "Formatting the file system.");
+		kernel->synchDisk->Erase();
 
 		// First, allocate space for FileHeaders for the directory and bitmap
 		// (make sure no one else grabs these!)
 		freeMap->Mark(FreeMapSector);
 		freeMap->Mark(DirectorySector);
+		for (int i = 0; i < JournalSectors; i++)
+			freeMap->Mark(JournalStart + i);
 		// Second, allocate space for the data blocks containing the contents
 		// of the directory and bitmap files.  There better be enough space!
 
@@ -115,22 +144,27 @@ FileSystem::FileSystem(bool format)
 		directoryFile = new OpenFile(DirectorySector);
 		// Once we have the files "open", we can write the initial version
 		// of each file back to disk.  The directory at this point is completely
-		// empty; but the bitmap has been changed to reflect the fact that
+		// empty, but the bitmap has been changed to reflect the fact that
 		// sectors on the disk have been allocated for the file headers and
 		// to hold the file data for the directory and bitmap.
 
 		DEBUG(dbgFile, "Writing bitmap and directory back to disk.");
 
-		freeMap->WriteBack(freeMapFile); // flush changes to disk
-
+		freeMap->WriteBackUsed(freeMapFile); // flush changes to disk
 		directory->WriteBack(directoryFile);
+		kernel->synchDisk->Sync();
+		journal->Format();
+
+		DEBUG(dbgFile, "Format took " << kernel->stats->totalTicks - startTicks
+			<< " ticks, " << (int)((WallClock() - startTime) * 1000)
+			<< " ms of host time; disk image holds "
+			<< kernel->synchDisk->ImageBytes() << " bytes");
 
 		if (debug->IsEnabled('f'))
 		{
 			freeMap->Print();
 			directory->Print();
 		}
-		delete freeMap;
 		delete directory;
 		delete mapHdr;
 		delete dirHdr;
@@ -139,9 +173,12 @@ FileSystem::FileSystem(bool format)
 	{
 		// if we are not formatting the disk, just open the files representing
 		// the bitmap and directory; these are left open while Nachos is running
+		journal->Recover();
 		freeMapFile = new OpenFile(FreeMapSector);
 		directoryFile = new OpenFile(DirectorySector);
+		freeMap = new PersistentBitmap(freeMapFile, NumSectors);
 	}
+	kernel->synchDisk->SetJournal(journal);
 }
 
 //----------------------------------------------------------------------
@@ -150,20 +187,25 @@ FileSystem::FileSystem(bool format)
 //----------------------------------------------------------------------
 FileSystem::~FileSystem()
 {
+	// no disk I/O here: the kernel deletes the disk first.  The bitmap
+	// was written back by each operation, and SynchDisk::Sync (called
+	// before halting) writes out the journal's last group.
+	delete freeMap;
 	delete freeMapFile;
 	delete directoryFile;
+	delete journal;
 }
 
 //----------------------------------------------------------------------
 // FileSystem::Create
 // 	Create a file in the Nachos file system (similar to UNIX create).
-//	Since we can't increase the size of files dynamically, we have
-//	to give Create the initial size of the file.
+//	Files grow as they are written, and their data blocks are only
+//	allocated then; "initialSize" just sets the starting length, with
+//	the unwritten part reading as zeros.
 //
 //	The steps to create a file are:
 //	  Make sure the file doesn't already exist
 //        Allocate a sector for the file header
-// 	  Allocate space on disk for the data blocks for the file
 //	  Add the name to the directory
 //	  Store the new file header on disk
 //	  Flush the changes to the bitmap and the directory back to disk
@@ -174,10 +216,9 @@ FileSystem::~FileSystem()
 //   		file is already in directory
 //	 	no free space for file header
 //	 	no free entry for file in directory
-//	 	no free space for data blocks for the file
 //
-// 	Note that this implementation assumes there is no concurrent access
-//	to the file system!
+// 	Other changes to the file system wait for the journal transaction
+//	to end, and lookups in the directory wait for its write lock.
 //
 //	"name" -- name of file to be created
 //	"initialSize" -- size of file to be created
@@ -212,16 +253,17 @@ void FileSystem::CreateDirectory(char *name)
 	int DirecSector, sector;
 	Directory *RootDirectory = new Directory(NumDirEntries);
 	Directory *directory = new Directory(NumDirEntries);
-	OpenFile *file;
-	PersistentBitmap *freeMap;
+	Directory *newDirectory;
+	OpenFile *file, *newFile;
 	FileHeader *hdr;
-	bool success;
+	bool success, allocated;
 
 	int size = DirectoryFileSize;
 	char Path[256];
 	char filename[10];
 	DEBUG(dbgFile, "Creating Directory " << name << " size " << DirectoryFileSize);
 
+	journal->Begin();
 	RootDirectory->FetchFrom(directoryFile);
 
 	SplitPath(name, Path, filename);
@@ -229,33 +271,61 @@ void FileSystem::CreateDirectory(char *name)
 
 	DirecSector = RootDirectory->FindPath(Path);
 	if (DirecSector == -1)
+	{
+		delete RootDirectory;
+		delete directory;
+		journal->Commit();
 		return;
+	}
 
 	file = new OpenFile(DirecSector);
+	file->InodeLock()->AcquireWrite(); // no lookups while it changes
 	directory->FetchFrom(file);
 
-	directory->Find(filename);
-
-	freeMap = new PersistentBitmap(freeMapFile, NumSectors);
-	sector = freeMap->FindAndSet(); // find a sector to hold the file header
-	directory->Add(filename, sector, true);
-
-	hdr = new FileHeader;
-	hdr->Allocate(freeMap, size);
-	hdr->WriteBack(sector);
-	directory->WriteBack(file);
-	freeMap->WriteBack(freeMapFile);
-
-	delete file;
-	delete directory;
-	file = new OpenFile(sector);
-	directory = new Directory(NumDirEntries);
-	directory->WriteBack(file);
-	delete hdr;
-	delete freeMap;
+	if (directory->Find(filename) != -1)
+		success = FALSE; // name is already in directory
+	else
+	{
+		sector = freeMap->FindAndSet(); // find a sector to hold the file header
+		if (sector == -1)
+			success = FALSE; // no free block for file header
+		else
+		{
+			hdr = new FileHeader;
+			allocated = success = hdr->Allocate(freeMap, size);
+			if (success)
+			{
+				// the new directory first, empty, so the entry
+				// never points at garbage
+				hdr->WriteBack(sector);
+				newFile = new OpenFile(sector);
+				newDirectory = new Directory(NumDirEntries);
+				success = newDirectory->WriteBack(newFile);
+				delete newDirectory;
+				delete newFile;
+			}
+			// a directory that fails to grow undoes the unwritten
+			// bitmap changes, so write this one first
+			freeMap->WriteBack(freeMapFile);
+			if (success)
+				success = directory->Add(filename, sector, TRUE);
+			if (!success)
+			{
+				if (allocated)
+					hdr->Deallocate(freeMap); // nothing links to it
+				freeMap->Clear(sector);
+				freeMap->WriteBack(freeMapFile);
+			}
+			else
+				directory->WriteBack(file);
+			delete hdr;
+		}
+	}
+	file->InodeLock()->ReleaseWrite();
 	delete file;
 	delete RootDirectory;
 	delete directory;
+	journal->Commit();
 }
 
 bool FileSystem::Create(char *name, int initialSize)
@@ -264,7 +334,6 @@ bool FileSystem::Create(char *name, int initialSize)
 	Directory *RootDirectory = new Directory(NumDirEntries);
 	Directory *directory = new Directory(NumDirEntries);
 	OpenFile *file;
-	PersistentBitmap *freeMap;
 	FileHeader *hdr;
 	bool success;
 
@@ -272,6 +341,7 @@ bool FileSystem::Create(char *name, int initialSize)
 	char filename[10];
 	DEBUG(dbgFile, "Creating file " << name << " size " << initialSize);
 
+	journal->Begin();
 	RootDirectory->FetchFrom(directoryFile);
 
 	SplitPath(name, Path, filename);
@@ -279,40 +349,53 @@ bool FileSystem::Create(char *name, int initialSize)
 
 	DirecSector = RootDirectory->FindPath(Path);
 	if (DirecSector == -1)
+	{
+		delete RootDirectory;
+		delete directory;
+		journal->Commit();
 		return FALSE;
+	}
 	file = new OpenFile(DirecSector);
+	file->InodeLock()->AcquireWrite(); // no lookups while it changes
 	directory->FetchFrom(file);
 
 	if (directory->Find(filename) != -1)
 		success = FALSE; // file is already in directory
 	else
 	{
-		freeMap = new PersistentBitmap(freeMapFile, NumSectors);
 		sector = freeMap->FindAndSet(); // find a sector to hold the file header
 		if (sector == -1)
 			success = FALSE; // no free block for file header
-		else if (!directory->Add(filename, sector, false))
-			success = FALSE; // no space in directory
 		else
 		{
-			hdr = new FileHeader;
-			if (!hdr->Allocate(freeMap, initialSize))
-				success = FALSE; // no space on disk for data
+			// write the bitmap first: a directory that fails to
+			// grow undoes the unwritten bitmap changes
+			freeMap->WriteBack(freeMapFile);
+			if (!directory->Add(filename, sector, false))
+			{
+				success = FALSE; // no space in directory
+				freeMap->Clear(sector);
+				freeMap->WriteBack(freeMapFile);
+			}
 			else
 			{
+				// no data sectors yet; they are allocated as the file
+				// is written (see OpenFile::WriteAt)
+				hdr = new FileHeader;
+				hdr->Initialize(initialSize);
 				success = TRUE;
 				// everthing worked, flush all changes back to disk
 				hdr->WriteBack(sector);
 				directory->WriteBack(file);
-				freeMap->WriteBack(freeMapFile);
+				delete hdr;
 			}
-			delete hdr;
 		}
-		delete freeMap;
 	}
+	file->InodeLock()->ReleaseWrite();
 	delete file;
 	delete RootDirectory;
 	delete directory;
+	journal->Commit();
 	return success;
 }
 
@@ -371,11 +454,11 @@ char *string_concat(char *str1, char *str2) {
 bool FileSystem::Remove(char *name)
 {
 	Directory *directory;
-	PersistentBitmap *freeMap;
 	FileHeader *fileHdr;
 	int sector;
 	char *temp="/";
 
+	journal->Begin();
 	directory = new Directory(NumDirEntries);
 	directory->FetchFrom(directoryFile);
 	/* get the first token */
@@ -394,6 +477,8 @@ bool FileSystem::Remove(char *name)
 			file = true;
 			break;
 		}
+		if (prev != directoryFile)
+			delete prev;
 		prev = file_tem;
 		file_tem = new OpenFile(sector);
 		directory->FetchFrom(file_tem);
@@ -406,35 +491,41 @@ bool FileSystem::Remove(char *name)
 	else
 		name = token;
 
-	if (file)
-		directory->FetchFrom(file_tem);
-	else
-		directory->FetchFrom(prev);
+	OpenFile *parentFile = file ? file_tem : prev;
+	parentFile->InodeLock()->AcquireWrite(); // no lookups while it changes
+	directory->FetchFrom(parentFile);
 	
 	sector = directory->Find(name);
 
 	if (sector == -1)
 	{
+		parentFile->InodeLock()->ReleaseWrite();
+		if (file_tem != directoryFile)
+			delete file_tem;
+		if (prev != directoryFile && prev != file_tem)
+			delete prev;
 		delete directory;
+		journal->Commit();
 		return FALSE; // file not found
 	}
 	fileHdr = new FileHeader;
 	fileHdr->FetchFrom(sector);
 
-	freeMap = new PersistentBitmap(freeMapFile, NumSectors);
-
 	fileHdr->Deallocate(freeMap); // remove data blocks
 	freeMap->Clear(sector);		  // remove header block
+	OpenFile::Removed(sector);	  // no longer open at that sector
 	directory->Remove(name);
 
 	freeMap->WriteBack(freeMapFile); // flush to disk
-	if (file)
-		directory->WriteBack(file_tem); // flush to disk
-	else
-		directory->WriteBack(prev);
+	directory->WriteBack(parentFile); // flush to disk
+	parentFile->InodeLock()->ReleaseWrite();
+	if (file_tem != directoryFile)
+		delete file_tem;
+	if (prev != directoryFile && prev != file_tem)
+		delete prev;
 	delete fileHdr;
 	delete directory;
-	delete freeMap;
+	journal->Commit();
 	return TRUE;
 }
 
@@ -446,15 +537,21 @@ bool FileSystem::Remove(char *name)
 void FileSystem::List(char *name)
 {
 	Directory *directory = new Directory(NumDirEntries);
-	OpenFile *file = NULL;
+	OpenFile *file;
 
 	directory->FetchFrom(directoryFile);
 	int sector = directory->FindPath(name);
-	if (sector >= 0)
-		file = new OpenFile(sector);
+	if (sector < 0)
+	{
+		delete directory; // no such directory
+		return;
+	}
+	file = new OpenFile(sector);
 
+	file->InodeLock()->AcquireRead();
 	directory->FetchFrom(file);
 	directory->List();
+	file->InodeLock()->ReleaseRead();
 
 	delete file;
 	delete directory;
@@ -491,89 +588,240 @@ void FileSystem::RecursiveList(char *name)
 	}
 }
 
+//----------------------------------------------------------------------
+// FileSystem::RecursiveRemove
+// 	Delete a file, or a directory and everything below it.
+//
+//	The parent directory is found once, from the full path; then the
+//	tree is walked once, depth first (RemoveTree).  Directories inside
+//	it are only read, never rewritten, since they go away too.  The
+//	sectors freed are cleared in the in-memory free map as they are
+//	found, so the map is written back just once, at the end.  The only
+//	directory written is the parent, which loses a single entry.  The
+//	whole removal is one journal transaction.
+//
+//	Return TRUE if the file or directory was removed, FALSE if there
+//	is none by that name.
+//
+//	"name" -- the absolute path of what to remove
+//----------------------------------------------------------------------
+
 bool FileSystem::RecursiveRemove(char *name)
 {
-	Directory *directory;
-	PersistentBitmap *freeMap;
-	FileHeader *fileHdr;
-	int sector;
-	char *temp="/";
-
-	directory = new Directory(NumDirEntries);
-	directory->FetchFrom(directoryFile);
-
-	OpenFile *file_tem = directoryFile;
-	OpenFile *file_dir;
+	Directory *root, *parent;
+	OpenFile *parentFile;
+	char path[256], filename[256];
+	int parentSector, sector;
+	bool isDirectory, success = FALSE;
+
+	if (name[0] != '/' || name[1] == '\0' || strlen(name) >= sizeof(path))
+		return FALSE; // not a path; the root itself always stays
+
+	int startTicks = kernel->stats->totalTicks;
+	journal->Begin();
+	root = new Directory(NumDirEntries);
+	root->FetchFrom(directoryFile);
+	SplitPath(name, path, filename);
+	parentSector = root->FindPath(path);
+	if (parentSector != -1)
+	{
+		parentFile = new OpenFile(parentSector);
+		parentFile->InodeLock()->AcquireWrite(); // no lookups in it meanwhile
+		parent = new Directory(NumDirEntries);
+		parent->FetchFrom(parentFile);
+		if (parent->Lookup(filename, &sector, &isDirectory))
+		{
+			int numRemoved = RemoveTree(sector, isDirectory);
+			parent->Remove(filename);
+			parent->WriteBack(parentFile);
+			freeMap->WriteBack(freeMapFile);
+			DEBUG(dbgFile, "Removed " << name << ": " << numRemoved
+				<< " files and directories in "
+				<< kernel->stats->totalTicks - startTicks << " ticks");
+			success = TRUE;
+		}
+		parentFile->InodeLock()->ReleaseWrite();
+		delete parent;
+		delete parentFile;
+	}
+	delete root;
+	journal->Commit();
+	return success;
+}
 
-	char pwd[20], buffer[20];
-	strcpy(pwd, name);
+//----------------------------------------------------------------------
+// FileSystem::RemoveTree
+// 	Free the file or directory whose header is at "sector", and, for
+//	a directory, everything in it.  Only the in-memory free map is
+//	changed.  Returns the number of files and directories freed.
+//----------------------------------------------------------------------
 
-	char *token = strtok(name, "/");
-	char *token_prev;
-	token_prev = token;
+int FileSystem::RemoveTree(int sector, bool isDirectory)
+{
+	FileHeader *hdr;
+	int count = 1;
 
-	while (token != NULL)
+	if (isDirectory)
 	{
-		 token = string_concat(temp,token);
-		if ((sector = directory->Find(token)) == -1 || !directory->IsDirectory(token)){
-			break;
-		}
-		file_tem = new OpenFile(sector);
-		directory->FetchFrom(file_tem);
-		token_prev = token;
-		token = strtok(NULL, "/");
+		OpenFile *file = new OpenFile(sector);
+		Directory *directory = new Directory(NumDirEntries);
+		directory->FetchFrom(file);
+		DirectoryEntry *table = directory->getTable();
+		for (int i = 0; i < directory->getTableSize(); i++)
+			if (table[i].inUse)
+				count += RemoveTree(table[i].sector, table[i].isDirectory);
+		delete directory;
+		delete file;
 	}
-	if (token == NULL)
-		name = token_prev;
-	else
-		name = token;
-	DirectoryEntry *table = directory->getTable();
+	hdr = new FileHeader;
+	hdr->FetchFrom(sector);
+	hdr->Deallocate(freeMap);
+	freeMap->Clear(sector);
+	OpenFile::Removed(sector);
+	delete hdr;
+	return count;
+}
 
-	if (directory->IsDirectory(name))
+//----------------------------------------------------------------------
+// FileSystem::CreateTree
+// 	Create a directory holding a whole tree below it, for testing:
+//	"fanout" empty files (/f0, /f1, ...) in every directory, and,
+//	above the bottom level, "fanout" subdirectories (/d0, /d1, ...),
+//	"depth" levels in all.
+//
+//	Each new directory is built in memory, and written once with all
+//	of its entries.  A large tree is more than one transaction can
+//	hold, so it is written in several (see SplitTransaction), while no
+//	directory on the disk points to it yet; the parent directory gets
+//	its one new entry in the last.  A crash before then leaves the
+//	tree out of the file system, though its sectors stay allocated.
+//	Fails, changing nothing, if the name is taken or the tree might
+//	not fit on the disk.
+//
+//	A directory with MaxTreeFanout files and subdirectories still
+//	fits in TreeTransactionSectors; more are not allowed.
+//
+//	"name" -- the absolute path of the new directory
+//	"depth" -- number of levels of directories, at least 1
+//	"fanout" -- files, and subdirectories, in each directory
+//----------------------------------------------------------------------
+
+bool FileSystem::CreateTree(char *name, int depth, int fanout)
+{
+	Directory *root, *parent;
+	OpenFile *parentFile;
+	char path[256], filename[256];
+	int parentSector, sector;
+	bool success = FALSE;
+
+	if (name[0] != '/' || name[1] == '\0' || strlen(name) >= sizeof(path) ||
+		depth < 1 || fanout < 1 || fanout > MaxTreeFanout)
+		return FALSE;
+
+	// a generous bound on the sectors needed: for each directory, its
+	// header, its initial size and its B+tree nodes, split half full
+	int dirSectors = 1 + divRoundUp(DirectoryFileSize, SectorSize) + 4 +
+					 (BTreeNodeSize / SectorSize) * (2 + 2 * divRoundUp(2 * fanout, BTreeSlots / 2));
+	double numDirs = 0, level = 1;
+	for (int i = 0; i < depth && numDirs <= NumSectors; i++, level *= fanout)
+		numDirs += level;
+	if (numDirs * (dirSectors + fanout) > freeMap->NumClear())
+		return FALSE;
+
+	journal->Begin();
+	root = new Directory(NumDirEntries);
+	root->FetchFrom(directoryFile);
+	SplitPath(name, path, filename);
+	parentSector = root->FindPath(path);
+	if (parentSector != -1)
 	{
-		for (int i = 0; i < directory->getTableSize(); i++){
-			if (table[i].inUse)
+		parentFile = new OpenFile(parentSector);
+		parentFile->InodeLock()->AcquireWrite(); // no lookups in it meanwhile
+		parent = new Directory(NumDirEntries);
+		parent->FetchFrom(parentFile);
+		if (parent->Find(filename) == -1)
+		{
+			sector = freeMap->FindAndSet();
+			BuildTree(sector, depth, fanout);
+			// a directory that fails to grow undoes the unwritten
+			// bitmap changes, so write the tree's first
+			freeMap->WriteBack(freeMapFile);
+			success = parent->Add(filename, sector, TRUE);
+			if (!success)
 			{
-				if (table[i].isDirectory)
-				{
-					int n = sprintf(buffer, "%s/%s", pwd, table[i].name);
-					RecursiveRemove(buffer);
-				}
-				else
-				{
-					sector = directory->Find(table[i].name);
-					fileHdr = new FileHeader;
-					fileHdr->FetchFrom(sector);
-					freeMap = new PersistentBitmap(freeMapFile, NumSectors);
-					fileHdr->Deallocate(freeMap);
-					freeMap->Clear(sector);
-					directory->Remove(table[i].name);
-					freeMap->WriteBack(freeMapFile);
-					directory->WriteBack(file_tem);
-				}
+				RemoveTree(sector, TRUE);
+				freeMap->WriteBack(freeMapFile);
 			}
+			parent->WriteBack(parentFile);
 		}
-		Remove(pwd);
+		parentFile->InodeLock()->ReleaseWrite();
+		delete parent;
+		delete parentFile;
 	}
-	else
-	{
-		printf("IS FILE %s\n", name);
-		sector = directory->Find(name);
-		fileHdr = new FileHeader;
-		fileHdr->FetchFrom(sector);
+	delete root;
+	journal->Commit();
+	return success;
+}
 
-		freeMap = new PersistentBitmap(freeMapFile, NumSectors);
-		fileHdr->Deallocate(freeMap);
-		freeMap->Clear(sector);
-		directory->Remove(name);
+//----------------------------------------------------------------------
+// FileSystem::BuildTree
+// 	Fill in a new directory, with its header at "sector" (already
+//	taken from the free map), and the tree below it, as described
+//	for CreateTree.  The caller has made sure there is room.
+//----------------------------------------------------------------------
 
-		freeMap->WriteBack(freeMapFile);
-		directory->WriteBack(file_tem);
+void FileSystem::BuildTree(int sector, int depth, int fanout)
+{
+	FileHeader *hdr = new FileHeader;
+	Directory *directory = new Directory(2 * fanout);
+	OpenFile *file;
+	char name[FileNameMaxLen + 1];
+	int child;
+
+	ASSERT(hdr->Allocate(freeMap, DirectoryFileSize));
+	for (int i = 0; i < fanout; i++)
+	{
+		FileHeader *childHdr = new FileHeader;
+		child = freeMap->FindAndSet();
+		childHdr->Initialize(0);
+		childHdr->WriteBack(child);
+		delete childHdr;
+		sprintf(name, "/f%d", i);
+		directory->Add(name, child, FALSE);
+		SplitTransaction();
+
+		if (depth > 1)
+		{
+			child = freeMap->FindAndSet();
+			BuildTree(child, depth - 1, fanout);
+			sprintf(name, "/d%d", i);
+			directory->Add(name, child, TRUE);
+		}
 	}
+	hdr->WriteBack(sector);
+	file = new OpenFile(sector);
+	ASSERT(directory->WriteBack(file)); // a new directory: one write, all entries
+	delete file;
+	delete directory;
+	delete hdr;
+	SplitTransaction();
+}
 
-	//delete fileHdr;
-	//delete directory;
-	//delete freeMap;
+//----------------------------------------------------------------------
+// FileSystem::SplitTransaction
+// 	Called by BuildTree between the pieces of a tree that nothing
+//	points to yet.  Once the transaction has grown to
+//	TreeTransactionSectors, write back the free map, which then
+//	covers all that was written, and start a new transaction.
+//----------------------------------------------------------------------
+
+void FileSystem::SplitTransaction()
+{
+	if (journal->Held() < TreeTransactionSectors)
+		return;
+	freeMap->WriteBack(freeMapFile);
+	journal->Commit();
+	journal->Begin();
 }
 
 //----------------------------------------------------------------------
@@ -590,7 +838,6 @@ void FileSystem::Print()
 {
 	FileHeader *bitHdr = new FileHeader;
 	FileHeader *dirHdr = new FileHeader;
-	PersistentBitmap *freeMap = new PersistentBitmap(freeMapFile, NumSectors);
 	Directory *directory = new Directory(NumDirEntries);
 
 	printf("Bit map file header:\n");
@@ -608,8 +855,162 @@ void FileSystem::Print()
 
 	delete bitHdr;
 	delete dirHdr;
-	delete freeMap;
 	delete directory;
 }
 
+// Parameters for the file locking benchmark: each client thread makes
+// LockBenchOps random accesses to LockBenchFiles files, LockBenchBlocks
+// blocks long.  A block (two sectors) is always written whole, with a
+// single byte repeated; one access in LockBenchWrites writes a block,
+// and the rest each read LockBenchReadBlocks blocks.
+
+static const int LockBenchClients = 8;
+static const int LockBenchOps = 32;
+static const int LockBenchFiles = 2;
+static const int LockBenchBlocks = 64;
+static const int LockBenchBlockSize = 2 * SectorSize;
+static const int LockBenchReadBlocks = 4;
+static const int LockBenchWrites = 4;
+
+class LockBenchClient
+{
+public:
+	Lock *global;		 // taken around every access, or NULL
+	int numBytes;		 // bytes read and written
+	int torn;			 // blocks read while half written
+	Semaphore *finished; // V'ed when the client is done
+};
+
+static void
+LockBenchClientThread(void *arg)
+{
+	LockBenchClient *client = (LockBenchClient *)arg;
+	OpenFile *files[LockBenchFiles];
+	char buf[LockBenchReadBlocks * LockBenchBlockSize];
+	char name[16];
+
+	for (int f = 0; f < LockBenchFiles; f++)
+	{
+		sprintf(name, "/lockb%d", f);
+		files[f] = kernel->fileSystem->Open(name);
+		ASSERT(files[f] != NULL);
+	}
+	for (int i = 0; i < LockBenchOps; i++)
+	{
+		OpenFile *file = files[RandomNumber() % LockBenchFiles];
+
+		if (client->global != NULL)
+			client->global->Acquire();
+		if (RandomNumber() % LockBenchWrites == 0)
+		{
+			int block = RandomNumber() % LockBenchBlocks;
+			memset(buf, 'a' + RandomNumber() % 26, LockBenchBlockSize);
+			client->numBytes += file->WriteAt(buf, LockBenchBlockSize,
+											  block * LockBenchBlockSize);
+		}
+		else
+		{
+			int block = RandomNumber() % (LockBenchBlocks - LockBenchReadBlocks + 1);
+			client->numBytes += file->ReadAt(buf, sizeof(buf), block * LockBenchBlockSize);
+			for (int b = 0; b < LockBenchReadBlocks; b++)
+			{
+				char *data = &buf[b * LockBenchBlockSize];
+				for (int j = 1; j < LockBenchBlockSize; j++)
+				{
+					if (data[j] != data[0])
+					{
+						client->torn++;
+						break;
+					}
+				}
+			}
+		}
+		if (client->global != NULL)
+			client->global->Release();
+	}
+	for (int f = 0; f < LockBenchFiles; f++)
+		delete files[f];
+	client->finished->V();
+}
+
+//----------------------------------------------------------------------
+// FileSystem::LockBenchmark
+// 	Run the same mix of reads and writes, from several concurrent
+//	threads, first with one lock taken around every access (the whole
+//	file system serialized), then with only the locks of the files
+//	themselves, and print the elapsed ticks and throughput of each.
+//	Under the file locks, readers of a file share it, so one thread's
+//	disk reads overlap with another's.
+//
+//	Every block read is checked to have been written whole; "torn"
+//	counts the ones that were not, which the locks should prevent.
+//----------------------------------------------------------------------
+
+void FileSystem::LockBenchmark()
+{
+	static char *passNames[] = {"global lock", "file locks"};
+	LockBenchClient *clients = new LockBenchClient[LockBenchClients];
+	Semaphore *finished = new Semaphore("lock benchmark", 0);
+	char *block = new char[LockBenchBlockSize];
+	char name[16];
+
+	memset(block, 'a', LockBenchBlockSize);
+	for (int f = 0; f < LockBenchFiles; f++)
+	{
+		sprintf(name, "/lockb%d", f);
+		if (!Create(name, 0))
+		{
+			printf("Couldn't create %s\n", name);
+			delete[] block;
+			delete finished;
+			delete[] clients;
+			return;
+		}
+		OpenFile *file = Open(name);
+		for (int b = 0; b < LockBenchBlocks; b++)
+			file->WriteAt(block, LockBenchBlockSize, b * LockBenchBlockSize);
+		delete file;
+	}
+	kernel->synchDisk->Sync();
+
+	for (int pass = 0; pass < 2; pass++)
+	{
+		Lock *global = (pass == 0) ? new Lock("file system") : NULL;
+		int startTicks = kernel->stats->totalTicks;
+		int numBytes = 0, torn = 0;
+
+		for (int c = 0; c < LockBenchClients; c++)
+		{
+			clients[c].global = global;
+			clients[c].numBytes = 0;
+			clients[c].torn = 0;
+			clients[c].finished = finished;
+			Thread *t = new Thread("file client", c + 1);
+			t->Fork((VoidFunctionPtr)LockBenchClientThread, (void *)&clients[c]);
+		}
+		for (int c = 0; c < LockBenchClients; c++)
+			finished->P();
+		for (int c = 0; c < LockBenchClients; c++)
+		{
+			numBytes += clients[c].numBytes;
+			torn += clients[c].torn;
+		}
+
+		int elapsed = kernel->stats->totalTicks - startTicks;
+		cout << passNames[pass] << ": " << numBytes << " bytes in "
+			 << elapsed << " ticks, " << (numBytes * 1000.0) / elapsed
+			 << " bytes per 1000 ticks, " << torn << " torn blocks\n";
+		delete global;
+	}
+
+	for (int f = 0; f < LockBenchFiles; f++)
+	{
+		sprintf(name, "/lockb%d", f);
+		Remove(name);
+	}
+	delete[] block;
+	delete finished;
+	delete[] clients;
+}
+
 #endif // FILESYS_STUB
@@ -34,15 +34,22 @@
 // and the directory of files.  These file headers are placed in well-known
 // sectors, so that they can be located on boot-up.
 
-// Initial file sizes for the bitmap and directory; until the file system
-// supports extensible files, the directory size sets the maximum number
-// of files that can be loaded onto the disk.
+// Initial file sizes for the bitmap and directory.  Directories grow as
+// files are added to them; NumDirEntries is the size of the fixed table
+// that directories used to be, which is still read (see directory.h).
 #define FreeMapSector 0
 #define DirectorySector 1
 #define FreeMapFileSize (NumSectors / BitsInByte)
 #define NumDirEntries 64
 #define DirectoryFileSize (sizeof(DirectoryEntry) * NumDirEntries)
 
+// CreateTree writes a tree in transactions of about TreeTransactionSectors
+// sectors.  A directory is written within one of them, so the largest it
+// makes, with MaxTreeFanout files and as many subdirectories, must still
+// fit in what a transaction may hold (see journal.h).
+#define TreeTransactionSectors 128
+#define MaxTreeFanout 300
+
 #ifndef FS_H
 #define FS_H
 
@@ -87,6 +94,9 @@ public:
 };
 
 #else // FILESYS
+class PersistentBitmap;
+class Journal;
+
 class FileSystem
 {
 public:
@@ -109,14 +119,28 @@ public:
 
 	void List(char *name);			// List all the files in the file system
 	void RecursiveList(char *name); // List all the files in the file system in RecursiveList
-	bool RecursiveRemove(char *name);
+	bool RecursiveRemove(char *name); // Delete a file or directory tree
+	bool CreateTree(char *name, int depth, int fanout);
+	// Create a directory tree, for testing
+	void LockBenchmark(); // Compare file locks with one global lock
 	void Print(); // List all the files and their contents
 
+	OpenFile *FreeMapFile() { return freeMapFile; } // for files that
+	PersistentBitmap *FreeMap() { return freeMap; } // grow as written
+	Journal *GetJournal() { return journal; } // metadata transactions
+
 private:
 	OpenFile *freeMapFile;   // Bit map of free disk blocks,
 							 // represented as a file
+	PersistentBitmap *freeMap; // Its contents, kept in memory
+	Journal *journal;		   // Log of metadata changes
 	OpenFile *directoryFile; // "Root" directory -- list of
 							 // file names, represented as a file
+
+	int RemoveTree(int sector, bool isDirectory);
+	void BuildTree(int sector, int depth, int fanout);
+	void SplitTransaction();  // End a long CreateTree transaction,
+							  // and start another
 };
 
 #endif // FILESYS
@@ -0,0 +1,394 @@
+// journal.cc
+//	Routines to keep a write-ahead journal of file system metadata.
+//
+//	The journal region is used as a log from its start; when the next
+//	group would not fit, everything written home so far is synced to
+//	the disk, and the log starts over (a checkpoint).  Groups carry a
+//	sequence number and a checksum, so replay stops at the first one
+//	that is stale or was only partly written.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+#include "debug.h"
+#include "journal.h"
+#include "synchdisk.h"
+#include "main.h"
+
+//----------------------------------------------------------------------
+// Checksum
+// 	Hash "numBytes" bytes of a group, to tell a group that was written
+//	completely from one that was not.
+//----------------------------------------------------------------------
+
+static unsigned int
+Checksum(char *data, int numBytes)
+{
+	unsigned int *words = (unsigned int *)data;
+	unsigned int sum = 0;
+
+	for (int i = 0; i < numBytes / (int)sizeof(unsigned int); i++)
+		sum = sum * 31 + words[i];
+	return sum;
+}
+
+//----------------------------------------------------------------------
+// Journal::Journal
+// 	Initialize an empty, disabled journal; Format or Recover turn it on.
+//----------------------------------------------------------------------
+
+Journal::Journal()
+{
+	enabled = FALSE;
+	lock = new Lock("journal");
+	owner = NULL;
+	depth = 0;
+	flushing = FALSE;
+	sequence = 1;
+	head = 1;
+	numGroups = 0;
+	crashGroup = 0;
+
+	numHeld = 0;
+	heldBefore = 0;
+	numCommitted = 0;
+	heldSectors = new int[MaxGroupSectors];
+	heldData = new char[MaxGroupSectors * SectorSize];
+	hashHeads = new int[MaxGroupSectors];
+	hashNext = new int[MaxGroupSectors];
+	for (int i = 0; i < MaxGroupSectors; i++)
+		hashHeads[i] = -1;
+}
+
+//----------------------------------------------------------------------
+// Journal::~Journal
+// 	De-allocate the journal.  Held sectors not yet written are lost,
+//	as in a crash.
+//----------------------------------------------------------------------
+
+Journal::~Journal()
+{
+	delete lock;
+	delete[] heldSectors;
+	delete[] heldData;
+	delete[] hashHeads;
+	delete[] hashNext;
+}
+
+//----------------------------------------------------------------------
+// Journal::Format
+// 	Start an empty journal, on a disk being formatted.  The caller
+//	has kept the journal's sectors out of the free map.
+//----------------------------------------------------------------------
+
+void Journal::Format()
+{
+	enabled = TRUE;
+	sequence = 1;
+	head = 1;
+	WriteStart();
+}
+
+//----------------------------------------------------------------------
+// Journal::Recover
+// 	Replay the journal, when the file system is mounted: write each
+//	complete group found in it to the sectors it logged, in order.
+//	Then sync them to the disk and start the journal over.
+//
+//	If the first sector of the region is not a journal, the disk was
+//	formatted without one, and the journal stays disabled.
+//----------------------------------------------------------------------
+
+void Journal::Recover()
+{
+	char first[SectorSize];
+	JournalHeader *header = (JournalHeader *)first;
+	int replayed = 0;
+
+	kernel->synchDisk->ReadSector(JournalStart, first);
+	if (header->magic != JournalMagic || header->count != 0)
+	{
+		DEBUG(dbgFile, "No journal on this disk.");
+		return;
+	}
+	enabled = TRUE;
+	sequence = header->sequence;
+	head = 1;
+
+	while (head < JournalSectors)
+	{
+		kernel->synchDisk->ReadSector(JournalStart + head, first);
+		if (header->magic != JournalMagic || header->sequence != sequence ||
+			header->count <= 0)
+			break;
+		int count = header->count;
+		int tagSectors = divRoundUp(count, TagsPerSector);
+		int length = 1 + tagSectors + count;
+		if (head + length > JournalSectors)
+			break;
+
+		char *group = new char[length * SectorSize];
+		kernel->synchDisk->ReadSectors(JournalStart + head, length, group);
+		if (Checksum(group + SectorSize, (length - 1) * SectorSize) !=
+			((JournalHeader *)group)->checksum)
+		{
+			delete[] group;
+			break; // the crash came while this group was written
+		}
+		int *tags = (int *)(group + SectorSize);
+		char *data = group + (1 + tagSectors) * SectorSize;
+		for (int i = 0; i < count; i++)
+			kernel->synchDisk->WriteSector(tags[i], data + i * SectorSize);
+		delete[] group;
+
+		DEBUG(dbgFile, "Replayed journal group " << sequence << ", " << count << " sectors");
+		head += length;
+		sequence++;
+		replayed++;
+	}
+	if (replayed > 0)
+		cout << "Journal: replayed " << replayed << " groups\n";
+	Checkpoint();
+}
+
+//----------------------------------------------------------------------
+// Journal::Begin
+// 	Start a transaction: from now until the matching Commit, the
+//	sectors this thread writes are held by the journal.  Other
+//	threads wait to start theirs.  A thread already in a transaction
+//	just goes one level deeper.
+//----------------------------------------------------------------------
+
+void Journal::Begin()
+{
+	if (!enabled)
+		return;
+	if (owner == kernel->currentThread)
+	{
+		depth++;
+		return;
+	}
+	lock->Acquire();
+	owner = kernel->currentThread;
+	depth = 1;
+	heldBefore = numHeld;
+}
+
+//----------------------------------------------------------------------
+// Journal::Commit
+// 	End a transaction.  Once GroupCommitSize of them have committed,
+//	or there might not be room for another, the group is written.
+//----------------------------------------------------------------------
+
+void Journal::Commit()
+{
+	if (!enabled)
+		return;
+	ASSERT(owner == kernel->currentThread);
+	if (--depth > 0)
+		return;
+	owner = NULL;
+	numCommitted++;
+	if (numCommitted >= GroupCommitSize ||
+		numHeld > MaxGroupSectors - MaxTransactionSectors)
+		Flush();
+	lock->Release();
+}
+
+//----------------------------------------------------------------------
+// Journal::Sync
+// 	Write the group of committed transactions now, so they survive a
+//	crash.  Does nothing if the journal is already being written by
+//	this thread (SynchDisk::Sync, at a checkpoint).
+//----------------------------------------------------------------------
+
+void Journal::Sync()
+{
+	if (!enabled || lock->IsHeldByCurrentThread())
+		return;
+	lock->Acquire();
+	Flush();
+	lock->Release();
+}
+
+//----------------------------------------------------------------------
+// Journal::Find
+// 	Return where "sector" is among the held sectors, or -1.
+//----------------------------------------------------------------------
+
+int Journal::Find(int sector)
+{
+	for (int i = hashHeads[sector % MaxGroupSectors]; i != -1; i = hashNext[i])
+	{
+		if (heldSectors[i] == sector)
+			return i;
+	}
+	return -1;
+}
+
+//----------------------------------------------------------------------
+// Journal::Read
+// 	If "sector" is held, copy the held contents into "data" and
+//	return TRUE; these are newer than anything the disk or the buffer
+//	cache has.
+//----------------------------------------------------------------------
+
+bool Journal::Read(int sector, char *data)
+{
+	int i;
+
+	if (!enabled || (i = Find(sector)) == -1)
+		return FALSE;
+	memcpy(data, heldData + i * SectorSize, SectorSize);
+	return TRUE;
+}
+
+//----------------------------------------------------------------------
+// Journal::Write
+// 	Offer a sector being written to the journal.  It is held (and
+//	TRUE returned) if the writer is in a transaction, or if the sector
+//	is held already -- say, a freed header sector reused for data --
+//	so the held copy stays the newest.
+//
+//	While the group is being written home, the write goes ahead
+//	anyway, with a held copy brought up to date first.
+//----------------------------------------------------------------------
+
+bool Journal::Write(int sector, char *data)
+{
+	if (!enabled)
+		return FALSE;
+	int i = Find(sector);
+	if (flushing)
+	{
+		if (i != -1 && data != heldData + i * SectorSize)
+			memcpy(heldData + i * SectorSize, data, SectorSize);
+		return FALSE;
+	}
+	if (i == -1)
+	{
+		if (owner != kernel->currentThread)
+			return FALSE;
+		// an open transaction is never written, so it must fit
+		ASSERT(Held() < MaxTransactionSectors);
+		i = numHeld++;
+		heldSectors[i] = sector;
+		hashNext[i] = hashHeads[sector % MaxGroupSectors];
+		hashHeads[sector % MaxGroupSectors] = i;
+	}
+	memcpy(heldData + i * SectorSize, data, SectorSize);
+	return TRUE;
+}
+
+//----------------------------------------------------------------------
+// Journal::Claims
+// 	Return TRUE if Write would hold any of "sectors"; the caller then
+//	writes them one at a time.
+//----------------------------------------------------------------------
+
+bool Journal::Claims(int *sectors, int numSectors)
+{
+	if (!enabled || flushing)
+		return FALSE;
+	if (owner == kernel->currentThread)
+		return TRUE;
+	for (int i = 0; i < numSectors; i++)
+	{
+		if (Find(sectors[i]) != -1)
+			return TRUE;
+	}
+	return FALSE;
+}
+
+//----------------------------------------------------------------------
+// Journal::Flush
+// 	Write the held sectors to the journal as one group, with a single
+//	disk request; then, with the group safely on disk, write them to
+//	their own sectors through the buffer cache, which sends them to
+//	the disk whenever it likes.
+//----------------------------------------------------------------------
+
+void Journal::Flush()
+{
+	if (numHeld == 0)
+	{
+		numCommitted = 0;
+		return;
+	}
+
+	int tagSectors = divRoundUp(numHeld, TagsPerSector);
+	int length = 1 + tagSectors + numHeld;
+	if (head + length > JournalSectors)
+		Checkpoint();
+
+	char *group = new char[length * SectorSize];
+	JournalHeader *header = (JournalHeader *)group;
+	int *tags = (int *)(group + SectorSize);
+
+	memset(group, 0, length * SectorSize);
+	for (int i = 0; i < numHeld; i++)
+		tags[i] = heldSectors[i];
+	memcpy(group + (1 + tagSectors) * SectorSize, heldData, numHeld * SectorSize);
+	header->magic = JournalMagic;
+	header->sequence = sequence;
+	header->count = numHeld;
+	header->checksum = Checksum(group + SectorSize, (length - 1) * SectorSize);
+
+	numGroups++;
+	if (numGroups == crashGroup)
+	{
+		kernel->synchDisk->WriteThrough(JournalStart + head, max(length / 2, 1), group);
+		cout << "Journal: crashing while writing group " << numGroups << "\n";
+		Exit(1);
+	}
+	kernel->synchDisk->WriteThrough(JournalStart + head, length, group);
+	DEBUG(dbgFile, "Journal group " << sequence << ": " << numCommitted
+		<< " transactions, " << numHeld << " sectors");
+	head += length;
+	sequence++;
+	delete[] group;
+
+	flushing = TRUE;
+	for (int i = 0; i < numHeld; i++)
+		kernel->synchDisk->WriteSector(heldSectors[i], heldData + i * SectorSize);
+	flushing = FALSE;
+
+	for (int i = 0; i < numHeld; i++)
+		hashHeads[heldSectors[i] % MaxGroupSectors] = -1;
+	numHeld = 0;
+	heldBefore = 0;
+	numCommitted = 0;
+}
+
+//----------------------------------------------------------------------
+// Journal::Checkpoint
+// 	Make the journal's groups unneeded, by syncing the sectors they
+//	logged to the disk, and start the log over from the beginning.
+//----------------------------------------------------------------------
+
+void Journal::Checkpoint()
+{
+	kernel->synchDisk->Sync();
+	head = 1;
+	WriteStart();
+}
+
+//----------------------------------------------------------------------
+// Journal::WriteStart
+// 	Write the first sector of the journal, with the sequence number
+//	the group at the start of the log must have to be replayed.
+//----------------------------------------------------------------------
+
+void Journal::WriteStart()
+{
+	char first[SectorSize];
+	JournalHeader *header = (JournalHeader *)first;
+
+	memset(first, 0, SectorSize);
+	header->magic = JournalMagic;
+	header->sequence = sequence;
+	header->count = 0;
+	kernel->synchDisk->WriteThrough(JournalStart, 1, first);
+}
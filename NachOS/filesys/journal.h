@@ -0,0 +1,117 @@
+// journal.h
+//	Data structures for a write-ahead journal of file system metadata.
+//
+//	Each file system operation that changes metadata (file headers,
+//	directories, the free map) runs as a transaction.  While it is
+//	open, every sector the operation writes is held in memory by the
+//	journal, instead of going to the disk.  Committed transactions
+//	are collected into a group, and the whole group is written to a
+//	reserved region of the disk with one sequential write;
+//	only then may the held sectors go to their real places.  After a
+//	crash, the groups found complete in the journal are written again
+//	(replayed) when the file system is mounted.
+//
+//	A group commit makes the operations in it durable; until then they
+//	can be lost in a crash, but never half done.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include "disk.h"
+#include "bitmap.h"
+#include "synch.h"
+
+// The journal takes JournalSectors sectors, right after the headers of
+// the bitmap and directory (sectors 0 and 1).  Its first sector says
+// where replay should start; groups follow it, each a JournalHeader
+// sector, then the numbers of the sectors logged (TagsPerSector to a
+// sector), then their contents.
+
+#define JournalStart 2
+#define JournalSectors 8192
+#define JournalMagic 0x4a726e6c // "Jrnl"
+#define TagsPerSector ((int)(SectorSize / sizeof(int)))
+
+// A transaction is never split across groups, so a group must have room
+// for the largest one.  A transaction may write the whole free map, as
+// removing a large file or tree does, and MaxTransactionOther sectors
+// besides; operations that could write more split themselves into
+// several transactions (see CreateTree, and MaxTransactionAlloc for
+// OpenFile::WriteAt).  A group is written once it holds more than
+// MaxGroupSectors - MaxTransactionSectors, so the next one always fits.
+
+#define FreeMapSectors divRoundUp(NumSectors, BitsInByte * SectorSize)
+#define MaxTransactionOther 512
+#define MaxTransactionSectors (FreeMapSectors + MaxTransactionOther)
+#define MaxGroupSectors (2 * MaxTransactionSectors)
+#define GroupCommitSize 8	// transactions batched into one group
+#define MaxTransactionAlloc 2048 // data sectors a transaction may
+								 //  allocate; keeps it within a group
+
+class JournalHeader
+{
+public:
+	int magic;	  // JournalMagic
+	int sequence; // one more than the group before
+	int count;	  // number of sectors logged; 0 in the first sector
+	unsigned int checksum; // of the tags and contents
+};
+
+class Journal
+{
+public:
+	Journal();
+	~Journal();
+
+	void Format();	// Start an empty journal on a new disk
+	void Recover(); // Replay the committed groups after a crash;
+					//  a disk without a journal just doesn't get one
+
+	void Begin();  // Start a transaction; may be nested
+	void Commit(); // End it, writing the group if it is full
+	void Sync();   // Write the group now
+	int Held() { return numHeld - heldBefore; }
+	// Sectors held for the open transaction
+
+	bool Read(int sector, char *data);	// Held copy of a sector, if any
+	bool Write(int sector, char *data); // Hold a sector written in a
+										//  transaction, or one held already
+	bool Claims(int *sectors, int numSectors);
+	// Would Write hold any of these?
+
+	void CrashAfter(int group) { crashGroup = group; }
+	// For testing: kill Nachos halfway
+	//  through writing this group
+
+private:
+	bool enabled;	 // does the disk have a journal?
+	Lock *lock;		 // one transaction at a time
+	Thread *owner;	 // thread with the transaction open
+	int depth;		 // how deeply it is nested
+	bool flushing;	 // writing the held sectors home?
+	int sequence;	 // of the next group
+	int head;		 // where it goes, within the journal
+	int numGroups;	 // groups written since Nachos started
+	int crashGroup;	 // group to crash in, or 0
+
+	int numHeld;		// sectors held for the group
+	int heldBefore;		// of them, held before the open transaction
+	int numCommitted;	// transactions committed in the group
+	int *heldSectors;	// their numbers,
+	char *heldData;		//  their contents,
+	int *hashHeads;		//  and a hash table to find them
+	int *hashNext;
+
+	int Find(int sector);
+	void Flush();	   // Write the group, then the sectors home
+	void Checkpoint(); // Empty the journal
+	void WriteStart(); // Write the journal's first sector
+};
+
+#endif // JOURNAL_H
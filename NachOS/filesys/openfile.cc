@@ -17,31 +17,76 @@
 #include "filehdr.h"
 #include "openfile.h"
 #include "synchdisk.h"
+#include "pbitmap.h"
+#include "journal.h"
+#include "synch.h"
+
+// The inodes of all the open files; made when the first file is opened
+static InodeTable *inodes = NULL;
+
+//----------------------------------------------------------------------
+// SectorsNeeded
+// 	Return how many free sectors a write must find, conservatively,
+//	to allocate "holes" sectors: their index blocks too, and if the
+//	write "extends" the file, the room to grow its header.
+//----------------------------------------------------------------------
+
+static int SectorsNeeded(int holes, bool extends)
+{
+    int needed = holes + 2 * divRoundUp(holes, (int)NumDirect) + 6;
+
+    if (extends)
+        needed += MaxExtendSectors;
+    return needed;
+}
 
 //----------------------------------------------------------------------
 // OpenFile::OpenFile
 // 	Open a Nachos file for reading and writing.  Bring the file header
-//	into memory while the file is open.
+//	into memory while the file is open -- unless the file is open
+//	already, and its in-core inode has it.
 //
 //	"sector" -- the location on disk of the file header for this file
 //----------------------------------------------------------------------
 
 OpenFile::OpenFile(int sector)
 {
-    hdr = new FileHeader;
-    hdr->FetchFrom(sector);
+    if (inodes == NULL)
+        inodes = new InodeTable;
+    inode = inodes->Open(sector);
+    hdr = inode->hdr;
     hdrSector = sector;
     seekPosition = 0;
+    nextRead = 0;
+    readAheadWindow = MinReadAhead;
+    readAheadEnd = 0;
 }
 
 //----------------------------------------------------------------------
 // OpenFile::~OpenFile
 // 	Close a Nachos file, de-allocating any in-memory data structures.
+//	Writes still buffered for the file are flushed first.
 //----------------------------------------------------------------------
 
 OpenFile::~OpenFile()
 {
-    delete hdr;
+    if (inode->bufferLength > 0) // else no need to lock
+        Flush();
+    inodes->Close(inode);
+}
+
+//----------------------------------------------------------------------
+// OpenFile::Removed
+// 	Called when the file whose header is at "sector" has been deleted,
+//	and its sectors freed, so that its in-core inode is not found by
+//	a file that reuses the sector.  Any OpenFile of the deleted file
+//	stays valid, but reads and writes nothing from now on.
+//----------------------------------------------------------------------
+
+void OpenFile::Removed(int sector)
+{
+    if (inodes != NULL)
+        inodes->Invalidate(sector);
 }
 
 //----------------------------------------------------------------------
@@ -49,21 +94,74 @@ OpenFile::~OpenFile()
 // 	Change the current location within the open file -- the point at
 //	which the next Read or Write will start from.
 //
+//	Buffered writes are left alone: a Write elsewhere flushes them.
+//
 //	"position" -- the location within the file for the next Read/Write
 //----------------------------------------------------------------------
 
 void OpenFile::Seek(int position)
 {
+    if (position != nextRead)
+        readAheadWindow = MinReadAhead;
     seekPosition = position;
 }
 
+//----------------------------------------------------------------------
+// OpenFile::Flush
+// 	Write the data buffered for the file (if any) to the disk.  This
+//	is also where the data gets its disk sectors, so a run of small
+//	appends is allocated, and written, a few whole sectors at a time.
+//
+//	The buffer is the inode's, so this flushes what any OpenFile of
+//	the file has written.
+//
+//	Return FALSE if buffered data has been lost since the last Flush,
+//	whether now or in a flush made by a later write: the disk was
+//	full, or the file was deleted.  Write counted those bytes as
+//	written, so this is where the loss is reported, when the file is
+//	closed.
+//----------------------------------------------------------------------
+
+bool OpenFile::Flush()
+{
+    inode->lock->AcquireWrite();
+    FlushLocked();
+    bool success = !inode->writeFailed;
+    inode->writeFailed = FALSE;
+    inode->lock->ReleaseWrite();
+    return success;
+}
+
+void OpenFile::FlushLocked()
+{
+    int length = inode->bufferLength;
+
+    if (length == 0)
+        return;
+    inode->bufferLength = 0;
+    if (inode->removed || WriteLocked(inode->buffer, length, inode->bufferStart) < length)
+    {
+        DEBUG(dbgFile, "Lost " << length << " buffered bytes at " << inode->bufferStart);
+        inode->writeFailed = TRUE;
+    }
+}
+
 //----------------------------------------------------------------------
 // OpenFile::Read/Write
 // 	Read/write a portion of a file, starting from seekPosition.
 //	Return the number of bytes actually written or read, and as a
 //	side effect, increment the current position within the file.
 //
-//	Implemented using the more primitive ReadAt/WriteAt.
+//	Implemented using the more primitive ReadAt/WriteAt.  Writes
+//	smaller than the write buffer are collected there first, and the
+//	buffer is written out whenever it reaches its last sector; it is
+//	aligned so that each flush after the first covers whole sectors.
+//	The bytes are counted as written once buffered, unless the write
+//	would extend the file by more than the disk seems to have room
+//	for; that write is made at once, so the caller gets the real count.
+//
+//	The buffer is shared by every OpenFile of the file, in its inode,
+//	and is only changed with the file locked for writing.
 //
 //	"into" -- the buffer to contain the data to be read from disk
 //	"from" -- the buffer containing the data to be written to disk
@@ -79,7 +177,51 @@ int OpenFile::Read(char *into, int numBytes)
 
 int OpenFile::Write(char *into, int numBytes)
 {
-    int result = WriteAt(into, numBytes, seekPosition);
+    int bufferSize = WriteBufferSectors * SectorSize;
+    int result = numBytes;
+
+    if (numBytes <= 0)
+        return 0;
+    inode->lock->AcquireWrite();
+    if (inode->removed)
+        result = 0;
+    else
+    {
+        if (inode->bufferLength > 0 &&
+            seekPosition != inode->bufferStart + inode->bufferLength)
+            FlushLocked(); // not adjacent to what is buffered
+        // the sectors the flush of this write will cover, at most
+        int start = (inode->bufferLength > 0) ? inode->bufferStart : seekPosition;
+        int end = seekPosition + numBytes;
+        int span = divRoundUp(end, SectorSize) - divRoundDown(start, SectorSize);
+        if (numBytes >= bufferSize ||
+            (end > hdr->FileLength() &&
+             kernel->fileSystem->FreeMap()->NumClear() < SectorsNeeded(span, TRUE)))
+        {
+            FlushLocked();
+            result = WriteLocked(into, numBytes, seekPosition);
+        }
+        else
+        {
+            if (inode->buffer == NULL)
+                inode->buffer = new char[bufferSize];
+            for (int done = 0; done < numBytes;)
+            {
+                int position = seekPosition + done;
+                if (inode->bufferLength == 0)
+                    inode->bufferStart = position;
+                // the buffer ends on a sector boundary
+                int limit = (divRoundDown(inode->bufferStart, SectorSize) + WriteBufferSectors) * SectorSize;
+                int amount = min(numBytes - done, limit - position);
+                bcopy(&into[done], &inode->buffer[inode->bufferLength], amount);
+                inode->bufferLength += amount;
+                done += amount;
+                if (position + amount == limit)
+                    FlushLocked();
+            }
+        }
+    }
+    inode->lock->ReleaseWrite();
     seekPosition += result;
     return result;
 }
@@ -103,6 +245,25 @@ int OpenFile::Write(char *into, int numBytes)
 //	   in the data that will be modified, and write back all the full
 //	   or partial sectors that are part of the request.
 //
+//	Only the partial sectors at either end go through a sector-sized
+//	buffer.  The full sectors in between are handed to the disk as one
+//	scatter-gather list pointing straight at the caller's buffer, so
+//	that each physically contiguous run of the file costs a single
+//	disk request and the data is copied once, between the caller and
+//	the disk's sector buffers.
+//
+//	Sectors the file has never written (holes) read as zeros.  A write
+//	past the end of the file extends it, and sectors are allocated for
+//	any holes the write covers; it only comes up short if the file
+//	would be too large or the disk is full.
+//
+//	A small file kept inline in its header (see filehdr.h) is read
+//	from the in-memory header, and written by writing the header.
+//
+//	The file is locked for reading or writing throughout.  A write
+//	flushes the buffered writes first; a read takes them from the
+//	buffer, as flushing needs the write lock.
+//
 //	"into" -- the buffer to contain the data to be read from disk
 //	"from" -- the buffer containing the data to be written to disk
 //	"numBytes" -- the number of bytes to transfer
@@ -111,11 +272,53 @@ int OpenFile::Write(char *into, int numBytes)
 //----------------------------------------------------------------------
 
 int OpenFile::ReadAt(char *into, int numBytes, int position)
+{
+    int result = 0;
+
+    inode->lock->AcquireRead();
+    if (!inode->removed)
+    {
+        result = ReadLocked(into, numBytes, position);
+        if (inode->bufferLength > 0)
+            result = ReadBuffered(into, numBytes, position, result);
+    }
+    inode->lock->ReleaseRead();
+    return result;
+}
+
+//----------------------------------------------------------------------
+// OpenFile::ReadBuffered
+// 	Lay the buffered writes over the "numRead" bytes just read from
+//	the disk at "position", and return how many bytes the read gets
+//	now that the file may reach as far as the end of the buffer.
+//	Bytes between the end of the file on disk and the buffer read
+//	as zeros.
+//----------------------------------------------------------------------
+
+int OpenFile::ReadBuffered(char *into, int numBytes, int position, int numRead)
+{
+    int start = inode->bufferStart;
+    int end = start + inode->bufferLength;
+    int stop = min(position + numBytes, max(position + numRead, end));
+
+    if (stop <= position)
+        return numRead;
+    memset(&into[numRead], 0, stop - position - numRead);
+    if (max(position, start) < min(stop, end))
+        bcopy(&inode->buffer[max(position, start) - start],
+              &into[max(position, start) - position],
+              min(stop, end) - max(position, start));
+    return stop - position;
+}
+
+int OpenFile::ReadLocked(char *into, int numBytes, int position)
 {
     int fileLength = hdr->FileLength();
 
-    int i, firstSector, lastSector, numSectors;
-    char *buf;
+    int i, j, k, firstSector, lastSector, numSectors, first, end;
+    int start, stop;
+    int *sectors;
+    char edge[SectorSize];
 
     if ((numBytes <= 0) || (position >= fileLength))
         return 0; // check request
@@ -123,67 +326,316 @@ int OpenFile::ReadAt(char *into, int numBytes, int position)
         numBytes = fileLength - position;
     DEBUG(dbgFile, "Reading " << numBytes << " bytes at " << position << " from file of length " << fileLength);
 
+    if (hdr->IsInline())
+    {
+        hdr->ReadInline(into, numBytes, position);
+        return numBytes;
+    }
+
     firstSector = divRoundDown(position, SectorSize);
     lastSector = divRoundDown(position + numBytes - 1, SectorSize);
     numSectors = 1 + lastSector - firstSector;
 
-    // read in all the full and partial sectors that we need
-    buf = new char[numSectors * SectorSize];
-    for (i = firstSector; i <= lastSector; i++)
-        kernel->synchDisk->ReadSector(hdr->ByteToSector(i * SectorSize),
-                                      &buf[(i - firstSector) * SectorSize]);
+    // sectors first..end-1 lie wholly inside the request
+    first = (position == firstSector * SectorSize) ? 0 : 1;
+    end = ((position + numBytes) == (lastSector + 1) * SectorSize) ? numSectors : numSectors - 1;
+    end = max(first, end);
 
-    // copy the part we want
-    bcopy(&buf[position - (firstSector * SectorSize)], into, numBytes);
-    delete[] buf;
+    // read the full sectors straight into place
+    sectors = new int[numSectors];
+    Translate(firstSector, numSectors, sectors);
+    for (i = first; i < end; i = j)
+    {
+        for (j = i + 1; j < end && (sectors[j] == -1) == (sectors[i] == -1); j++)
+            ;
+        char *dest = &into[(firstSector + i) * SectorSize - position];
+        if (sectors[i] == -1) // hole
+            memset(dest, 0, (j - i) * SectorSize);
+        else
+            kernel->synchDisk->ReadVector(&sectors[i], j - i, dest);
+    }
+
+    // read the partial sectors, and copy the part we want
+    for (k = 0; k < 2; k++)
+    {
+        i = (k == 0) ? 0 : numSectors - 1;
+        if ((i >= first && i < end) || (k == 1 && i == 0))
+            continue;
+        if (sectors[i] == -1)
+            memset(edge, 0, SectorSize);
+        else
+            kernel->synchDisk->ReadSector(sectors[i], edge);
+        start = max(position, (firstSector + i) * SectorSize);
+        stop = min(position + numBytes, (firstSector + i + 1) * SectorSize);
+        bcopy(&edge[start - (firstSector + i) * SectorSize], &into[start - position], stop - start);
+    }
+    delete[] sectors;
+    ReadAhead(position, numBytes);
     return numBytes;
 }
 
+//----------------------------------------------------------------------
+// OpenFile::ReadAhead
+// 	Called after reading "numBytes" at "position".  If the read
+//	carried on from where the previous one stopped, ask the disk to
+//	prefetch the next readAheadWindow sectors of the file (those not
+//	asked for already), and double the window for next time.  Any
+//	other read starts over with the smallest window.
+//
+//	The prefetch is done by the disk's read-ahead thread, so the
+//	sectors are on their way while the reader works on what it has.
+//----------------------------------------------------------------------
+
+void OpenFile::ReadAhead(int position, int numBytes)
+{
+    int nextSector = divRoundUp(position + numBytes, SectorSize);
+    int endSector = min(nextSector + readAheadWindow,
+                        divRoundUp(hdr->FileLength(), SectorSize));
+    int sectors[MaxReadAhead];
+    int count = 0;
+
+    if (position != nextRead)
+    {
+        nextRead = position + numBytes;
+        readAheadWindow = MinReadAhead;
+        readAheadEnd = nextSector;
+        return;
+    }
+    nextRead = position + numBytes;
+
+    int first = max(nextSector, readAheadEnd);
+    if (first < endSector)
+    {
+        Translate(first, endSector - first, sectors);
+        for (int i = 0; i < endSector - first; i++)
+        {
+            if (sectors[i] != -1) // holes need no reading
+                sectors[count++] = sectors[i];
+        }
+    }
+    if (count > 0)
+    {
+        DEBUG(dbgFile, "Reading ahead " << count << " sectors after " << nextRead);
+        kernel->synchDisk->Prefetch(sectors, count);
+    }
+    readAheadEnd = max(readAheadEnd, endSector);
+    readAheadWindow = min(2 * readAheadWindow, MaxReadAhead);
+}
+
 int OpenFile::WriteAt(char *from, int numBytes, int position)
+{
+    inode->lock->AcquireWrite();
+    FlushLocked(); // keep the writes in order
+    int result = inode->removed ? 0 : WriteLocked(from, numBytes, position);
+    inode->lock->ReleaseWrite();
+    return result;
+}
+
+int OpenFile::WriteLocked(char *from, int numBytes, int position)
 {
     int fileLength = hdr->FileLength();
 
-    int i, firstSector, lastSector, numSectors;
-    bool firstAligned, lastAligned;
-    char *buf;
+    int i, firstSector, lastSector, numSectors, first, end, holes;
+    bool firstAligned, lastAligned, partialLast;
+    int *sectors;
+    char head[SectorSize], tail[SectorSize];
 
-    if ((numBytes <= 0) || (position >= fileLength))
+    PersistentBitmap *freeMap = NULL; // set once the file needs sectors
+    Journal *journal = NULL;          //  (the file system may still be
+                                      //  formatting until then)
+
+    if (numBytes <= 0)
         return 0; // check request
-    if ((position + numBytes) > fileLength)
-        numBytes = fileLength - position;
     DEBUG(dbgFile, "Writing " << numBytes << " bytes at " << position << " from file of length " << fileLength);
 
+    if (hdr->IsInline() && position + numBytes <= MaxInlineSize)
+    {
+        // one sector write updates both the data and the length
+        hdr->WriteInline(from, numBytes, position);
+        hdr->WriteBack(hdrSector);
+        return numBytes;
+    }
+
     firstSector = divRoundDown(position, SectorSize);
     lastSector = divRoundDown(position + numBytes - 1, SectorSize);
     numSectors = 1 + lastSector - firstSector;
 
-    buf = new char[numSectors * SectorSize];
-
     // Mp4 mod tag
-    memset(buf, 0, sizeof(char) * numSectors * SectorSize); // dummy operation to keep valgrind happy
+    memset(head, 0, SectorSize); // the parts past the end of the file
+    memset(tail, 0, SectorSize); //  read as zeros
 
     firstAligned = (position == (firstSector * SectorSize));
     lastAligned = ((position + numBytes) == ((lastSector + 1) * SectorSize));
+    partialLast = !lastAligned && ((firstSector != lastSector) || firstAligned);
+
+    // sectors first..end-1 are wholly overwritten, from "from" itself
+    first = firstAligned ? 0 : 1;
+    end = lastAligned ? numSectors : numSectors - 1;
+    end = max(first, end);
 
-    // read in first and last sector, if they are to be partially modified
+    // read in first and last sector, if they are to be partially
+    // modified, and copy in the bytes we want to change
     if (!firstAligned)
-        ReadAt(buf, SectorSize, firstSector * SectorSize);
-    if (!lastAligned && ((firstSector != lastSector) || firstAligned))
-        ReadAt(&buf[(lastSector - firstSector) * SectorSize],
-               SectorSize, lastSector * SectorSize);
+    {
+        ReadLocked(head, SectorSize, firstSector * SectorSize);
+        bcopy(from, &head[position - (firstSector * SectorSize)],
+              min(numBytes, (firstSector + 1) * SectorSize - position));
+    }
+    if (partialLast)
+    {
+        ReadLocked(tail, SectorSize, lastSector * SectorSize);
+        bcopy(&from[lastSector * SectorSize - position], tail,
+              position + numBytes - lastSector * SectorSize);
+    }
+
+    // find the sectors the write is missing: the holes, and all of
+    // those past the end of the file
+    sectors = new int[numSectors];
+    holes = 0;
+    for (i = firstSector; i <= lastSector; i++)
+    {
+        sectors[i - firstSector] = -1;
+        if (i * SectorSize < fileLength)
+            sectors[i - firstSector] = hdr->ByteToSector(i * SectorSize);
+        if (sectors[i - firstSector] == -1)
+            holes++;
+    }
+    if (holes > 0 || position + numBytes > fileLength)
+    {
+        freeMap = kernel->fileSystem->FreeMap();
+        journal = kernel->fileSystem->GetJournal();
+        journal->Begin(); // allocating is a file system transaction
+        if (inode->removed)
+        {
+            // deleted while we waited for the journal; its sectors,
+            // header included, may belong to another file by now
+            journal->Commit();
+            delete[] sectors;
+            return 0;
+        }
 
-    // copy in the bytes we want to change
-    bcopy(from, &buf[position - (firstSector * SectorSize)], numBytes);
+        // if there may not be room for the holes, fail before
+        // changing anything
+        if (freeMap->NumClear() < SectorsNeeded(holes, position + numBytes > fileLength))
+        {
+            DEBUG(dbgFile, "Disk full writing " << numBytes << " bytes at " << position);
+            journal->Commit();
+            delete[] sectors;
+            return 0;
+        }
+    }
+
+    // grow the file
+    if (position + numBytes > fileLength)
+    {
+        if (!hdr->Extend(freeMap, position + numBytes))
+        {
+            // the shared header may be partly grown; start it over
+            freeMap->Undo(kernel->fileSystem->FreeMapFile());
+            hdr->FetchFrom(hdrSector);
+            journal->Commit();
+            delete[] sectors;
+            return 0; // file too large
+        }
+        ZeroTail(fileLength, firstSector);
+    }
+    if (freeMap != NULL)
+    {
+        bool success = TRUE;
+
+        // a huge write allocates in slices, each committed on its own,
+        // so that no transaction outgrows a journal group; a crash in
+        // between leaves part of the range allocated, and the rest holes
+        for (i = 0; success && i < numSectors; i += MaxTransactionAlloc)
+        {
+            if (i > 0)
+            {
+                hdr->WriteBack(hdrSector);
+                freeMap->WriteBack(kernel->fileSystem->FreeMapFile());
+                journal->Commit();
+                journal->Begin();
+                if (inode->removed)
+                {
+                    journal->Commit();
+                    delete[] sectors;
+                    return 0;
+                }
+            }
+            success = hdr->AllocateRange(freeMap, firstSector + i,
+                                         min(MaxTransactionAlloc, numSectors - i));
+        }
+        hdr->WriteBack(hdrSector);
+        freeMap->WriteBack(kernel->fileSystem->FreeMapFile());
+        journal->Commit();
+        if (!success)
+        {
+            DEBUG(dbgFile, "Disk full writing " << numBytes << " bytes at " << position);
+            delete[] sectors;
+            return 0;
+        }
+        for (i = firstSector; i <= lastSector; i++)
+            sectors[i - firstSector] = hdr->ByteToSector(i * SectorSize);
+    }
 
     // write modified sectors back
-    for (i = firstSector; i <= lastSector; i++)
-        kernel->synchDisk->WriteSector(hdr->ByteToSector(i * SectorSize),
-                                       &buf[(i - firstSector) * SectorSize]);
+    if (end > first)
+        kernel->synchDisk->WriteVector(&sectors[first], end - first,
+                                       &from[(firstSector + first) * SectorSize - position]);
+    if (!firstAligned)
+        kernel->synchDisk->WriteSector(sectors[0], head);
+    if (partialLast)
+        kernel->synchDisk->WriteSector(sectors[numSectors - 1], tail);
 
-    delete[] buf;
+    delete[] sectors;
     return numBytes;
 }
 
+//----------------------------------------------------------------------
+// OpenFile::Translate
+// 	Set sectors[i] to the disk sector holding sector firstSector + i
+//	of the file (-1 for a hole), for "numSectors" sectors.
+//
+//	Readers of a file share its header, and looking sectors up may
+//	load index blocks into it, so the lookups are made one thread at
+//	a time, under the inode's mapLock.  (A writer has the whole file
+//	to itself anyway.)
+//----------------------------------------------------------------------
+
+void OpenFile::Translate(int firstSector, int numSectors, int *sectors)
+{
+    inode->mapLock->Acquire();
+    for (int i = 0; i < numSectors; i++)
+        sectors[i] = hdr->ByteToSector((firstSector + i) * SectorSize);
+    inode->mapLock->Release();
+}
+
+//----------------------------------------------------------------------
+// OpenFile::ZeroTail
+// 	Clear the bytes past the old end of the file in its last sector,
+//	once a write beyond that sector has extended the file, so that the
+//	gap reads as zeros.  (If the write starts in that sector, WriteAt
+//	has already zero-filled it.)
+//
+//	"oldLength" -- the length of the file before the write
+//	"firstSector" -- the first sector of the file being written
+//----------------------------------------------------------------------
+
+void OpenFile::ZeroTail(int oldLength, int firstSector)
+{
+    int lastSector = divRoundDown(oldLength, SectorSize);
+    int sector;
+    char buf[SectorSize];
+
+    if (oldLength % SectorSize == 0 || lastSector >= firstSector)
+        return;
+    sector = hdr->ByteToSector(lastSector * SectorSize);
+    if (sector == -1)
+        return; // a hole reads as zeros already
+    kernel->synchDisk->ReadSector(sector, buf);
+    memset(&buf[oldLength % SectorSize], 0, SectorSize - oldLength % SectorSize);
+    kernel->synchDisk->WriteSector(sector, buf);
+}
+
 //----------------------------------------------------------------------
 // OpenFile::Length
 // 	Return the number of bytes in the file.
@@ -191,7 +643,140 @@ int OpenFile::WriteAt(char *from, int numBytes, int position)
 
 int OpenFile::Length()
 {
+    if (inode->bufferLength > 0)
+        return max(hdr->FileLength(), inode->bufferStart + inode->bufferLength);
     return hdr->FileLength();
 }
 
+//----------------------------------------------------------------------
+// InodeTable::InodeTable
+// 	Initialize an empty table of in-core inodes.
+//----------------------------------------------------------------------
+
+InodeTable::InodeTable()
+{
+    for (int i = 0; i < InodeBuckets; i++)
+        buckets[i] = NULL;
+}
+
+//----------------------------------------------------------------------
+// InodeTable::~InodeTable
+// 	De-allocate the table, and any inodes still in it.
+//----------------------------------------------------------------------
+
+InodeTable::~InodeTable()
+{
+    for (int i = 0; i < InodeBuckets; i++)
+    {
+        while (buckets[i] != NULL)
+        {
+            Inode *inode = buckets[i];
+            buckets[i] = inode->next;
+            delete inode->hdr;
+            delete inode->lock;
+            delete inode->mapLock;
+            delete[] inode->buffer;
+            delete inode;
+        }
+    }
+}
+
+//----------------------------------------------------------------------
+// InodeTable::Open
+// 	Return the in-core inode of the file whose header is at "sector",
+//	counting one more user of it.  If the file is not open yet, a new
+//	inode is entered, and its header read in from the disk.
+//
+//	The inode goes into the table before its header is read, so that
+//	a second thread opening the file meanwhile finds it, instead of
+//	reading the header again; that thread waits for the read through
+//	the inode's lock, which the first one holds for writing until the
+//	header is in.  Nothing else in here can switch threads.
+//----------------------------------------------------------------------
+
+Inode *InodeTable::Open(int sector)
+{
+    Inode **bucket = &buckets[sector % InodeBuckets];
+    Inode *inode;
+
+    for (inode = *bucket; inode != NULL; inode = inode->next)
+    {
+        if (inode->sector == sector)
+        {
+            inode->users++;
+            if (inode->loading)
+            {
+                inode->lock->AcquireRead();
+                inode->lock->ReleaseRead();
+            }
+            return inode;
+        }
+    }
+    inode = new Inode;
+    inode->sector = sector;
+    inode->users = 1;
+    inode->loading = TRUE;
+    inode->removed = FALSE;
+    inode->hdr = new FileHeader;
+    inode->lock = new RWLock("file");
+    inode->mapLock = new Lock("file map");
+    inode->buffer = NULL;
+    inode->bufferStart = inode->bufferLength = 0;
+    inode->writeFailed = FALSE;
+    inode->next = *bucket;
+    *bucket = inode;
+
+    inode->lock->AcquireWrite();
+    inode->hdr->FetchFrom(sector);
+    inode->loading = FALSE;
+    inode->lock->ReleaseWrite();
+    return inode;
+}
+
+//----------------------------------------------------------------------
+// InodeTable::Close
+// 	Count one fewer user of "inode", deleting it once there are none.
+//	The header has been written back by whoever changed it, and the
+//	last user has flushed the buffered writes.
+//----------------------------------------------------------------------
+
+void InodeTable::Close(Inode *inode)
+{
+    Inode **link = &buckets[inode->sector % InodeBuckets];
+
+    if (--inode->users > 0)
+        return;
+    if (!inode->removed)
+    {
+        while (*link != inode)
+            link = &(*link)->next;
+        *link = inode->next;
+    }
+    delete inode->hdr;
+    delete inode->lock;
+    delete inode->mapLock;
+    delete[] inode->buffer;
+    delete inode;
+}
+
+//----------------------------------------------------------------------
+// InodeTable::Invalidate
+// 	Take the inode of the file whose header is at "sector", if it is
+//	open, out of the table, and mark it removed; it is deleted when
+//	its last user closes it.
+//----------------------------------------------------------------------
+
+void InodeTable::Invalidate(int sector)
+{
+    Inode **link = &buckets[sector % InodeBuckets];
+
+    while (*link != NULL && (*link)->sector != sector)
+        link = &(*link)->next;
+    if (*link == NULL)
+        return;
+    DEBUG(dbgFile, "Dropping the inode of deleted file " << sector);
+    (*link)->removed = TRUE;
+    *link = (*link)->next;
+}
+
 #endif //FILESYS_STUB
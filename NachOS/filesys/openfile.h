@@ -9,9 +9,13 @@
 //
 //	The other is the "real" implementation, that turns these
 //	operations into read and write disk sector requests. 
-//	In this baseline implementation of the file system, we don't 
-//	worry about concurrent accesses to the file system
-//	by different threads.
+//	All the OpenFiles of a file share its header, in memory, and a
+//	reader/writer lock that keeps threads using the file at the same
+//	time apart: reads of a file go on in parallel, and a write has the
+//	file to itself.  Small writes are collected in the shared inode
+//	too, so every OpenFile of the file sees them at once.  Each OpenFile
+//	has its own position in the file, and is not meant to be shared
+//	between threads.
 //
 // Copyright (c) 1992-1993 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation 
@@ -53,6 +57,7 @@ class OpenFile {
 		}
 
     int Length() { Lseek(file, 0, 2); return Tell(file); }
+    bool Flush() { return TRUE; }	// nothing is buffered
     
   private:
     int file;
@@ -61,6 +66,66 @@ class OpenFile {
 
 #else // FILESYS
 class FileHeader;
+class RWLock;
+class Lock;
+
+// The in-core inode of an open file: its header, read in once, its
+// lock, and its buffer of small writes, all shared by every OpenFile
+// of the file.  Inodes are kept in
+// a table, found by the sector of the header; each is counted, for
+// every OpenFile using it, and goes away when the last one is closed.
+// When the file is deleted, its inode leaves the table at once, so a
+// file later made with the same header sector gets an inode of its own;
+// the OpenFiles still using the old one can no longer read or write.
+
+class Inode {
+  public:
+    int sector;				// where the file header is
+    int users;				// OpenFiles of the file
+    bool loading;			// header still being read in?
+    bool removed;			// file deleted, out of the table?
+    FileHeader *hdr;			// the header
+    RWLock *lock;			// reader/writer lock for the file
+    Lock *mapLock;			// held to look up sectors in "hdr",
+					// which loads its index blocks
+    char *buffer;			// Data written but not yet flushed,
+    int bufferStart;			// for bytes bufferStart up to
+    int bufferLength;			// bufferStart + bufferLength; only
+					// changed with "lock" held for writing
+    bool writeFailed;			// buffered data lost since the last
+					// Flush?
+    Inode *next;			// in the same hash chain
+};
+
+#define InodeBuckets 64
+
+class InodeTable {
+  public:
+    InodeTable();
+    ~InodeTable();
+
+    Inode *Open(int sector);		// The inode of the file whose
+					// header is at "sector"; the header
+					// is only read if it is not open
+    void Close(Inode *inode);		// One fewer user of the inode
+    void Invalidate(int sector);	// The file whose header is at
+					// "sector" has been deleted
+
+  private:
+    Inode *buckets[InodeBuckets];
+};
+
+// Small writes through Write are collected in a buffer of this many
+// sectors, and reach the disk together when the buffer fills up, when
+// a write goes elsewhere in the file, when a read needs them, or when
+// the file is closed.
+#define WriteBufferSectors 4
+
+// Reading a file sequentially starts read-ahead of this many sectors
+// past each read; the window doubles, up to MaxReadAhead, for as long
+// as the reads stay sequential, and shrinks back after a seek.
+#define MinReadAhead 4
+#define MaxReadAhead 32
 
 class OpenFile {
   public:
@@ -70,6 +135,10 @@ class OpenFile {
 
     void Seek(int position); 		// Set the position from which to 
 					// start reading/writing -- UNIX lseek
+    bool Flush();			// Write out any buffered data; FALSE
+					// if some of it could not be written
+    static void Removed(int sector);	// The file whose header is at
+					// "sector" has been deleted
 
     int Read(char *into, int numBytes); // Read/write bytes from the file,
 					// starting at the implicit position.
@@ -89,11 +158,41 @@ class OpenFile {
  	int getHdrSector(){ return hdrSector; } 
 
 	FileHeader* getHdr() { return hdr;}
+
+    RWLock *InodeLock() { return inode->lock; }
+					// Shared by every OpenFile of the
+					// file, and taken by ReadAt/WriteAt;
+					// a directory's guards its entries
     
   private:
-    FileHeader *hdr;			// Header for this file 
+    Inode *inode;			// In-core inode of this file,
+    FileHeader *hdr;			// and its header
     int seekPosition;			// Current position within the file
 	int hdrSector;
+
+    int nextRead;			// where a sequential read would start
+    int readAheadWindow;		// sectors to read ahead
+    int readAheadEnd;			// first sector not yet read ahead
+
+    int ReadLocked(char *into, int numBytes, int position);
+    int WriteLocked(char *from, int numBytes, int position);
+					// ReadAt/WriteAt, once the file
+					// is locked
+    void FlushLocked();			// Flush, once the file is locked
+    int ReadBuffered(char *into, int numBytes, int position, int numRead);
+					// Add the buffered writes to a read
+
+    void Translate(int firstSector, int numSectors, int *sectors);
+					// Find where sectors of the file are
+
+    void ReadAhead(int position, int numBytes);
+					// Prefetch past a read, if the file
+					// is being read sequentially
+
+    void ZeroTail(int oldLength, int firstSector);
+					// Clear the old last sector past the
+					// end, after the file has grown
+
 };
 
 #endif // FILESYS
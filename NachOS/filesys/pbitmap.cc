@@ -8,6 +8,9 @@
 
 #include "copyright.h"
 #include "pbitmap.h"
+#include "disk.h"
+
+const int BitsInSector = SectorSize * BitsInByte;
 
 //----------------------------------------------------------------------
 // PersistentBitmap::PersistentBitmap(int)
@@ -16,11 +19,18 @@
 //
 //	"numItems" is the number of bits in the bitmap.
 //
-//      This constructor does not initialize the bitmap from a disk file
+//      This constructor does not initialize the bitmap from a disk file,
+//      so all of it counts as changed.
 //----------------------------------------------------------------------
 
 PersistentBitmap::PersistentBitmap(int numItems):Bitmap(numItems) 
 { 
+    numBytes = numWords * sizeof(unsigned);
+    numFileSectors = divRoundUp(numBytes, SectorSize);
+    dirty = new bool[numFileSectors];
+    for (int i = 0; i < numFileSectors; i++) {
+	dirty[i] = TRUE;
+    }
 }
 
 //----------------------------------------------------------------------
@@ -37,10 +47,13 @@ PersistentBitmap::PersistentBitmap(int numItems):Bitmap(numItems)
 
 PersistentBitmap::PersistentBitmap(OpenFile *file, int numItems):Bitmap(numItems) 
 { 
+    numBytes = numWords * sizeof(unsigned);
+    numFileSectors = divRoundUp(numBytes, SectorSize);
+    dirty = new bool[numFileSectors];
     // map has already been initialized by the BitMap constructor,
     // but we will just overwrite that with the contents of the
     // map found in the file
-    file->ReadAt((char *)map, numWords * sizeof(unsigned), 0);
+    FetchFrom(file);
 }
 
 //----------------------------------------------------------------------
@@ -50,6 +63,19 @@ PersistentBitmap::PersistentBitmap(OpenFile *file, int numItems):Bitmap(numItems
 
 PersistentBitmap::~PersistentBitmap()
 { 
+    delete [] dirty;
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::Changed
+// 	Note that the sector of the file holding bit "which" must be
+//	written back.
+//----------------------------------------------------------------------
+
+void
+PersistentBitmap::Changed(int which)
+{
+    dirty[which / BitsInSector] = TRUE;
 }
 
 //----------------------------------------------------------------------
@@ -62,12 +88,18 @@ PersistentBitmap::~PersistentBitmap()
 void
 PersistentBitmap::FetchFrom(OpenFile *file) 
 {
-    file->ReadAt((char *)map, numWords * sizeof(unsigned), 0);
+    file->ReadAt((char *)map, numBytes, 0);
+    Recount();
+    for (int i = 0; i < numFileSectors; i++) {
+	dirty[i] = FALSE;
+    }
 }
 
 //----------------------------------------------------------------------
 // PersistentBitmap::WriteBack
 // 	Store the contents of a persistent bitmap to a Nachos file.
+//	Only the sectors with changed bits are written, each run of
+//	them with a single write.
 //
 //	"file" is the place to write the bitmap to
 //----------------------------------------------------------------------
@@ -75,5 +107,64 @@ PersistentBitmap::FetchFrom(OpenFile *file)
 void
 PersistentBitmap::WriteBack(OpenFile *file)
 {
-   file->WriteAt((char *)map, numWords * sizeof(unsigned), 0);
+    int i = 0;
+
+    while (i < numFileSectors) {
+	if (!dirty[i]) {
+	    i++;
+	    continue;
+	}
+	int first = i;
+	while (i < numFileSectors && dirty[i]) {
+	    dirty[i++] = FALSE;
+	}
+	int start = first * SectorSize;
+	int end = min(i * SectorSize, numBytes);
+	file->WriteAt((char *)map + start, end - start, start);
+    }
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::Undo
+// 	Throw away the changes made since the bitmap was last read or
+//	written, by reading the changed sectors back from the file.
+//
+//	"file" is the place the bitmap was read from
+//----------------------------------------------------------------------
+
+void
+PersistentBitmap::Undo(OpenFile *file)
+{
+    for (int i = 0; i < numFileSectors; i++) {
+	if (dirty[i]) {
+	    int start = i * SectorSize;
+	    file->ReadAt((char *)map + start, min(SectorSize, numBytes - start), start);
+	    dirty[i] = FALSE;
+	}
+    }
+    Recount();
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::WriteBackUsed
+// 	Store the contents of a persistent bitmap to a Nachos file whose
+//	contents are known to be all zeros (a freshly erased disk).  Only
+//	the words up to the last set bit need to be written; the rest of
+//	the file already holds the right (clear) bits.
+//
+//	"file" is the place to write the bitmap to
+//----------------------------------------------------------------------
+
+void
+PersistentBitmap::WriteBackUsed(OpenFile *file)
+{
+    int usedWords = numWords;
+
+    while (usedWords > 0 && map[usedWords - 1] == 0)
+	usedWords--;
+    if (usedWords > 0)
+	file->WriteAt((char *)map, usedWords * sizeof(unsigned), 0);
+    for (int i = 0; i < numFileSectors; i++) {
+	dirty[i] = FALSE;
+    }
 }
@@ -6,6 +6,10 @@
 //    when it is created, or it can be initialized later using
 //    the FetchFrom method
 //
+//    The bitmap remembers which sectors of its file hold bits changed
+//    since it was last read or written, and only those are written
+//    back; they can also be read back in instead, to undo the changes.
+//
 // Copyright (c) 1992,1993,1995 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation 
 // of liability and disclaimer of warranty provisions.
@@ -30,6 +34,17 @@ class PersistentBitmap : public Bitmap {
 
     void FetchFrom(OpenFile *file);     // read bitmap from the disk
     void WriteBack(OpenFile *file); 	// write bitmap contents to disk 
+    void WriteBackUsed(OpenFile *file);	// write only up to the last set
+					// bit, onto a file known to be zero
+    void Undo(OpenFile *file);		// forget the changes not yet
+					// written back
+
+  private:
+    int numBytes;			// size of the bitmap in its file
+    int numFileSectors;			// sectors of the file it takes
+    bool *dirty;			// which of them have changed bits
+
+    void Changed(int which);
 };
 
 #endif // PBITMAP_H
@@ -1,48 +1,105 @@
-// synchdisk.cc 
-//	Routines to synchronously access the disk.  The physical disk 
+// synchdisk.cc
+//	Routines to synchronously access the disk.  The physical disk
 //	is an asynchronous device (disk requests return immediately, and
 //	an interrupt happens later on).  This is a layer on top of
 //	the disk providing a synchronous interface (requests wait until
 //	the request completes).
 //
-//	Use a semaphore to synchronize the interrupt handlers with the
-//	pending requests.  And, because the physical disk can only
-//	handle one operation at a time, use a lock to enforce mutual
-//	exclusion.
+//	Because the physical disk can only handle one operation at a
+//	time, requests are kept in a queue, and the next one is sent to
+//	the disk from the interrupt handler of the previous one.  The
+//	scheduling policy decides which queued request goes next, so
+//	that concurrent requests can be reordered to cut seek time.
+//	Each synchronous request waits on its own semaphore.
+//
+//	Sectors are kept in a write-back buffer cache, so that repeated
+//	accesses to the same sector (file headers, directories and the
+//	free map) do not each cost a trip to the disk.
+//
+//	When the file system keeps a journal, sectors written inside one
+//	of its transactions are handed to the journal instead, and read
+//	back from it until the journal lets them through.
 //
 // Copyright (c) 1992-1993 The Regents of the University of California.
-// All rights reserved.  See copyright.h for copyright notice and limitation 
+// All rights reserved.  See copyright.h for copyright notice and limitation
 // of liability and disclaimer of warranty provisions.
 
 #include "copyright.h"
 #include "synchdisk.h"
+#include "journal.h"
+#include "debug.h"
+#include "main.h"
+
+// Used to wait for a single request to finish.  The disk interrupt
+// handler calls CallBack when the request is done.
+
+class RequestDone : public CallBackObj {
+  public:
+    RequestDone() : done("disk request", 0) { finishedAt = 0; }
+    void CallBack() { finishedAt = kernel->stats->totalTicks; done.V(); }
+    void Wait() { done.P(); }
 
+    int finishedAt;			// when the request completed
+  private:
+    Semaphore done;
+};
 
 //----------------------------------------------------------------------
 // SynchDisk::SynchDisk
 // 	Initialize the synchronous interface to the physical disk, in turn
 //	initializing the physical disk.
 //
+//	"cacheSectors" -- how many sectors the buffer cache can hold
+//	"policy" -- the order in which queued requests are served
+//	"mapDisk" -- have the raw disk map its UNIX file into memory
 //----------------------------------------------------------------------
 
-SynchDisk::SynchDisk()
+SynchDisk::SynchDisk(int cacheSectors, DiskPolicy policy, bool mapDisk)
 {
-    semaphore = new Semaphore("synch disk", 0);
+    ASSERT(cacheSectors >= 0);
+    pending = new List<DiskRequest *>;
+    active = NULL;
+    schedPolicy = policy;
+    sweepUp = TRUE;
     lock = new Lock("synch disk lock");
-    disk = new Disk(this);
+    bufferReady = new Condition("synch disk buffer");
+    disk = new Disk(this, mapDisk);
+
+    numBuffers = cacheSectors;
+    numBuckets = (cacheSectors > 0) ? cacheSectors : 1;
+    cache = new SectorBuffer[numBuffers];
+    hashHeads = new int[numBuckets];
+    for (int i = 0; i < numBuckets; i++)
+	hashHeads[i] = -1;
+    for (int i = 0; i < numBuffers; i++) {
+	cache[i].sector = -1;
+	cache[i].dirty = FALSE;
+	cache[i].busy = FALSE;
+	cache[i].lastUsed = 0;
+	cache[i].next = -1;
+    }
+    useClock = 0;
+    readAhead = new SynchList<DiskRequest *>;
+    readAheadStarted = FALSE;
+    journal = NULL;
 }
 
 //----------------------------------------------------------------------
 // SynchDisk::~SynchDisk
 // 	De-allocate data structures needed for the synchronous disk
-//	abstraction.
+//	abstraction.  Dirty sectors that were never synced are lost,
+//	just as they would be if the machine lost power.
 //----------------------------------------------------------------------
 
 SynchDisk::~SynchDisk()
 {
     delete disk;
+    delete bufferReady;
     delete lock;
-    delete semaphore;
+    delete pending;
+    delete readAhead;
+    delete [] cache;
+    delete [] hashHeads;
 }
 
 //----------------------------------------------------------------------
@@ -57,16 +114,23 @@ SynchDisk::~SynchDisk()
 void
 SynchDisk::ReadSector(int sectorNumber, char* data)
 {
-    lock->Acquire();			// only one disk I/O at a time
-    disk->ReadRequest(sectorNumber, data);
-    semaphore->P();			// wait for interrupt
+    if (journal != NULL && journal->Read(sectorNumber, data))
+	return;
+    if (numBuffers == 0) {
+	Transfer(sectorNumber, data, FALSE);
+	return;
+    }
+    lock->Acquire();
+    int which = GetBuffer(sectorNumber, TRUE);
+    memcpy(data, cache[which].data, SectorSize);
     lock->Release();
 }
 
 //----------------------------------------------------------------------
 // SynchDisk::WriteSector
-// 	Write the contents of a buffer into a disk sector.  Return only
-//	after the data has been written.
+// 	Write the contents of a buffer into a disk sector.  With the
+//	cache enabled, the data only reaches the disk once the sector is
+//	evicted or Sync is called.
 //
 //	"sectorNumber" -- the disk sector to be written
 //	"data" -- the new contents of the disk sector
@@ -75,20 +139,832 @@ SynchDisk::ReadSector(int sectorNumber, char* data)
 void
 SynchDisk::WriteSector(int sectorNumber, char* data)
 {
-    lock->Acquire();			// only one disk I/O at a time
-    disk->WriteRequest(sectorNumber, data);
-    semaphore->P();			// wait for interrupt
+    if (journal != NULL && journal->Write(sectorNumber, data))
+	return;
+    if (numBuffers == 0) {
+	Transfer(sectorNumber, data, TRUE);
+	return;
+    }
+    lock->Acquire();
+    int which = GetBuffer(sectorNumber, FALSE);
+    memcpy(cache[which].data, data, SectorSize);
+    cache[which].dirty = TRUE;
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// QueueRuns
+// 	Split a scatter-gather list into runs of physically contiguous
+//	sectors, and queue one disk request for each run.  Returns the
+//	number of requests queued; the caller waits for each of them.
+//
+//	"skip" -- if not NULL, sectors to leave out of the transfer
+//	"requests", "done" -- room for up to numSectors requests
+//----------------------------------------------------------------------
+
+static int
+QueueRuns(SynchDisk *synchDisk, int *sectors, int numSectors, char *data,
+	bool *skip, bool writing, DiskRequest *requests, RequestDone *done)
+{
+    int numRequests = 0;
+    int i = 0;
+
+    while (i < numSectors) {
+	if (skip != NULL && skip[i]) {
+	    i++;
+	    continue;
+	}
+	int end = i + 1;
+	while (end < numSectors && (skip == NULL || !skip[end])
+			&& sectors[end] == sectors[end - 1] + 1)
+	    end++;
+	requests[numRequests].sector = sectors[i];
+	requests[numRequests].count = end - i;
+	requests[numRequests].data = &data[i * SectorSize];
+	requests[numRequests].writing = writing;
+	requests[numRequests].whenDone = &done[numRequests];
+	synchDisk->Request(&requests[numRequests]);
+	numRequests++;
+	i = end;
+    }
+    return numRequests;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::ReadSectors/WriteSectors
+// 	Read/write a run of consecutive sectors, returning once the whole
+//	transfer is done.
+//
+//	"firstSector" -- the first sector of the run
+//	"numSectors" -- how many sectors
+//	"data" -- numSectors * SectorSize bytes of buffer
+//----------------------------------------------------------------------
+
+void
+SynchDisk::ReadSectors(int firstSector, int numSectors, char* data)
+{
+    int *sectors = new int[numSectors];
+
+    for (int i = 0; i < numSectors; i++)
+	sectors[i] = firstSector + i;
+    ReadVector(sectors, numSectors, data);
+    delete [] sectors;
+}
+
+void
+SynchDisk::WriteSectors(int firstSector, int numSectors, char* data)
+{
+    int *sectors = new int[numSectors];
+
+    for (int i = 0; i < numSectors; i++)
+	sectors[i] = firstSector + i;
+    WriteVector(sectors, numSectors, data);
+    delete [] sectors;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::ReadVector
+// 	Read a list of sectors, sectors[i] into data[i * SectorSize].
+//
+//	Small transfers simply go through the buffer cache a sector at a
+//	time.  For large ones, the sectors already in the cache are copied
+//	from there, and the rest are read straight into "data", one request
+//	per physically contiguous run, without disturbing the cache.  The
+//	requests are queued while the cache is locked, so that they cannot
+//	overtake a later write-back of the same sectors.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::ReadVector(int *sectors, int numSectors, char* data)
+{
+    if (numBuffers > 0 && numSectors <= numBuffers / 4) {
+	for (int i = 0; i < numSectors; i++)
+	    ReadSector(sectors[i], &data[i * SectorSize]);
+	return;
+    }
+
+    bool *cached = new bool[numSectors];
+    DiskRequest *requests = new DiskRequest[numSectors];
+    RequestDone *done = new RequestDone[numSectors];
+    int numRequests;
+
+    lock->Acquire();
+    for (int i = 0; i < numSectors; i++) {
+	int which = (numBuffers > 0) ? FindBuffer(sectors[i]) : -1;
+	while (which != -1 && cache[which].busy) {
+	    bufferReady->Wait(lock);
+	    which = FindBuffer(sectors[i]);
+	}
+	cached[i] = (which != -1);
+	if (cached[i]) {
+	    memcpy(&data[i * SectorSize], cache[which].data, SectorSize);
+	    kernel->stats->numCacheHits++;
+	} else if (numBuffers > 0) {
+	    kernel->stats->numCacheMisses++;
+	}
+    }
+    numRequests = QueueRuns(this, sectors, numSectors, data, cached, FALSE,
+				requests, done);
+    lock->Release();
+
+    for (int i = 0; i < numRequests; i++)
+	done[i].Wait();
+    for (int i = 0; journal != NULL && i < numSectors; i++)
+	journal->Read(sectors[i], &data[i * SectorSize]);
+
+    delete [] done;
+    delete [] requests;
+    delete [] cached;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::WriteVector
+// 	Write a list of sectors, sectors[i] from data[i * SectorSize].
+//
+//	Small transfers go through the buffer cache.  Large ones are sent
+//	straight to the disk, one request per physically contiguous run;
+//	any cached copies are brought up to date and, since the disk is
+//	about to hold the same data, marked clean.  Sectors the journal
+//	wants go to it one at a time.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::WriteVector(int *sectors, int numSectors, char* data)
+{
+    if ((numBuffers > 0 && numSectors <= numBuffers / 4) ||
+		(journal != NULL && journal->Claims(sectors, numSectors))) {
+	for (int i = 0; i < numSectors; i++)
+	    WriteSector(sectors[i], &data[i * SectorSize]);
+	return;
+    }
+
+    DiskRequest *requests = new DiskRequest[numSectors];
+    RequestDone *done = new RequestDone[numSectors];
+    int numRequests;
+
+    lock->Acquire();
+    for (int i = 0; numBuffers > 0 && i < numSectors; i++) {
+	int which = FindBuffer(sectors[i]);
+	while (which != -1 && cache[which].busy) {
+	    bufferReady->Wait(lock);
+	    which = FindBuffer(sectors[i]);
+	}
+	if (which != -1) {
+	    memcpy(cache[which].data, &data[i * SectorSize], SectorSize);
+	    cache[which].dirty = FALSE;
+	}
+    }
+    numRequests = QueueRuns(this, sectors, numSectors, data, NULL, TRUE,
+				requests, done);
+    lock->Release();
+
+    for (int i = 0; i < numRequests; i++)
+	done[i].Wait();
+
+    delete [] done;
+    delete [] requests;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::WriteThrough
+// 	Write a run of consecutive sectors to the disk with a single
+//	request, and return once it is there.  Cached copies are brought
+//	up to date and marked clean.  Used by the journal, which must know
+//	its groups are on the disk before anything else is written.
+//
+//	"firstSector" -- the first sector of the run
+//	"numSectors" -- how many sectors
+//	"data" -- numSectors * SectorSize bytes to write
+//----------------------------------------------------------------------
+
+void
+SynchDisk::WriteThrough(int firstSector, int numSectors, char* data)
+{
+    DiskRequest request;
+    RequestDone done;
+
+    lock->Acquire();
+    for (int i = 0; numBuffers > 0 && i < numSectors; i++) {
+	int which = FindBuffer(firstSector + i);
+	while (which != -1 && cache[which].busy) {
+	    bufferReady->Wait(lock);
+	    which = FindBuffer(firstSector + i);
+	}
+	if (which != -1) {
+	    memcpy(cache[which].data, &data[i * SectorSize], SectorSize);
+	    cache[which].dirty = FALSE;
+	}
+    }
+    request.sector = firstSector;
+    request.count = numSectors;
+    request.data = data;
+    request.writing = TRUE;
+    request.whenDone = &done;
+    Request(&request);
     lock->Release();
+    done.Wait();
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Prefetch
+// 	Ask for sectors to be read into the buffer cache, without waiting
+//	for them.  The list is split into physically contiguous runs, and
+//	each run is handed to the read-ahead thread (forked on first use),
+//	which reads it with a single disk request while the caller goes
+//	on with its work.  At most half of the cache is filled this way
+//	per call, and sectors already cached are left alone.
+//
+//	"sectors" -- the sectors that will probably be read soon
+//	"numSectors" -- how many there are
+//----------------------------------------------------------------------
+
+void
+SynchDisk::Prefetch(int *sectors, int numSectors)
+{
+    numSectors = min(numSectors, numBuffers / 2);
+    if (numSectors <= 0)
+	return;
+    if (!readAheadStarted) {
+	Thread *t = new Thread("disk read-ahead", 0);
+	t->Fork((VoidFunctionPtr) ReadAheadThread, (void *) this);
+	readAheadStarted = TRUE;
+    }
+
+    for (int i = 0; i < numSectors;) {
+	int end = i + 1;
+	while (end < numSectors && sectors[end] == sectors[end - 1] + 1)
+	    end++;
+	DiskRequest *run = new DiskRequest;
+	run->sector = sectors[i];
+	run->count = end - i;
+	readAhead->Append(run);
+	i = end;
+    }
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::ReadAheadThread
+// 	Body of the read-ahead thread: read each run of sectors asked for
+//	by Prefetch into the cache, in order, forever.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::ReadAheadThread(void *synchDisk)
+{
+    SynchDisk *self = (SynchDisk *) synchDisk;
+
+    for (;;) {
+	DiskRequest *run = self->readAhead->RemoveFront();
+	self->FillRun(run->sector, run->count);
+	delete run;
+    }
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::FillRun
+// 	Load a run of consecutive sectors into the cache.  Each sector not
+//	already cached takes over the least recently used buffer that is
+//	neither busy nor dirty -- read-ahead never forces a write-back --
+//	and prefetching stops early if there is no such buffer.  The
+//	buffers are marked busy while the sectors are read, with one disk
+//	request per stretch of the run that was missing.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::FillRun(int firstSector, int numSectors)
+{
+    int *buffers = new int[numSectors];
+    char *data = new char[numSectors * SectorSize];
+    int i;
+
+    lock->Acquire();
+    for (i = 0; i < numSectors; i++) {
+	buffers[i] = -1;
+	if (FindBuffer(firstSector + i) != -1)
+	    continue;			// cached, or on its way
+	int which = -1;
+	for (int j = 0; j < numBuffers; j++) {
+	    if (!cache[j].busy && !cache[j].dirty && (which == -1 ||
+			cache[j].lastUsed < cache[which].lastUsed))
+		which = j;
+	}
+	if (which == -1)
+	    break;
+	if (cache[which].sector != -1) {
+	    kernel->stats->numCacheEvictions++;
+	    Unhash(which);
+	}
+	cache[which].sector = firstSector + i;
+	cache[which].next = hashHeads[cache[which].sector % numBuckets];
+	hashHeads[cache[which].sector % numBuckets] = which;
+	cache[which].busy = TRUE;
+	cache[which].lastUsed = ++useClock;
+	buffers[i] = which;
+    }
+    numSectors = i;
+    lock->Release();
+
+    for (i = 0; i < numSectors;) {
+	if (buffers[i] == -1) {
+	    i++;
+	    continue;
+	}
+	int end = i + 1;
+	while (end < numSectors && buffers[end] != -1)
+	    end++;
+
+	DiskRequest request;
+	RequestDone done;
+	request.sector = firstSector + i;
+	request.count = end - i;
+	request.data = &data[i * SectorSize];
+	request.writing = FALSE;
+	request.whenDone = &done;
+	Request(&request);
+	done.Wait();
+
+	lock->Acquire();
+	for (; i < end; i++) {
+	    memcpy(cache[buffers[i]].data, &data[i * SectorSize], SectorSize);
+	    cache[buffers[i]].busy = FALSE;
+	    kernel->stats->numCacheReadAheads++;
+	}
+	bufferReady->Broadcast(lock);
+	lock->Release();
+    }
+    delete [] data;
+    delete [] buffers;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Sync
+// 	Write every dirty sector in the buffer cache back to the disk.
+//	All the write-backs are queued at once, so the scheduling policy
+//	gets to order them.  The cached copies stay valid.  Must be
+//	called from a thread, since it waits for the disk.
+//
+//	The journal writes out its committed transactions first, so that
+//	they are in the cache to be synced too.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::Sync()
+{
+    if (journal != NULL)
+	journal->Sync();
+
+    DiskRequest *requests = new DiskRequest[numBuffers];
+    RequestDone *done = new RequestDone[numBuffers];
+    int numQueued = 0;
+
+    lock->Acquire();
+    for (int i = 0; i < numBuffers; i++) {
+	requests[i].whenDone = NULL;
+	while (cache[i].busy)		// wait out any eviction in progress
+	    bufferReady->Wait(lock);
+	if (cache[i].dirty) {
+	    cache[i].busy = TRUE;
+	    requests[i].sector = cache[i].sector;
+	    requests[i].data = cache[i].data;
+	    requests[i].writing = TRUE;
+	    requests[i].whenDone = &done[i];
+	    Request(&requests[i]);
+	    numQueued++;
+	}
+    }
+    lock->Release();
+
+    for (int i = 0; i < numBuffers && numQueued > 0; i++) {
+	if (requests[i].whenDone == &done[i]) {
+	    done[i].Wait();
+	    numQueued--;
+	}
+    }
+
+    lock->Acquire();
+    for (int i = 0; i < numBuffers; i++) {
+	if (requests[i].whenDone == &done[i]) {
+	    cache[i].dirty = FALSE;
+	    cache[i].busy = FALSE;
+	    kernel->stats->numCacheWriteBacks++;
+	}
+    }
+    bufferReady->Broadcast(lock);
+    lock->Release();
+
+    delete [] done;
+    delete [] requests;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Erase
+// 	Throw away the contents of the disk, so that every sector reads
+//	back as zeros, and empty the buffer cache (dirty sectors and all)
+//	to match.  Only used when formatting, when nothing else can be
+//	using the disk.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::Erase()
+{
+    lock->Acquire();
+    ASSERT(active == NULL && pending->IsEmpty());
+    for (int i = 0; i < numBuckets; i++)
+	hashHeads[i] = -1;
+    for (int i = 0; i < numBuffers; i++) {
+	ASSERT(!cache[i].busy);
+	cache[i].sector = -1;
+	cache[i].dirty = FALSE;
+	cache[i].lastUsed = 0;
+	cache[i].next = -1;
+    }
+    disk->Erase();
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Request
+// 	Queue an asynchronous request for the disk, and return at once.
+//	If the disk is idle the request is started right away; otherwise
+//	it is started from the interrupt handler of an earlier request.
+//	"request->whenDone" is called back, at interrupt level, once the
+//	transfer has completed.
+//
+//	"request" -- what to transfer; must stay allocated until then
+//----------------------------------------------------------------------
+
+void
+SynchDisk::Request(DiskRequest *request)
+{
+    IntStatus oldLevel = kernel->interrupt->SetLevel(IntOff);
+
+    ASSERT((request->sector >= 0) && (request->sector < NumSectors));
+    request->queuedAt = kernel->stats->totalTicks;
+    pending->Append(request);
+    if (active == NULL)
+	StartNext();
+    (void) kernel->interrupt->SetLevel(oldLevel);
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Transfer
+// 	Read or write a sector directly, bypassing the buffer cache,
+//	and wait until the disk is done with it.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::Transfer(int sectorNumber, char* data, bool writing)
+{
+    DiskRequest request;
+    RequestDone done;
+
+    request.sector = sectorNumber;
+    request.data = data;
+    request.writing = writing;
+    request.whenDone = &done;
+    Request(&request);
+    done.Wait();			// wait for interrupt
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::StartNext
+// 	If any requests are waiting, send the one chosen by the
+//	scheduling policy to the disk.  Called with interrupts off.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::StartNext()
+{
+    ASSERT(active == NULL);
+    if (pending->IsEmpty())
+	return;
+
+    active = ChooseNext();
+    pending->Remove(active);
+    DEBUG(dbgDisk, "Starting request for sector " << active->sector
+		<< ", " << pending->NumInList() << " left in queue");
+    if (active->writing)
+	disk->WriteSectors(active->sector, active->count, active->data);
+    else
+	disk->ReadSectors(active->sector, active->count, active->data);
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::MustWait
+// 	Requests that touch the same sectors, at least one of them a
+//	write, have to reach the disk in the order they were queued.
+//	Return TRUE if an earlier request in the queue conflicts with
+//	"request" in that way, so that it may not be started yet.
+//----------------------------------------------------------------------
+
+bool
+SynchDisk::MustWait(DiskRequest *request)
+{
+    ListIterator<DiskRequest *> iter(pending);
+
+    for (; iter.Item() != request; iter.Next()) {
+	DiskRequest *earlier = iter.Item();
+	if ((earlier->writing || request->writing)
+		&& earlier->sector < request->sector + request->count
+		&& request->sector < earlier->sector + earlier->count)
+	    return TRUE;
+    }
+    return FALSE;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::ChooseNext
+// 	Pick the queued request to serve next, according to the
+//	scheduling policy.  Seek distances are measured with
+//	Disk::TimeToSeek from the current position of the disk head.
+//	The request at the front of the queue can always be started, so
+//	there is always a choice.
+//----------------------------------------------------------------------
+
+DiskRequest *
+SynchDisk::ChooseNext()
+{
+    ListIterator<DiskRequest *> iter(pending);
+    DiskRequest *best = NULL;
+    DiskRequest *lowest = NULL;
+    int bestSeek = 0;
+    int head = disk->HeadSector();
+    int rotate;
+
+    switch (schedPolicy) {
+      case DiskFCFS:
+	return pending->Front();
+
+      case DiskSSTF:
+	for (; !iter.IsDone(); iter.Next()) {
+	    if (MustWait(iter.Item()))
+		continue;
+	    int seek = disk->TimeToSeek(iter.Item()->sector, &rotate);
+	    if (best == NULL || seek < bestSeek) {
+		best = iter.Item();
+		bestSeek = seek;
+	    }
+	}
+	return best;
+
+      case DiskSCAN:
+	// nearest request in the direction the head is sweeping;
+	// turn around when there is nothing left ahead
+	for (int pass = 0; pass < 2 && best == NULL; pass++) {
+	    for (iter = ListIterator<DiskRequest *>(pending);
+				!iter.IsDone(); iter.Next()) {
+		int sector = iter.Item()->sector;
+		if ((sweepUp ? (sector < head) : (sector > head))
+				|| MustWait(iter.Item()))
+		    continue;
+		int seek = disk->TimeToSeek(sector, &rotate);
+		if (best == NULL || seek < bestSeek) {
+		    best = iter.Item();
+		    bestSeek = seek;
+		}
+	    }
+	    if (best == NULL)
+		sweepUp = !sweepUp;
+	}
+	return best;
+
+      case DiskCLOOK:
+	// lowest sector at or beyond the head; once past the last
+	// request, jump back to the lowest one
+	for (; !iter.IsDone(); iter.Next()) {
+	    int sector = iter.Item()->sector;
+	    if (MustWait(iter.Item()))
+		continue;
+	    if (lowest == NULL || sector < lowest->sector)
+		lowest = iter.Item();
+	    if (sector >= head && (best == NULL || sector < best->sector))
+		best = iter.Item();
+	}
+	return (best != NULL) ? best : lowest;
+    }
+    ASSERTNOTREACHED();
+    return NULL;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::FindBuffer
+// 	Look up a sector in the buffer cache.  Return the index of the
+//	buffer holding it, or -1 if it is not cached.
+//----------------------------------------------------------------------
+
+int
+SynchDisk::FindBuffer(int sectorNumber)
+{
+    for (int i = hashHeads[sectorNumber % numBuckets]; i != -1;
+							i = cache[i].next) {
+	if (cache[i].sector == sectorNumber)
+	    return i;
+    }
+    return -1;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Unhash
+// 	Take a buffer off the hash chain of the sector it holds.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::Unhash(int which)
+{
+    int *link = &hashHeads[cache[which].sector % numBuckets];
+
+    while (*link != which) {
+	ASSERT(*link != -1);
+	link = &cache[*link].next;
+    }
+    *link = cache[which].next;
+    cache[which].next = -1;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::GetBuffer
+// 	Return the buffer holding "sectorNumber", loading it into the
+//	cache if necessary.  On a miss, the least recently used buffer
+//	is reused, after writing it back if it is dirty.
+//
+//	The cache lock is held on entry and on return, but is let go
+//	while waiting for the disk, so that other threads can use the
+//	cache (and queue their own requests) in the meantime.  Buffers
+//	in transit are marked busy, and nobody else touches them until
+//	the transfer is over.
+//
+//	"sectorNumber" -- the sector wanted
+//	"fetch" -- read the old contents from disk on a miss; FALSE when
+//		the caller is about to overwrite the whole sector
+//----------------------------------------------------------------------
+
+int
+SynchDisk::GetBuffer(int sectorNumber, bool fetch)
+{
+    int which;
+
+    for (;;) {
+	which = FindBuffer(sectorNumber);
+	if (which != -1) {
+	    if (cache[which].busy) {	// someone else is loading it
+		bufferReady->Wait(lock);
+		continue;
+	    }
+	    kernel->stats->numCacheHits++;
+	    break;
+	}
+
+	which = -1;
+	for (int i = 0; i < numBuffers; i++) {
+	    if (!cache[i].busy && (which == -1 ||
+			cache[i].lastUsed < cache[which].lastUsed))
+		which = i;
+	}
+	if (which == -1) {		// every buffer is in transit
+	    bufferReady->Wait(lock);
+	    continue;
+	}
+	if (cache[which].dirty) {
+	    // clean the victim first; the cache may have changed by the
+	    // time that is done, so start the lookup over afterwards
+	    cache[which].busy = TRUE;
+	    lock->Release();
+	    Transfer(cache[which].sector, cache[which].data, TRUE);
+	    lock->Acquire();
+	    cache[which].busy = FALSE;
+	    cache[which].dirty = FALSE;
+	    kernel->stats->numCacheWriteBacks++;
+	    bufferReady->Broadcast(lock);
+	    continue;
+	}
+
+	kernel->stats->numCacheMisses++;
+	if (cache[which].sector != -1) {
+	    DEBUG(dbgDisk, "Evicting sector " << cache[which].sector
+				<< " from the buffer cache");
+	    kernel->stats->numCacheEvictions++;
+	    Unhash(which);
+	}
+	cache[which].sector = sectorNumber;
+	cache[which].next = hashHeads[sectorNumber % numBuckets];
+	hashHeads[sectorNumber % numBuckets] = which;
+	if (fetch) {
+	    cache[which].busy = TRUE;
+	    lock->Release();
+	    Transfer(sectorNumber, cache[which].data, FALSE);
+	    lock->Acquire();
+	    cache[which].busy = FALSE;
+	    bufferReady->Broadcast(lock);
+	}
+	break;
+    }
+    cache[which].lastUsed = ++useClock;
+    return which;
 }
 
 //----------------------------------------------------------------------
 // SynchDisk::CallBack
-// 	Disk interrupt handler.  Wake up any thread waiting for the disk
-//	request to finish.
+// 	Disk interrupt handler.  Start the next queued request, if any,
+//	then tell whoever issued the request that just finished.
 //----------------------------------------------------------------------
 
 void
 SynchDisk::CallBack()
-{ 
-    semaphore->V();
+{
+    DiskRequest *done = active;
+
+    ASSERT(done != NULL);
+    active = NULL;
+    StartNext();
+    done->whenDone->CallBack();
+}
+
+// Parameters for the scheduling benchmark: each client thread reads
+// BenchRequests random sectors, one at a time, from the first
+// BenchTracks tracks of the disk.
+
+static const int BenchClients = 8;
+static const int BenchRequests = 16;
+static const int BenchTracks = 1024;
+
+class BenchClient {
+  public:
+    SynchDisk *disk;			// where to send the requests
+    int sectors[BenchRequests];		// which sectors to read
+    int totalLatency;			// sum of queued-to-done times
+    Semaphore *finished;		// V'ed when the client is done
+};
+
+static void
+BenchClientThread(void *arg)
+{
+    BenchClient *client = (BenchClient *) arg;
+    char buffer[SectorSize];
+
+    for (int i = 0; i < BenchRequests; i++) {
+	DiskRequest request;
+	RequestDone done;
+
+	request.sector = client->sectors[i];
+	request.data = buffer;
+	request.writing = FALSE;
+	request.whenDone = &done;
+	client->disk->Request(&request);
+	done.Wait();
+	client->totalLatency += done.finishedAt - request.queuedAt;
+    }
+    client->finished->V();
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Benchmark
+// 	Run the same read workload, from several concurrent threads,
+//	under each scheduling policy in turn, and print the average
+//	time each request spent queued and in service, along with the
+//	total number of ticks the disk spent seeking.  Reads bypass the
+//	buffer cache, so every one of them goes to the disk.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::Benchmark()
+{
+    static char *policyNames[] = { "FCFS", "SSTF", "SCAN", "C-LOOK" };
+    DiskPolicy oldPolicy = schedPolicy;
+    BenchClient *clients = new BenchClient[BenchClients];
+    Semaphore *finished = new Semaphore("disk benchmark", 0);
+
+    for (int c = 0; c < BenchClients; c++) {
+	for (int i = 0; i < BenchRequests; i++)
+	    clients[c].sectors[i] =
+		RandomNumber() % (BenchTracks * SectorsPerTrack);
+    }
+
+    for (int p = DiskFCFS; p <= DiskCLOOK; p++) {
+	int startSeek = kernel->stats->numDiskSeekTicks;
+	int startTicks = kernel->stats->totalTicks;
+	int totalLatency = 0;
+
+	schedPolicy = (DiskPolicy) p;
+	for (int c = 0; c < BenchClients; c++) {
+	    clients[c].disk = this;
+	    clients[c].totalLatency = 0;
+	    clients[c].finished = finished;
+	    Thread *t = new Thread("disk client", c + 1);
+	    t->Fork((VoidFunctionPtr) BenchClientThread, (void *) &clients[c]);
+	}
+	for (int c = 0; c < BenchClients; c++) {
+	    finished->P();
+	}
+	for (int c = 0; c < BenchClients; c++)
+	    totalLatency += clients[c].totalLatency;
+
+	cout << policyNames[p] << ": average latency "
+	     << totalLatency / (BenchClients * BenchRequests)
+	     << " ticks, seeking " << kernel->stats->numDiskSeekTicks - startSeek
+	     << " ticks, elapsed " << kernel->stats->totalTicks - startTicks
+	     << " ticks\n";
+    }
+    schedPolicy = oldPolicy;
+    delete finished;
+    delete [] clients;
 }
@@ -1,9 +1,9 @@
-// synchdisk.h 
-// 	Data structures to export a synchronous interface to the raw 
+// synchdisk.h
+// 	Data structures to export a synchronous interface to the raw
 //	disk device.
 //
 // Copyright (c) 1992-1993 The Regents of the University of California.
-// All rights reserved.  See copyright.h for copyright notice and limitation 
+// All rights reserved.  See copyright.h for copyright notice and limitation
 // of liability and disclaimer of warranty provisions.
 
 #include "copyright.h"
@@ -14,6 +14,36 @@
 #include "disk.h"
 #include "synch.h"
 #include "callback.h"
+#include "list.h"
+#include "synchlist.h"
+
+class Journal;
+
+// The order in which queued requests are handed to the disk.
+
+enum DiskPolicy {
+    DiskFCFS,		// first come, first served
+    DiskSSTF,		// shortest seek time first
+    DiskSCAN,		// elevator: sweep up and down across the tracks
+    DiskCLOOK		// sweep upwards only, then jump back to the lowest
+};
+
+// An asynchronous disk request.  The caller fills in the sector(s), the
+// buffer and the direction, and is called back (at interrupt level)
+// through "whenDone" once the transfer is complete.  The request
+// must stay allocated until then.
+
+class DiskRequest {
+  public:
+    DiskRequest() { count = 1; whenDone = NULL; }
+
+    int sector;				// the (first) sector to read or write
+    int count;				// number of consecutive sectors
+    char *data;				// where the data comes from or goes to
+    bool writing;			// write request?
+    CallBackObj *whenDone;		// told when the request completes
+    int queuedAt;			// time the request was queued
+};
 
 // The following class defines a "synchronous" disk abstraction.
 // As with other I/O devices, the raw physical disk is an asynchronous device --
@@ -22,34 +52,129 @@
 // (Also, the physical characteristics of the disk device assume that
 // only one operation can be requested at a time).
 //
-// This class provides the abstraction that for any individual thread
-// making a request, it waits around until the operation finishes before
-// returning.
+// This class keeps a queue of requests in front of the disk, and
+// hands them to the device one at a time, in the order chosen by the
+// scheduling policy.  For any individual thread making a synchronous
+// request, it waits around until the operation finishes before
+// returning; many threads may be waiting at once.
+//
+// A small write-back buffer cache of whole sectors sits in front of the
+// raw disk.  Reads are satisfied from the cache when possible, and
+// writes only mark the cached copy dirty; dirty sectors reach the disk
+// when they are evicted (least recently used first) or when Sync is
+// called.  A cache size of zero sends every request straight to the disk.
+//
+// Sectors can also be read into the cache ahead of time (Prefetch); a
+// kernel thread does the reading, so the caller does not wait for it.
+
+const int DefaultCacheSectors = 64;	// sectors buffered by default
+
+class SectorBuffer {
+  public:
+    int sector;				// disk sector held, or -1 if unused
+    bool dirty;				// modified since read from disk?
+    bool busy;				// being transferred to or from disk?
+    unsigned int lastUsed;		// for least recently used replacement
+    int next;				// next buffer in the same hash chain
+    char data[SectorSize];		// the cached contents of the sector
+};
 
 class SynchDisk : public CallBackObj {
   public:
-    SynchDisk();    		        // Initialize a synchronous disk,
+    SynchDisk(int cacheSectors = DefaultCacheSectors,
+	      DiskPolicy policy = DiskCLOOK, bool mapDisk = FALSE);
+					// Initialize a synchronous disk,
 					// by initializing the raw Disk.
     ~SynchDisk();			// De-allocate the synch disk data
-    
+
     void ReadSector(int sectorNumber, char* data);
     					// Read/write a disk sector, returning
-    					// only once the data is actually read 
-					// or written.  These call
-    					// Disk::ReadRequest/WriteRequest and
-					// then wait until the request is done.
+    					// only once the data is actually read
+					// or written.  These queue a request
+					// for the disk and then wait until
+					// it is done.
     void WriteSector(int sectorNumber, char* data);
-    
+
+    void ReadSectors(int firstSector, int numSectors, char* data);
+    void WriteSectors(int firstSector, int numSectors, char* data);
+					// Read/write a run of consecutive
+					// sectors
+    void ReadVector(int *sectors, int numSectors, char* data);
+    void WriteVector(int *sectors, int numSectors, char* data);
+					// Scatter-gather: sectors[i] goes
+					// to/from data[i * SectorSize]; each
+					// physically contiguous run is sent
+					// to the disk as one request
+
+    void WriteThrough(int firstSector, int numSectors, char* data);
+					// Write a run of consecutive sectors
+					// to the disk with one request,
+					// whatever the cache size
+
+    void Prefetch(int *sectors, int numSectors);
+					// Start reading sectors into the
+					// cache, and return at once
+    void Sync();			// Write every dirty cached sector
+					// back to the disk.
+    void Erase();			// Discard the contents of the whole
+					// disk, cached or not
+    int ImageBytes() { return disk->ImageBytes(); }
+					// host space used by the disk image
+
+    void Request(DiskRequest *request);	// Queue an asynchronous request,
+					// bypassing the cache, and return
+					// immediately.
+    void SetPolicy(DiskPolicy policy) { schedPolicy = policy; }
+    DiskPolicy GetPolicy() { return schedPolicy; }
+    void SetJournal(Journal *j) { journal = j; }
+					// Hand metadata writes to a journal
+
     void CallBack();			// Called by the disk device interrupt
 					// handler, to signal that the
 					// current disk operation is complete.
 
+    void Benchmark();			// Report request latency under
+					// each scheduling policy
+
   private:
     Disk *disk;		  		// Raw disk device
-    Semaphore *semaphore; 		// To synchronize requesting thread 
-					// with the interrupt handler
-    Lock *lock;		  		// Only one read/write request
-					// can be sent to the disk at a time
+    List<DiskRequest *> *pending;	// requests waiting for the disk
+    DiskRequest *active;		// request the disk is working on
+    DiskPolicy schedPolicy;		// how to pick the next request
+    bool sweepUp;			// DiskSCAN: head moving to higher tracks?
+
+    Lock *lock;		  		// Protects the buffer cache
+    Condition *bufferReady;		// Signalled when a busy buffer is
+					// done with its transfer
+    SectorBuffer *cache;		// the buffer cache
+    int numBuffers;			// number of entries in "cache"
+    int *hashHeads;			// first buffer of each hash chain
+    int numBuckets;			// number of hash chains
+    unsigned int useClock;		// advanced on every cache access
+
+    SynchList<DiskRequest *> *readAhead;// runs of sectors to prefetch
+    bool readAheadStarted;		// prefetching thread forked yet?
+    Journal *journal;			// holds sectors written in a file
+					// system transaction, or NULL
+
+    void Transfer(int sectorNumber, char *data, bool writing);
+					// Uncached transfer: queue a request
+					// and wait for it to finish
+    void StartNext();			// hand the next request to the disk
+    DiskRequest *ChooseNext();		// pick it according to the policy
+    bool MustWait(DiskRequest *request);// would it overtake a request
+					// for the same sectors?
+
+    int FindBuffer(int sectorNumber);	// cached buffer for a sector, or -1
+    int GetBuffer(int sectorNumber, bool fetch);
+					// buffer for a sector, evicting the
+					// least recently used one on a miss
+    void Unhash(int which);		// remove a buffer from its chain
+
+    static void ReadAheadThread(void *synchDisk);
+					// serves the prefetch requests
+    void FillRun(int firstSector, int numSectors);
+					// read a run into free buffers
 };
 
 #endif // SYNCHDISK_H
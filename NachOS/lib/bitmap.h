@@ -5,6 +5,10 @@
 //	Represented as an array of unsigned integers, on which we do
 //	modulo arithmetic to find the bit we are interested in.
 //
+//	Besides the bits themselves, the bitmap keeps the number of clear
+//	bits, in total and within each group of BitsInGroup bits, so that
+//	searches can step over full groups without looking at them.
+//
 //	The bitmap can be parameterized with with the number of bits being 
 //	managed.
 //
@@ -21,6 +25,8 @@
 // Definitions helpful for representing a bitmap as an array of integers
 const int BitsInByte =	8;
 const int BitsInWord = sizeof(unsigned int) * BitsInByte;
+const int BitsInGroup = 4096;		// bits per count of clear bits
+const int WordsInGroup = BitsInGroup / BitsInWord;
 
 // The following class defines a "bitmap" -- an array of bits,
 // each of which can be independently set, cleared, and tested.
@@ -34,18 +40,33 @@ class Bitmap {
   public:
     Bitmap(int numItems);	// Initialize a bitmap, with "numItems" bits
 				// initially, all bits are cleared.
-    ~Bitmap();			// De-allocate bitmap
+    virtual ~Bitmap();		// De-allocate bitmap
     
     void Mark(int which);   	// Set the "nth" bit
     void Clear(int which);  	// Clear the "nth" bit
     bool Test(int which) const;	// Is the "nth" bit set?
     int FindAndSet();         // Return the # of a clear bit, and as a side
-				// effect, set the bit. 
+				// effect, set the bit.  The search starts
+				// where the last one left off.
+				// If no bits are clear, return -1.
+    int FindRun(int wanted, int *length) const;
+				// Return the first bit of the clear run
+				// best fitting "wanted" bits, and put the
+				// run's full length in "length"; -1 if
+				// no bits are clear
+    int FindAndSetRun(int wanted, int *found);
+				// Set a run of up to "wanted" clear bits,
+				// chosen best-fit; return its first bit
+				// and put its length in "found".
 				// If no bits are clear, return -1.
-    int NumClear() const;	// Return the number of clear bits
+    int NumClear() const { return numClear; }
+				// Return the number of clear bits
 
     void Print() const;		// Print contents of bitmap
     void SelfTest();		// Test whether bitmap is working
+    static void Benchmark(int numItems);
+				// Time allocations from a bitmap of
+				// "numItems" bits, at several fill levels
     
   protected:
     int numBits;		// number of bits in the bitmap
@@ -54,6 +75,23 @@ class Bitmap {
 				//  multiple of the number of bits in
 				//  a word)
     unsigned int *map;		// bit storage
+
+    int numClear;		// number of clear bits
+    int *groupClear;		// number of clear bits in each group
+    int hint;			// word where FindAndSet last found a bit
+
+    void Recount();		// Recompute the counts, after "map" has
+				// been overwritten
+    virtual void Changed(int which) {}
+				// Called when bit "which" flips
+    int FindClearWord(int first, int last) const;
+				// First word in [first, last) with a
+				// clear bit, or -1
+    int NextClear(int which) const;
+				// First clear bit from "which" on, or -1
+    int NextSet(int which) const;
+				// First set bit from "which" on, or
+				// numBits
 };
 
 #endif // BITMAP_H
@@ -33,6 +33,7 @@
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <cerrno>
+#include <sys/mman.h>
 
 #ifdef SOLARIS
 // KMS
@@ -132,6 +133,21 @@ Delay(int seconds)
     (void) sleep((unsigned) seconds);
 }
 
+//----------------------------------------------------------------------
+// WallClock
+// 	Return the host's time of day, in seconds, for measuring how long
+//	the simulator itself takes to do something.
+//----------------------------------------------------------------------
+
+double
+WallClock()
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
 //----------------------------------------------------------------------
 // UDelay
 // 	Put the UNIX process running Nachos to sleep for x microseconds,
@@ -367,6 +383,106 @@ WriteFile(int fd, char *buffer, int nBytes)
 	ASSERT(retVal == nBytes);
 }
 
+//----------------------------------------------------------------------
+// ReadAtOffset/WriteAtOffset
+// 	Read/write characters at a given offset in an open file, without
+//	a separate seek.  Abort if the transfer comes up short.
+//----------------------------------------------------------------------
+
+void
+ReadAtOffset(int fd, char *buffer, int nBytes, int offset)
+{
+    int retVal = pread(fd, buffer, nBytes, offset);
+    ASSERT(retVal == nBytes);
+}
+
+void
+WriteAtOffset(int fd, char *buffer, int nBytes, int offset)
+{
+    int retVal = pwrite(fd, buffer, nBytes, offset);
+    ASSERT(retVal == nBytes);
+}
+
+//----------------------------------------------------------------------
+// Truncate
+// 	Set the length of an open file.  Growing a file this way leaves
+//	a hole, which reads back as zeros and takes no space on the host.
+//----------------------------------------------------------------------
+
+void
+Truncate(int fd, int length)
+{
+    int retVal = ftruncate(fd, length);
+    ASSERT(retVal == 0);
+}
+
+//----------------------------------------------------------------------
+// AllocatedBytes
+// 	Return how many bytes of an open file actually hold data, as
+//	opposed to holes, by walking it with SEEK_DATA/SEEK_HOLE.  Hosts
+//	that cannot tell report the whole file as data.
+//----------------------------------------------------------------------
+
+int
+AllocatedBytes(int fd)
+{
+    int end = lseek(fd, 0, SEEK_END);
+    int total = 0;
+
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+    int offset = 0;
+    while (offset < end) {
+	int data = lseek(fd, offset, SEEK_DATA);
+	if (data < 0)
+	    break;			// nothing but a hole from here on
+	int hole = lseek(fd, data, SEEK_HOLE);
+	total += hole - data;
+	offset = hole;
+    }
+#else
+    total = end;
+#endif
+    return total;
+}
+
+//----------------------------------------------------------------------
+// MapFile
+// 	Map the first "nBytes" of an open file into memory, shared, so
+//	that stores to the mapping update the file.  Abort on error.
+//----------------------------------------------------------------------
+
+char *
+MapFile(int fd, int nBytes)
+{
+    void *addr = mmap(NULL, nBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ASSERT(addr != MAP_FAILED);
+    return (char *) addr;
+}
+
+//----------------------------------------------------------------------
+// SyncMappedFile
+// 	Force the modified pages of a mapping out to the file.
+//----------------------------------------------------------------------
+
+void
+SyncMappedFile(char *addr, int nBytes)
+{
+    int retVal = msync(addr, nBytes, MS_SYNC);
+    ASSERT(retVal == 0);
+}
+
+//----------------------------------------------------------------------
+// UnmapFile
+// 	Remove a mapping made by MapFile.
+//----------------------------------------------------------------------
+
+void
+UnmapFile(char *addr, int nBytes)
+{
+    int retVal = munmap(addr, nBytes);
+    ASSERT(retVal == 0);
+}
+
 //----------------------------------------------------------------------
 // Lseek
 // 	Change the location within an open file.  Abort on error.
@@ -35,12 +35,13 @@ const int DiskSize = (MagicSize + (NumSectors * SectorSize));
 // 	ok to treat it as Nachos disk storage.
 //
 //	"toCall" -- object to call when disk read/write request completes
+//	"mapped" -- map the UNIX file into memory, rather than reading
+//		and writing it a sector at a time
 //----------------------------------------------------------------------
 
-Disk::Disk(CallBackObj *toCall)
+Disk::Disk(CallBackObj *toCall, bool mapped)
 {
     int magicNum;
-    int tmp = 0;
 
     DEBUG(dbgDisk, "Initializing the disk.");
     callWhenDone = toCall;
@@ -56,9 +57,14 @@ Disk::Disk(CallBackObj *toCall)
         fileno = OpenForWrite(diskname);
 	magicNum = MagicNumber;  
 	WriteFile(fileno, (char *) &magicNum, MagicSize); // write magic number
-	// need to write at end of file, so that reads will not return EOF
-        Lseek(fileno, DiskSize - sizeof(int), 0);	
-	WriteFile(fileno, (char *)&tmp, sizeof(int));  
+	// make the file full size, so that reads will not return EOF;
+	// the rest of the file is a hole, and reads back as zeros
+	Truncate(fileno, DiskSize);
+    }
+    image = NULL;
+    if (mapped) {
+	DEBUG(dbgDisk, "Mapping the disk into memory.");
+	image = MapFile(fileno, DiskSize);
     }
     active = FALSE;
 }
@@ -66,11 +72,16 @@ Disk::Disk(CallBackObj *toCall)
 //----------------------------------------------------------------------
 // Disk::~Disk()
 // 	Clean up disk simulation, by closing the UNIX file representing the
-//	disk.
+//	disk.  If the file is mapped, everything written to the mapping is
+//	forced out to the file first.
 //----------------------------------------------------------------------
 
 Disk::~Disk()
 {
+    if (image != NULL) {
+	SyncMappedFile(image, DiskSize);
+	UnmapFile(image, DiskSize);
+    }
     Close(fileno);
 }
 
@@ -112,43 +123,120 @@ PrintSector (bool writing, int sector, char *data)
 void
 Disk::ReadRequest(int sectorNumber, char* data)
 {
-    int ticks = ComputeLatency(sectorNumber, FALSE);
+    ReadSectors(sectorNumber, 1, data);
+}
+
+void
+Disk::WriteRequest(int sectorNumber, char* data)
+{
+    WriteSectors(sectorNumber, 1, data);
+}
+
+//----------------------------------------------------------------------
+// Disk::ReadSectors/WriteSectors
+// 	Simulate a request to read/write a run of consecutive disk
+//	sectors.  The whole run is transferred with a single operation
+//	on the UNIX file, and completes with a single interrupt.  Once
+//	the head reaches the first sector, the rest stream past it one
+//	sector per RotationTime (plus a track-to-track seek whenever the
+//	run crosses onto the next track).
+//
+//	"firstSector" -- the first disk sector to read/write
+//	"numSectors" -- how many sectors in the run
+//	"data" -- the bytes to be written, the buffer to hold the incoming
+//		bytes; numSectors * SectorSize bytes long
+//----------------------------------------------------------------------
+
+void
+Disk::ReadSectors(int firstSector, int numSectors, char* data)
+{
+    int rotate;
+    int seek = TimeToSeek(firstSector, &rotate);
+    int ticks = ComputeLatency(firstSector, FALSE, numSectors);
 
     ASSERT(!active);				// only one request at a time
-    ASSERT((sectorNumber >= 0) && (sectorNumber < NumSectors));
+    ASSERT((firstSector >= 0) && (numSectors > 0)
+			&& (firstSector + numSectors <= NumSectors));
     
-    DEBUG(dbgDisk, "Reading from sector " << sectorNumber);
-    Lseek(fileno, SectorSize * sectorNumber + MagicSize, 0);
-    Read(fileno, data, SectorSize);
-    if (debug->IsEnabled('d'))
-	PrintSector(FALSE, sectorNumber, data);
+    DEBUG(dbgDisk, "Reading " << numSectors << " sectors from sector " << firstSector);
+    if (image != NULL)
+	memcpy(data, &image[SectorSize * firstSector + MagicSize],
+			numSectors * SectorSize);
+    else
+	ReadAtOffset(fileno, data, numSectors * SectorSize,
+			SectorSize * firstSector + MagicSize);
+    if (debug->IsEnabled('d')) {
+	for (int i = 0; i < numSectors; i++)
+	    PrintSector(FALSE, firstSector + i, &data[i * SectorSize]);
+    }
     
     active = TRUE;
-    UpdateLast(sectorNumber);
+    UpdateLast(firstSector, numSectors, ticks);
     kernel->stats->numDiskReads++;
+    kernel->stats->numDiskSeekTicks += seek;
     kernel->interrupt->Schedule(this, ticks, DiskInt);
 }
 
 void
-Disk::WriteRequest(int sectorNumber, char* data)
+Disk::WriteSectors(int firstSector, int numSectors, char* data)
 {
-    int ticks = ComputeLatency(sectorNumber, TRUE);
+    int rotate;
+    int seek = TimeToSeek(firstSector, &rotate);
+    int ticks = ComputeLatency(firstSector, TRUE, numSectors);
 
     ASSERT(!active);
-    ASSERT((sectorNumber >= 0) && (sectorNumber < NumSectors));
+    ASSERT((firstSector >= 0) && (numSectors > 0)
+			&& (firstSector + numSectors <= NumSectors));
     
-    DEBUG(dbgDisk, "Writing to sector " << sectorNumber);
-    Lseek(fileno, SectorSize * sectorNumber + MagicSize, 0);
-    WriteFile(fileno, data, SectorSize);
-    if (debug->IsEnabled('d'))
-	PrintSector(TRUE, sectorNumber, data);
+    DEBUG(dbgDisk, "Writing " << numSectors << " sectors to sector " << firstSector);
+    if (image != NULL)
+	memcpy(&image[SectorSize * firstSector + MagicSize], data,
+			numSectors * SectorSize);
+    else
+	WriteAtOffset(fileno, data, numSectors * SectorSize,
+			SectorSize * firstSector + MagicSize);
+    if (debug->IsEnabled('d')) {
+	for (int i = 0; i < numSectors; i++)
+	    PrintSector(TRUE, firstSector + i, &data[i * SectorSize]);
+    }
     
     active = TRUE;
-    UpdateLast(sectorNumber);
+    UpdateLast(firstSector, numSectors, ticks);
     kernel->stats->numDiskWrites++;
+    kernel->stats->numDiskSeekTicks += seek;
     kernel->interrupt->Schedule(this, ticks, DiskInt);
 }
 
+//----------------------------------------------------------------------
+// Disk::Erase
+// 	Throw away the contents of the whole disk, so that every sector
+//	reads back as zeros.  Rather than writing zeros everywhere, cut the
+//	UNIX file back to just the magic number and then stretch it out to
+//	full size again, leaving one big hole.  This takes no simulated
+//	time; a real disk would do it with a TRIM or a low-level format.
+//----------------------------------------------------------------------
+
+void
+Disk::Erase()
+{
+    ASSERT(!active);
+    DEBUG(dbgDisk, "Erasing the disk.");
+    Truncate(fileno, MagicSize);
+    Truncate(fileno, DiskSize);
+}
+
+//----------------------------------------------------------------------
+// Disk::ImageBytes
+// 	Return how much of the UNIX file holds data rather than holes;
+//	sectors that were never written since the last Erase take no space.
+//----------------------------------------------------------------------
+
+int
+Disk::ImageBytes()
+{
+    return AllocatedBytes(fileno);
+}
+
 //----------------------------------------------------------------------
 // Disk::CallBack()
 // 	Called by the machine simulation when the disk interrupt occurs.
@@ -223,11 +311,19 @@ Disk::ModuloDiff(int to, int from)
 //   	read requests to the current track to be satisfied more quickly.
 //   	The contents of the track buffer are discarded after every seek to 
 //   	a new track.
+//
+//	For a run of "numSectors" consecutive sectors, the remaining
+//	sectors follow at one per RotationTime, plus a one-track seek each
+//	time the run moves on to the next track.
 //----------------------------------------------------------------------
 
 int
-Disk::ComputeLatency(int newSector, bool writing)
+Disk::ComputeLatency(int newSector, bool writing, int numSectors)
 {
+    int endSector = newSector + numSectors - 1;
+    int streaming = (numSectors - 1) * RotationTime
+	+ (endSector / SectorsPerTrack - newSector / SectorsPerTrack) * SeekTime;
+
     int rotation;
     int seek = TimeToSeek(newSector, &rotation);
     int timeAfter = kernel->stats->totalTicks + seek + rotation;
@@ -237,31 +333,43 @@ Disk::ComputeLatency(int newSector, bool writing)
     if ((writing == FALSE) && (seek == 0) 
 		&& (((timeAfter - bufferInit) / RotationTime) 
 	     		> ModuloDiff(newSector, bufferInit / RotationTime))) {
-        DEBUG(dbgDisk, "Request latency = " << RotationTime);
-	return RotationTime; // time to transfer sector from the track buffer
+        DEBUG(dbgDisk, "Request latency = " << RotationTime + streaming);
+	return RotationTime + streaming; // time to transfer sector from
+					 // the track buffer
     }
 #endif
 
     rotation += ModuloDiff(newSector, timeAfter / RotationTime) * RotationTime;
 
-    DEBUG(dbgDisk, "Request latency = " << (seek + rotation + RotationTime));
-    return(seek + rotation + RotationTime);
+    DEBUG(dbgDisk, "Request latency = " << (seek + rotation + RotationTime + streaming));
+    return(seek + rotation + RotationTime + streaming);
 }
 
 //----------------------------------------------------------------------
 // Disk::UpdateLast
 //   	Keep track of the most recently requested sector.  So we can know
 //	what is in the track buffer.
+//
+//	"newSector" -- the first sector of the request
+//	"numSectors" -- how many consecutive sectors it covers
+//	"ticks" -- how long the whole request takes
 //----------------------------------------------------------------------
 
 void
-Disk::UpdateLast(int newSector)
+Disk::UpdateLast(int newSector, int numSectors, int ticks)
 {
     int rotate;
     int seek = TimeToSeek(newSector, &rotate);
+    int endSector = newSector + numSectors - 1;
     
     if (seek != 0)
 	bufferInit = kernel->stats->totalTicks + seek + rotate;
-    lastSector = newSector;
+    if (endSector / SectorsPerTrack != newSector / SectorsPerTrack) {
+	// the run ended on a later track; its track buffer started
+	// filling when the head arrived there
+	bufferInit = kernel->stats->totalTicks + ticks
+		- ((endSector % SectorsPerTrack) + 1) * RotationTime;
+    }
+    lastSector = endSector;
     DEBUG(dbgDisk, "Updating last sector = " << lastSector << " , " << bufferInit);
 }
@@ -46,6 +46,10 @@
 // disks these days now come with a track buffer.
 //
 // The track buffer simulation can be disabled by compiling with -DNOTRACKBUF
+//
+// Optionally, the UNIX file can be mapped into memory, so that each
+// transfer is a memory copy instead of a system call.  This only
+// changes how fast the simulator runs, not the simulated timing.
 
 const int SectorSize = 128;		// number of bytes per disk sector
 const int SectorsPerTrack  = 32;	// number of sectors per disk track 
@@ -55,9 +59,12 @@ const int NumSectors = (SectorsPerTrack * NumTracks);
 
 class Disk : public CallBackObj {
   public:
-    Disk(CallBackObj *toCall);          // Create a simulated disk.  
+    Disk(CallBackObj *toCall, bool mapped = FALSE);
+					// Create a simulated disk.  
 					// Invoke toCall->CallBack() 
 					// when each request completes.
+					// If "mapped", access the UNIX
+					// file through a memory mapping.
     ~Disk();				// Deallocate the disk.
     
     void ReadRequest(int sectorNumber, char* data);
@@ -67,26 +74,37 @@ class Disk : public CallBackObj {
     					// Only one request allowed at a time!
     void WriteRequest(int sectorNumber, char* data);
 
+    void ReadSectors(int firstSector, int numSectors, char* data);
+    void WriteSectors(int firstSector, int numSectors, char* data);
+					// Read/write a run of consecutive
+					// sectors as a single request
+
     void CallBack();			// Invoked when disk request 
 					// finishes. In turn calls, callWhenDone.
 
-    int ComputeLatency(int newSector, bool writing);	
+    void Erase();			// Make every sector read as zeros
+    int ImageBytes();			// Space the UNIX file really uses
+
+    int ComputeLatency(int newSector, bool writing, int numSectors = 1);
     					// Return how long a request to 
 					// newSector will take: 
 					// (seek + rotational delay + transfer)
+    int TimeToSeek(int newSector, int *rotate); // time to get to the new track
+    int HeadSector() { return lastSector; }
+					// where the head was last sent
 
   private:
     int fileno;				// UNIX file number for simulated disk 
     char diskname[32];			// name of simulated disk's file
+    char *image;			// the file mapped into memory, or NULL
     CallBackObj *callWhenDone;		// Invoke when any disk request finishes
     bool active;     			// Is a disk operation in progress?
     int lastSector;			// The previous disk request 
     int bufferInit;			// When the track buffer started 
 					// being loaded
 
-    int TimeToSeek(int newSector, int *rotate); // time to get to the new track
     int ModuloDiff(int to, int from);        // # sectors between to and from
-    void UpdateLast(int newSector);
+    void UpdateLast(int newSector, int numSectors, int ticks);
 };
 
 #endif // DISK_H
@@ -188,6 +188,34 @@ void Interrupt::OneTick()
     }
 }
 
+//----------------------------------------------------------------------
+// Interrupt::UserTicks
+// 	Advance simulated time for "count" user instructions at once, as
+//	"count" calls to OneTick would, when the caller knows that no
+//	interrupt falls due in that time (see TicksUntilDue).
+//----------------------------------------------------------------------
+void Interrupt::UserTicks(int count)
+{
+    Statistics *stats = kernel->stats;
+
+    ASSERT(status == UserMode && count < TicksUntilDue());
+    stats->totalTicks += count * UserTick;
+    stats->userTicks += count * UserTick;
+}
+
+//----------------------------------------------------------------------
+// Interrupt::TicksUntilDue
+// 	Return the number of ticks until the next pending interrupt falls
+//	due, so that a tick any sooner fires nothing; or a very large
+//	number if there is none pending.
+//----------------------------------------------------------------------
+int Interrupt::TicksUntilDue()
+{
+    if (pending->IsEmpty())
+        return 0x7fffffff;
+    return pending->Front()->when - kernel->stats->totalTicks;
+}
+
 //----------------------------------------------------------------------
 // Interrupt::YieldOnReturn
 // 	Called from within an interrupt handler, to cause a context switch
@@ -253,6 +281,9 @@ void Interrupt::Halt()
     cout << "This is halt\n";
     kernel->stats->Print();
 	*/
+    if (debug->IsEnabled(dbgStats)) {
+        kernel->stats->Print();
+    }
     delete debug;
 
     delete kernel; // Never returns.
@@ -278,7 +309,7 @@ int Interrupt::Open(char *filename)
 {
     return kernel->Open(filename);
 }
-int Interrupt::Write(char *buffer, int size, int id)
+int Interrupt::Write(int buffer, int size, int id)
 {
     return kernel->WriteFile(buffer, size, id);
 }
@@ -286,10 +317,14 @@ int Interrupt::Close(int fid)
 {
     return kernel->CloseFile(fid);
 }
-int Interrupt::Read(char *buffer, int size, int id)
+int Interrupt::Read(int buffer, int size, int id)
 {
     return kernel->ReadFile(buffer, size, id);
 }
+int Interrupt::Seek(int position, int id)
+{
+    return kernel->SeekFile(position, id);
+}
 
 //----------------------------------------------------------------------
 // Interrupt::Schedule
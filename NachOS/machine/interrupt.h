@@ -127,8 +127,9 @@ public:
   void DumpState(); // Print interrupt state
 
   int Create(char *filename, int initialSize);
-  int Write(char *buffer, int size, int id);
-  int Read(char *buffer, int size, int id);
+  int Write(int buffer, int size, int id);
+  int Read(int buffer, int size, int id);
+  int Seek(int position, int id);
   int Close(int pid);
   int Open(char *filename);
 
@@ -147,6 +148,9 @@ public:
   // by the hardware device simulators.
 
   void OneTick(); // Advance simulated time
+  void UserTicks(int count); // Advance time for "count" user
+      // instructions, none with an interrupt due
+  int TicksUntilDue(); // Ticks before the next interrupt
 
 private:
   IntStatus level; // are interrupts enabled or disabled?
@@ -50,9 +50,16 @@ void CheckEndian()
 //
 //	"debug" -- if TRUE, drop into the debugger after each user instruction
 //		is executed.
+//	"decodeCache" -- if TRUE, keep each instruction decoded once it has
+//		been fetched, so that loops skip the fetch and decode.
+//	"runBlocks" -- if TRUE (and "decodeCache"), run whole basic blocks
+//		of decoded instructions at a time.
+//	"fastTranslate" -- if TRUE, cache the translations of the pages user
+//		loads and stores touch, instead of translating every time.
 //----------------------------------------------------------------------
 
-Machine::Machine(bool debug)
+Machine::Machine(bool debug, bool decodeCache, bool runBlocks,
+		 bool fastTranslate)
 {
     int i;
 
@@ -61,18 +68,42 @@ Machine::Machine(bool debug)
     mainMemory = new char[MemorySize];
     for (i = 0; i < MemorySize; i++)
       	mainMemory[i] = 0;
-#ifdef USE_TLB
-    tlb = new TranslationEntry[TLBSize];
-    for (i = 0; i < TLBSize; i++)
-	tlb[i].valid = FALSE;
-    pageTable = NULL;
-#else	// use linear page table
-    tlb = NULL;
+    tlb = NULL;			// use linear page table, unless UseTLB
+    tlbAsid = NULL;
+    tlbStamp = NULL;
+    tlbEntries = tlbWays = 0;
+    tlbClock = 0;
+    asid = 0;
     pageTable = NULL;
-#endif
+
+    decoded = NULL;
+    decodedValid = NULL;
+    if (decodeCache) {
+	decoded = new Instruction[MemorySize / 4];
+	decodedValid = new bool[MemorySize / 4];
+	for (i = 0; i < MemorySize / 4; i++)
+	    decodedValid[i] = FALSE;
+    }
+    blockLength = NULL;
+    pageBlocks = NULL;
+    if (decodeCache && runBlocks) {
+	blockLength = new char[MemorySize / 4];
+	pageBlocks = new bool[NumPhysPages];
+	for (i = 0; i < MemorySize / 4; i++)
+	    blockLength[i] = 0;
+	for (i = 0; i < NumPhysPages; i++)
+	    pageBlocks[i] = FALSE;
+    }
+    blockTicks = 0;
+    numTraps = 0;
+    this->fastTranslate = fastTranslate;
+    FlushTranslations();
 
     singleStep = debug;
     CheckEndian();
+#ifdef USE_TLB
+    UseTLB(TLBSize, TLBSize, TLBFIFO);
+#endif
 }
 
 //----------------------------------------------------------------------
@@ -85,6 +116,53 @@ Machine::~Machine()
     delete [] mainMemory;
     if (tlb != NULL)
         delete [] tlb;
+    delete [] tlbAsid;
+    delete [] tlbStamp;
+    delete [] decoded;
+    delete [] decodedValid;
+    delete [] blockLength;
+    delete [] pageBlocks;
+}
+
+//----------------------------------------------------------------------
+// Machine::FlushDecoded
+// 	Forget the decoded form of every instruction in "size" bytes of
+//	physical memory starting at "physAddr", because the memory has
+//	been overwritten.  The simulator does this itself for user stores;
+//	the kernel must do it when it copies into mainMemory directly.
+//
+//	Entries are kept by physical address, and every fetch is still
+//	translated, so remapping a page needs no flush -- only reusing a
+//	frame for new contents does, and that means writing to it.
+//
+//	The basic blocks in the pages written are forgotten as well.
+//----------------------------------------------------------------------
+
+void
+Machine::FlushDecoded(int physAddr, int size)
+{
+    if (decoded == NULL || size <= 0)
+	return;
+    for (int i = physAddr / 4; i <= (physAddr + size - 1) / 4; i++) {
+	decodedValid[i] = FALSE;
+	if (pageBlocks != NULL && pageBlocks[i / WordsPerPage])
+	    ForgetBlocks(i / WordsPerPage);
+    }
+}
+
+//----------------------------------------------------------------------
+// Machine::ForgetBlocks
+// 	Forget the lengths of the basic blocks in physical page "page",
+//	because some word in it has changed.  (Blocks never cross a page,
+//	so no others can include the word.)
+//----------------------------------------------------------------------
+
+void
+Machine::ForgetBlocks(int page)
+{
+    for (int i = page * WordsPerPage; i < (page + 1) * WordsPerPage; i++)
+	blockLength[i] = 0;
+    pageBlocks[page] = FALSE;
 }
 
 //----------------------------------------------------------------------
@@ -101,10 +179,16 @@ void
 Machine::RaiseException(ExceptionType which, int badVAddr)
 {
     DEBUG(dbgMach, "Exception: " << exceptionNames[which]);
+    numTraps++;
+    if (blockTicks > 0) {	// charge the block's time up to here
+	kernel->interrupt->UserTicks(blockTicks);
+	blockTicks = 0;
+    }
     registers[BadVAddrReg] = badVAddr;
     DelayedLoad(0, 0);			// finish anything in progress
     kernel->interrupt->setStatus(SystemMode);
     ExceptionHandler(which);		// interrupts are enabled at this point
+    FlushTranslations();		// the handler may have changed them
     kernel->interrupt->setStatus(UserMode);
 }
 
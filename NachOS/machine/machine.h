@@ -38,7 +38,18 @@ const int PageSize = 128; 		// set the page size equal to
 const int NumPhysPages = 128;
 
 const int MemorySize = (NumPhysPages * PageSize);
+const int WordsPerPage = PageSize / 4;	// instructions in a page
 const int TLBSize = 4;			// if there is a TLB, make it small
+					// (by default; see Machine::UseTLB)
+
+// Which entry of a TLB set a refill replaces, when none is free
+enum TLBPolicy {
+    TLBFIFO,		// the one loaded longest ago
+    TLBLRU,		// the one used longest ago
+    TLBRandom		// any of them
+};
+const int FastTranslations = 32;	// translations the simulator keeps
+					// for itself; a power of two
 
 enum ExceptionType { NoException,           // Everything ok!
 		     SyscallException,      // A program executed a system call.
@@ -88,12 +99,48 @@ enum ExceptionType { NoException,           // Everything ok!
 // The procedures in this class are defined in machine.cc, mipssim.cc, and
 // translate.cc.
 
-class Instruction;
+// The following class defines an instruction, represented in both
+// 	undecoded binary form
+//      decoded to identify
+//	    operation to do
+//	    registers to act on
+//	    any immediate operand value
+
+class Instruction {
+  public:
+    void Decode();	// decode the binary representation of the instruction
+
+    unsigned int value; // binary representation of the instruction
+
+    char opCode;     // Type of instruction.  This is NOT the same as the
+    		     // opcode field from the instruction: see defs in mips.h
+    char rs, rt, rd; // Three registers from instruction.
+    int extra;       // Immediate or target or shamt field or offset.
+                     // Immediates are sign-extended.
+};
+
+// The following class remembers one translation that ReadMem or WriteMem
+// has already checked, so that later accesses to the same virtual page
+// can go straight to its frame.  This is the simulator's own bookkeeping,
+// not part of the simulated hardware: user programs and the kernel never
+// see it, except that the kernel must flush it (FlushTranslations) when
+// it changes a page table or the TLB.
+
+class FastTranslation {
+  public:
+    int virtualPage;	// the page translated, or -1 if none
+    char *frame;	// the start of its frame, in mainMemory
+    bool writable;	// have stores been checked too, and the page
+			// marked dirty?
+};
+
 class Interrupt;
 
 class Machine {
   public:
-    Machine(bool debug);	// Initialize the simulation of the hardware
+    Machine(bool debug, bool decodeCache = TRUE, bool runBlocks = TRUE,
+	    bool fastTranslate = TRUE);
+				// Initialize the simulation of the hardware
 				// for running user programs
     ~Machine();			// De-allocate the data structures
 
@@ -131,9 +178,27 @@ class Machine {
 // space, stored in memory), there is only one TLB (implemented in hardware).
 // Thus the TLB pointer should be considered as *read-only*, although 
 // the contents of the TLB are free to be modified by the kernel software.
+//
+// The TLB is "tlbEntries" entries, in sets of "tlbWays": a virtual page
+// can only be in the set numbered vpn % (tlbEntries / tlbWays).  Each
+// entry is tagged with the address space it belongs to (in "tlbAsid"),
+// and only matches while "asid" is set to that space, so the TLB need
+// not be flushed on a context switch.  TLBVictim tells the kernel which
+// entry to replace on a miss.
 
     TranslationEntry *tlb;		// this pointer should be considered 
 					// "read-only" to Nachos kernel code
+    int *tlbAsid;			// address space of each TLB entry
+    int tlbEntries;			// size of the TLB
+    int tlbWays;			// entries in each set
+    int asid;				// address space being run
+
+    void UseTLB(int entries, int ways, TLBPolicy policy);
+				// Translate through a TLB of "entries"
+				// entries, "ways" to a set, instead of a
+				// page table
+    int TLBVictim(int vpn);	// The TLB entry to load virtual page
+				// "vpn" into, for the current space
 
     TranslationEntry *pageTable;
     unsigned int pageTableSize;
@@ -143,6 +208,17 @@ class Machine {
     				// Read or write 1, 2, or 4 bytes of virtual 
 				// memory (at addr).  Return FALSE if a 
 				// correct translation couldn't be found.
+
+    void FlushDecoded(int physAddr, int size);
+				// Forget the decoded instructions in
+				// "size" bytes of physical memory; the
+				// kernel must call this whenever it
+				// writes into mainMemory itself
+
+    void FlushTranslations();	// Forget the translations ReadMem and
+				// WriteMem have cached; the kernel must
+				// call this whenever it changes the page
+				// table or the TLB
   private:
 
 // Routines internal to the machine simulation -- DO NOT call these directly
@@ -151,9 +227,21 @@ class Machine {
 
     void OneInstruction(Instruction *instr); 	
     				// Run one instruction of a user program.
+    int Execute(Instruction *instr, int count, bool *valid);
+				// Run instructions once they are decoded
+    bool RunBlock();		// Run a basic block of a user program, if
+				// we can
+    int FindBlock(int start);	// Decode the basic block at a word
     
 
 
+    bool SlowReadMem(int addr, int size, int* value);
+    bool SlowWriteMem(int addr, int size, int value);
+				// ReadMem and WriteMem, when the translation
+				// isn't cached: translate, and cache it
+    void Overwritten(int physAddr);	// Forget any instruction decoded at
+				// a word that is being stored to
+
     ExceptionType Translate(int virtAddr, int* physAddr, int size,bool writing);
     				// Translate an address, and check for 
 				// alignment.  Set the use and dirty bits in 
@@ -178,6 +266,26 @@ class Machine {
     int runUntilTime;		// drop back into the debugger when simulated
 				// time reaches this value
 
+    Instruction *decoded;	// instructions already decoded, indexed by
+				// physical word address; NULL if disabled
+    bool *decodedValid;		// is decoded[i] up to date with memory?
+    char *blockLength;		// length of the basic block starting at
+				// each word, if known; NULL if disabled
+    bool *pageBlocks;		// any blocks known in a physical page?
+    int blockTicks;		// instructions run in the current block,
+				// whose time is not yet charged
+    unsigned int numTraps;	// exceptions raised so far
+    TLBPolicy tlbPolicy;	// which TLB entry TLBVictim replaces
+    unsigned int *tlbStamp;	// when each TLB entry was loaded (FIFO)
+				// or last used (LRU)
+    unsigned int tlbClock;	// TLB loads and uses so far, for stamps
+    bool fastTranslate;		// cache translations for ReadMem/WriteMem?
+    FastTranslation fastTLB[FastTranslations];
+				// recent translations, indexed by virtual
+				// page number modulo FastTranslations
+
+    void ForgetBlocks(int page);	// Forget the blocks in a page
+
     friend class Interrupt;		// calls DelayedLoad()    
 };
 
@@ -198,9 +306,114 @@ extern void ExceptionHandler(ExceptionType which);
 //	simulated machine byte ordering:
 //	   contents of main memory
 
-unsigned int WordToHost(unsigned int word);
-unsigned short ShortToHost(unsigned short shortword);
-unsigned int WordToMachine(unsigned int word);
-unsigned short ShortToMachine(unsigned short shortword);
+inline unsigned int
+WordToHost(unsigned int word) {
+#ifdef HOST_IS_BIG_ENDIAN
+	 register unsigned long result;
+	 result = (word >> 24) & 0x000000ff;
+	 result |= (word >> 8) & 0x0000ff00;
+	 result |= (word << 8) & 0x00ff0000;
+	 result |= (word << 24) & 0xff000000;
+	 return result;
+#else 
+	 return word;
+#endif /* HOST_IS_BIG_ENDIAN */
+}
+
+inline unsigned short
+ShortToHost(unsigned short shortword) {
+#ifdef HOST_IS_BIG_ENDIAN
+	 register unsigned short result;
+	 result = (shortword << 8) & 0xff00;
+	 result |= (shortword >> 8) & 0x00ff;
+	 return result;
+#else 
+	 return shortword;
+#endif /* HOST_IS_BIG_ENDIAN */
+}
+
+inline unsigned int
+WordToMachine(unsigned int word) { return WordToHost(word); }
+
+inline unsigned short
+ShortToMachine(unsigned short shortword) { return ShortToHost(shortword); }
+
+//----------------------------------------------------------------------
+// Machine::ReadMem, Machine::WriteMem
+//	Read or write "size" (1, 2, or 4) bytes of virtual memory at "addr".
+//	See translate.cc.
+//
+//	These are the common case, inline: the page was translated a
+//	moment ago, so the access goes straight to its frame.  Anything
+//	else -- a page not cached, a misaligned address, the first store
+//	to a page that has only been read -- takes the full path.
+//----------------------------------------------------------------------
+
+inline bool
+Machine::ReadMem(int addr, int size, int *value)
+{
+    unsigned int vpn = (unsigned) addr / PageSize;
+    FastTranslation *fast = &fastTLB[vpn % FastTranslations];
+    char *p;
+
+    if (fast->virtualPage != (int) vpn || (addr & (size - 1)) != 0)
+	return SlowReadMem(addr, size, value);
+    p = fast->frame + (unsigned) addr % PageSize;
+    switch (size) {
+      case 1:
+	*value = *p;
+	break;
+      case 2:
+	*value = ShortToHost(*(unsigned short *) p);
+	break;
+      default:
+	*value = WordToHost(*(unsigned int *) p);
+	break;
+    }
+    return TRUE;
+}
+
+inline bool
+Machine::WriteMem(int addr, int size, int value)
+{
+    unsigned int vpn = (unsigned) addr / PageSize;
+    FastTranslation *fast = &fastTLB[vpn % FastTranslations];
+    char *p;
+
+    if (fast->virtualPage != (int) vpn || !fast->writable
+			|| (addr & (size - 1)) != 0)
+	return SlowWriteMem(addr, size, value);
+    p = fast->frame + (unsigned) addr % PageSize;
+    Overwritten(p - mainMemory);
+    switch (size) {
+      case 1:
+	*p = (unsigned char) (value & 0xff);
+	break;
+      case 2:
+	*(unsigned short *) p = ShortToMachine((unsigned short) (value & 0xffff));
+	break;
+      default:
+	*(unsigned int *) p = WordToMachine((unsigned int) value);
+	break;
+    }
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// Machine::Overwritten
+//	A user store is about to change the word at "physAddr", which may
+//	have been an instruction; forget its decoded form, and the blocks
+//	in its page.
+//----------------------------------------------------------------------
+
+inline void
+Machine::Overwritten(int physAddr)
+{
+    if (decoded != NULL) {
+	decodedValid[physAddr / 4] = FALSE;
+	if (pageBlocks != NULL && pageBlocks[physAddr / PageSize])
+	    ForgetBlocks(physAddr / PageSize);
+    }
+}
 
 #endif // MACHINE_H
@@ -24,26 +24,6 @@
 
 static void Mult(int a, int b, bool signedArith, int* hiPtr, int* loPtr);
 
-// The following class defines an instruction, represented in both
-// 	undecoded binary form
-//      decoded to identify
-//	    operation to do
-//	    registers to act on
-//	    any immediate operand value
-
-class Instruction {
-  public:
-    void Decode();	// decode the binary representation of the instruction
-
-    unsigned int value; // binary representation of the instruction
-
-    char opCode;     // Type of instruction.  This is NOT the same as the
-    		     // opcode field from the instruction: see defs in mips.h
-    char rs, rt, rd; // Three registers from instruction.
-    int extra;       // Immediate or target or shamt field or offset.
-                     // Immediates are sign-extended.
-};
-
 //----------------------------------------------------------------------
 // Machine::Run
 // 	Simulate the execution of a user-level program on Nachos.
@@ -51,12 +31,18 @@ class Instruction {
 //
 //	This routine is re-entrant, in that it can be called multiple
 //	times concurrently -- one for each thread executing user code.
+//
+//	Where it can, a whole basic block is run at a time (see RunBlock);
+//	single-stepping or tracing instructions or interrupts falls back
+//	to one instruction at a time.
 //----------------------------------------------------------------------
 
 void
 Machine::Run()
 {
     Instruction *instr = new Instruction;  // storage for decoded instruction
+    bool blocks = (blockLength != NULL) && !singleStep &&
+		!debug->IsEnabled('m') && !debug->IsEnabled('i');
 
     if (debug->IsEnabled('m')) {
         cout << "Starting program in thread: " << kernel->currentThread->getName();
@@ -64,13 +50,115 @@ Machine::Run()
     }
     kernel->interrupt->setStatus(UserMode);
     for (;;) {
-        OneInstruction(instr);
+	if (!blocks || !RunBlock())
+	    OneInstruction(instr);
 		kernel->interrupt->OneTick();
 		if (singleStep && (runUntilTime <= kernel->stats->totalTicks))
 	  		Debugger();
     }
 }
 
+//----------------------------------------------------------------------
+// IsBranch
+// 	Return TRUE if an instruction may transfer control, so that a
+//	basic block ends after its delay slot.
+//----------------------------------------------------------------------
+
+static bool
+IsBranch(int opCode)
+{
+    switch (opCode) {
+      case OP_BEQ: case OP_BGEZ: case OP_BGEZAL: case OP_BGTZ:
+      case OP_BLEZ: case OP_BLTZ: case OP_BLTZAL: case OP_BNE:
+      case OP_J: case OP_JAL: case OP_JALR: case OP_JR:
+	return TRUE;
+      default:
+	return FALSE;
+    }
+}
+
+//----------------------------------------------------------------------
+// Machine::FindBlock
+// 	Find the basic block starting at physical word "start": the
+//	instructions up to the first branch or jump and its delay slot,
+//	without leaving the page.  Decode them, record the block's length
+//	and return it.
+//----------------------------------------------------------------------
+
+int
+Machine::FindBlock(int start)
+{
+    int pageEnd = (start / WordsPerPage + 1) * WordsPerPage;
+    int end;
+
+    for (end = start; end < pageEnd; end++) {
+	if (!decodedValid[end]) {
+	    kernel->stats->numDecodeMisses++;
+	    decoded[end].value = WordToHost(*(unsigned int *) &mainMemory[end * 4]);
+	    decoded[end].Decode();
+	    decodedValid[end] = TRUE;
+	}
+	if (IsBranch(decoded[end].opCode)) {
+	    end = min(end + 2, pageEnd);	// take in the delay slot
+	    break;
+	}
+    }
+    kernel->stats->numBlocksBuilt++;
+    blockLength[start] = end - start;
+    pageBlocks[start / WordsPerPage] = TRUE;
+    return end - start;
+}
+
+//----------------------------------------------------------------------
+// Machine::RunBlock
+// 	Run the basic block starting at the PC in one go, and return TRUE;
+//	or return FALSE, if the next instruction should be run by itself.
+//
+//	The instructions are executed exactly as OneInstruction would, but
+//	from the decoded block, with the PC translated once for the block,
+//	and simulated time advanced once for all but the last of them.
+//	Run() ticks for the last instruction as usual.  That is only exact
+//	if no interrupt falls due inside the block, so the block is cut
+//	short at the next pending interrupt; nor would a block be right
+//	in the delay slot of a taken branch, where the next PC is not the
+//	next word.
+//
+//	If an instruction traps, RaiseException charges the time of the
+//	instructions before it, so that the kernel sees the clock as it
+//	would have been, and the block ends there.  So it does if an
+//	instruction overwrites one later in the block.
+//----------------------------------------------------------------------
+
+bool
+Machine::RunBlock()
+{
+    int physPC, start, length, done;
+    unsigned int traps;
+
+    if (registers[NextPCReg] != registers[PCReg] + 4)
+	return FALSE;
+    if (Translate(registers[PCReg], &physPC, 4, FALSE) != NoException)
+	return FALSE;			// OneInstruction raises the exception
+
+    // a block is known only while its page is unchanged, so its
+    // instructions are all still decoded when it starts
+    start = physPC / 4;
+    length = blockLength[start];
+    if (length == 0)
+	length = FindBlock(start);
+    length = min(length, kernel->interrupt->TicksUntilDue());
+    if (length < 2)
+	return FALSE;
+
+    kernel->stats->numBlocksRun++;
+    traps = numTraps;
+    done = Execute(&decoded[start], length, &decodedValid[start]);
+    blockTicks = 0;
+    if (numTraps == traps)		// else the time is charged already
+	kernel->interrupt->UserTicks(done - 1);
+    return TRUE;
+}
+
 
 //----------------------------------------------------------------------
 // TypeToReg
@@ -119,22 +207,127 @@ TypeToReg(RegType reg, Instruction *instr)
 
 void
 Machine::OneInstruction(Instruction *instr)
+{
+    int raw, physPC;
+
+    // Fetch instruction.  If it has been decoded at this physical
+    // address before, and not overwritten since, use that instead; the
+    // PC is still translated, so faults and remapping behave as before.
+    if (decoded != NULL) {
+	ExceptionType exception = Translate(registers[PCReg], &physPC, 4, FALSE);
+	if (exception != NoException) {
+	    RaiseException(exception, registers[PCReg]);
+	    return;
+	}
+	instr = &decoded[physPC / 4];
+	if (decodedValid[physPC / 4]) {
+	    kernel->stats->numDecodeHits++;
+	} else {
+	    kernel->stats->numDecodeMisses++;
+	    instr->value = WordToHost(*(unsigned int *) &mainMemory[physPC]);
+	    instr->Decode();
+	    decodedValid[physPC / 4] = TRUE;
+	}
+    } else {
+	if (!ReadMem(registers[PCReg], 4, &raw))
+	    return;			// exception occurred
+	instr->value = raw;
+	instr->Decode();
+    }
+    Execute(instr, 1, NULL);
+}
+
+//----------------------------------------------------------------------
+// Machine::Execute
+// 	Execute up to "count" instructions already fetched and decoded,
+//	the first from the PC and the rest from the words after it, and
+//	advance the program counters past each.  Stop early after an
+//	instruction that traps (raising the exception, and leaving the
+//	counters for the kernel), or before one whose word has been
+//	overwritten since it was decoded ("valid" is FALSE).  Return the
+//	number of instructions that completed.
+//
+//	The instruction set is written once, as the cases of the switch
+//	below.  Compiled with THREADED_DISPATCH (GNU C++ only), each case
+//	is also labelled, and the cases are reached by jumping through a
+//	table of the labels' addresses ("computed goto") rather than by
+//	the switch.  Every case then finishes its own instruction and jumps
+//	straight to the case for the next one, so each has its own
+//	indirect jump for the host to predict, instead of all of them
+//	sharing the switch's.  (Only the first instruction is traced with
+//	-d m then; Run() does not hand over more than one while tracing.)
+//----------------------------------------------------------------------
+
+#ifdef THREADED_DISPATCH
+#define OPCASE(op)	case op: op##_label
+#define SET_HANDLER(op)	handlers[op] = &&op##_label
+#define NEXT		FINISH_INSTRUCTION; \
+			goto *handlers[(int) instr->opCode]
+#else
+#define OPCASE(op)	case op
+#define NEXT		break
+#endif
+
+// Do any delayed load operation and advance the program counters; then
+// stop, or set up for the next instruction.
+#define FINISH_INSTRUCTION \
+    DelayedLoad(nextLoadReg, nextLoadValue);				\
+    registers[PrevPCReg] = registers[PCReg];	/* for debugging, in case we */ \
+						/* are jumping into lala-land */ \
+    registers[PCReg] = registers[NextPCReg];				\
+    registers[NextPCReg] = pcAfter;					\
+    if (++done == count || !valid[done])				\
+	return done;							\
+    instr++;								\
+    blockTicks = done;							\
+    nextLoadReg = nextLoadValue = 0;					\
+    pcAfter = registers[NextPCReg] + 4
+
+int
+Machine::Execute(Instruction *instr, int count, bool *valid)
 {
 #ifdef SIM_FIX
     int byte;       // described in Kane for LWL,LWR,...
 #endif
 
-    int raw;
     int nextLoadReg = 0; 	
     int nextLoadValue = 0; 	// record delayed load operation, to apply
 				// in the future
+    int done = 0;		// instructions completed
 
-    // Fetch instruction 
-    if (!ReadMem(registers[PCReg], 4, &raw))
-	return;			// exception occurred
-    instr->value = raw;
-    instr->Decode();
+    // Compute next pc, but don't install in case there's an error or branch.
+    int pcAfter = registers[NextPCReg] + 4;
+    int sum, diff, tmp, value;
+    unsigned int rs, rt, imm;
 
+#ifdef THREADED_DISPATCH
+    static void *handlers[MaxOpcode + 1];
+
+    if (handlers[OP_RES] == NULL) {
+	// opcodes with no case are never decoded; treat them as reserved
+	for (int i = 0; i <= MaxOpcode; i++)
+	    handlers[i] = &&OP_RES_label;
+	SET_HANDLER(OP_ADD); SET_HANDLER(OP_ADDI); SET_HANDLER(OP_ADDIU); SET_HANDLER(OP_ADDU);
+	SET_HANDLER(OP_AND); SET_HANDLER(OP_ANDI); SET_HANDLER(OP_BEQ); SET_HANDLER(OP_BGEZAL);
+	SET_HANDLER(OP_BGEZ); SET_HANDLER(OP_BGTZ); SET_HANDLER(OP_BLEZ); SET_HANDLER(OP_BLTZAL);
+	SET_HANDLER(OP_BLTZ); SET_HANDLER(OP_BNE); SET_HANDLER(OP_DIV); SET_HANDLER(OP_DIVU);
+	SET_HANDLER(OP_JAL); SET_HANDLER(OP_J); SET_HANDLER(OP_JALR); SET_HANDLER(OP_JR);
+	SET_HANDLER(OP_LB); SET_HANDLER(OP_LBU); SET_HANDLER(OP_LH); SET_HANDLER(OP_LHU);
+	SET_HANDLER(OP_LUI); SET_HANDLER(OP_LW); SET_HANDLER(OP_LWL); SET_HANDLER(OP_LWR);
+	SET_HANDLER(OP_MFHI); SET_HANDLER(OP_MFLO); SET_HANDLER(OP_MTHI); SET_HANDLER(OP_MTLO);
+	SET_HANDLER(OP_MULT); SET_HANDLER(OP_MULTU); SET_HANDLER(OP_NOR); SET_HANDLER(OP_OR);
+	SET_HANDLER(OP_ORI); SET_HANDLER(OP_SB); SET_HANDLER(OP_SH); SET_HANDLER(OP_SLL);
+	SET_HANDLER(OP_SLLV); SET_HANDLER(OP_SLT); SET_HANDLER(OP_SLTI); SET_HANDLER(OP_SLTIU);
+	SET_HANDLER(OP_SLTU); SET_HANDLER(OP_SRA); SET_HANDLER(OP_SRAV); SET_HANDLER(OP_SRL);
+	SET_HANDLER(OP_SRLV); SET_HANDLER(OP_SUB); SET_HANDLER(OP_SUBU); SET_HANDLER(OP_SW);
+	SET_HANDLER(OP_SWL); SET_HANDLER(OP_SWR); SET_HANDLER(OP_SYSCALL); SET_HANDLER(OP_XOR);
+	SET_HANDLER(OP_XORI); SET_HANDLER(OP_RES); SET_HANDLER(OP_UNIMP);
+    }
+#endif
+
+    blockTicks = 0;
+
+  dispatch:
     if (debug->IsEnabled('m')) {
         struct OpString *str = &opStrings[instr->opCode];
 	char buf[80];
@@ -145,86 +338,85 @@ Machine::OneInstruction(Instruction *instr)
 	     TypeToReg(str->args[1], instr), TypeToReg(str->args[2], instr));
         cout << "\t" << buf << "\n";
     }
-    
-    // Compute next pc, but don't install in case there's an error or branch.
-    int pcAfter = registers[NextPCReg] + 4;
-    int sum, diff, tmp, value;
-    unsigned int rs, rt, imm;
+
+#ifdef THREADED_DISPATCH
+    goto *handlers[(int) instr->opCode];
+#endif
 
     // Execute the instruction (cf. Kane's book)
     switch (instr->opCode) {
 	
-      case OP_ADD:
+      OPCASE(OP_ADD):
 	sum = registers[instr->rs] + registers[instr->rt];
 	if (!((registers[instr->rs] ^ registers[instr->rt]) & SIGN_BIT) &&
 	    ((registers[instr->rs] ^ sum) & SIGN_BIT)) {
 	    RaiseException(OverflowException, 0);
-	    return;
+	    return done;
 	}
 	registers[instr->rd] = sum;
-	break;
+	NEXT;
 	
-      case OP_ADDI:
+      OPCASE(OP_ADDI):
 	sum = registers[instr->rs] + instr->extra;
 	if (!((registers[instr->rs] ^ instr->extra) & SIGN_BIT) &&
 	    ((instr->extra ^ sum) & SIGN_BIT)) {
 	    RaiseException(OverflowException, 0);
-	    return;
+	    return done;
 	}
 	registers[instr->rt] = sum;
-	break;
+	NEXT;
 	
-      case OP_ADDIU:
+      OPCASE(OP_ADDIU):
 	registers[instr->rt] = registers[instr->rs] + instr->extra;
-	break;
+	NEXT;
 	
-      case OP_ADDU:
+      OPCASE(OP_ADDU):
 	registers[instr->rd] = registers[instr->rs] + registers[instr->rt];
-	break;
+	NEXT;
 	
-      case OP_AND:
+      OPCASE(OP_AND):
 	registers[instr->rd] = registers[instr->rs] & registers[instr->rt];
-	break;
+	NEXT;
 	
-      case OP_ANDI:
+      OPCASE(OP_ANDI):
 	registers[instr->rt] = registers[instr->rs] & (instr->extra & 0xffff);
-	break;
+	NEXT;
 	
-      case OP_BEQ:
+      OPCASE(OP_BEQ):
 	if (registers[instr->rs] == registers[instr->rt])
 	    pcAfter = registers[NextPCReg] + IndexToAddr(instr->extra);
-	break;
+	NEXT;
 	
-      case OP_BGEZAL:
+      OPCASE(OP_BGEZAL):
 	registers[R31] = registers[NextPCReg] + 4;
-      case OP_BGEZ:
+      OPCASE(OP_BGEZ):
 	if (!(registers[instr->rs] & SIGN_BIT))
 	    pcAfter = registers[NextPCReg] + IndexToAddr(instr->extra);
-	break;
+	NEXT;
 	
-      case OP_BGTZ:
+      OPCASE(OP_BGTZ):
 	if (registers[instr->rs] > 0)
 	    pcAfter = registers[NextPCReg] + IndexToAddr(instr->extra);
-	break;
+	NEXT;
 	
-      case OP_BLEZ:
+      OPCASE(OP_BLEZ):
 	if (registers[instr->rs] <= 0)
 	    pcAfter = registers[NextPCReg] + IndexToAddr(instr->extra);
-	break;
+	NEXT;
 	
-      case OP_BLTZAL:
+      OPCASE(OP_BLTZAL):
 	registers[R31] = registers[NextPCReg] + 4;
-      case OP_BLTZ:
+      OPCASE(OP_BLTZ):
 	if (registers[instr->rs] & SIGN_BIT)
 	    pcAfter = registers[NextPCReg] + IndexToAddr(instr->extra);
-	break;
+	NEXT;
 	
-      case OP_BNE:
+      OPCASE(OP_BNE):
 	if (registers[instr->rs] != registers[instr->rt])
 	    pcAfter = registers[NextPCReg] + IndexToAddr(instr->extra);
-	break;
+	NEXT;
 	
-      case OP_DIV:
+      OPCASE(OP_DIV):
 	if (registers[instr->rt] == 0) {
 	    registers[LoReg] = 0;
 	    registers[HiReg] = 0;
@@ -232,9 +424,9 @@ Machine::OneInstruction(Instruction *instr)
 	    registers[LoReg] =  registers[instr->rs] / registers[instr->rt];
 	    registers[HiReg] = registers[instr->rs] % registers[instr->rt];
 	}
-	break;
+	NEXT;
 	
-      case OP_DIVU:	  
+      OPCASE(OP_DIVU):	  
 	  rs = (unsigned int) registers[instr->rs];
 	  rt = (unsigned int) registers[instr->rt];
 	  if (rt == 0) {
@@ -246,25 +438,25 @@ Machine::OneInstruction(Instruction *instr)
 	      tmp = rs % rt;
 	      registers[HiReg] = (int) tmp;
 	  }
-	  break;
+	  NEXT;
 	
-      case OP_JAL:
+      OPCASE(OP_JAL):
 	registers[R31] = registers[NextPCReg] + 4;
-      case OP_J:
+      OPCASE(OP_J):
 	pcAfter = (pcAfter & 0xf0000000) | IndexToAddr(instr->extra);
-	break;
+	NEXT;
 	
-      case OP_JALR:
+      OPCASE(OP_JALR):
 	registers[instr->rd] = registers[NextPCReg] + 4;
-      case OP_JR:
+      OPCASE(OP_JR):
 	pcAfter = registers[instr->rs];
-	break;
+	NEXT;
 	
-      case OP_LB:
-      case OP_LBU:
+      OPCASE(OP_LB):
+      OPCASE(OP_LBU):
 	tmp = registers[instr->rs] + instr->extra;
 	if (!ReadMem(tmp, 1, &value))
-	    return;
+	    return done;
 
 	if ((value & 0x80) && (instr->opCode == OP_LB))
 	    value |= 0xffffff00;
@@ -272,17 +464,17 @@ Machine::OneInstruction(Instruction *instr)
 	    value &= 0xff;
 	nextLoadReg = instr->rt;
 	nextLoadValue = value;
-	break;
+	NEXT;
 	
-      case OP_LH:
-      case OP_LHU:	  
+      OPCASE(OP_LH):
+      OPCASE(OP_LHU):	  
 	tmp = registers[instr->rs] + instr->extra;
 	if (tmp & 0x1) {
 	    RaiseException(AddressErrorException, tmp);
-	    return;
+	    return done;
 	}
 	if (!ReadMem(tmp, 2, &value))
-	    return;
+	    return done;
 
 	if ((value & 0x8000) && (instr->opCode == OP_LH))
 	    value |= 0xffff0000;
@@ -290,26 +482,26 @@ Machine::OneInstruction(Instruction *instr)
 	    value &= 0xffff;
 	nextLoadReg = instr->rt;
 	nextLoadValue = value;
-	break;
+	NEXT;
       	
-      case OP_LUI:
+      OPCASE(OP_LUI):
 	DEBUG(dbgMach, "Executing: LUI r" << instr->rt << ", " << instr->extra);
 	registers[instr->rt] = instr->extra << 16;
-	break;
+	NEXT;
 	
-      case OP_LW:
+      OPCASE(OP_LW):
 	tmp = registers[instr->rs] + instr->extra;
 	if (tmp & 0x3) {
 	    RaiseException(AddressErrorException, tmp);
-	    return;
+	    return done;
 	}
 	if (!ReadMem(tmp, 4, &value))
-	    return;
+	    return done;
 	nextLoadReg = instr->rt;
 	nextLoadValue = value;
-	break;
+	NEXT;
     	
-      case OP_LWL:	  
+      OPCASE(OP_LWL):	  
 	tmp = registers[instr->rs] + instr->extra;
 
 #ifdef SIM_FIX
@@ -324,7 +516,7 @@ Machine::OneInstruction(Instruction *instr)
         // DEBUG('P', "Addr 0x%X\n",tmp-byte);
 
         if (!ReadMem(tmp-byte, 4, &value))
-            return;
+            return done;
 #else
 	// ReadMem assumes all 4 byte requests are aligned on an even 
 	// word boundary.  Also, the little endian/big endian swap code would
@@ -332,7 +524,7 @@ Machine::OneInstruction(Instruction *instr)
 	ASSERT((tmp & 0x3) == 0);  
 
 	if (!ReadMem(tmp, 4, &value))
-	    return;
+	    return done;
 #endif
 
 	if (registers[LoadReg] == instr->rt)
@@ -359,9 +551,9 @@ Machine::OneInstruction(Instruction *instr)
 	    break;
 	}
 	nextLoadReg = instr->rt;
-	break;
+	NEXT;
       	
-      case OP_LWR:
+      OPCASE(OP_LWR):
 	tmp = registers[instr->rs] + instr->extra;
 
 #ifdef SIM_FIX
@@ -376,7 +568,7 @@ Machine::OneInstruction(Instruction *instr)
         // DEBUG('P', "Addr 0x%X\n",tmp-byte);
 
         if (!ReadMem(tmp-byte, 4, &value))
-            return;
+            return done;
 #else
 	// ReadMem assumes all 4 byte requests are aligned on an even 
 	// word boundary.  Also, the little endian/big endian swap code would
@@ -384,7 +576,7 @@ Machine::OneInstruction(Instruction *instr)
 	ASSERT((tmp & 0x3) == 0);  
 
 	if (!ReadMem(tmp, 4, &value))
-	    return;
+	    return done;
 #endif
 
 	if (registers[LoadReg] == instr->rt)
@@ -415,141 +607,141 @@ Machine::OneInstruction(Instruction *instr)
 	    break;
 	}
 	nextLoadReg = instr->rt;
-	break;
+	NEXT;
     	
-      case OP_MFHI:
+      OPCASE(OP_MFHI):
 	registers[instr->rd] = registers[HiReg];
-	break;
+	NEXT;
 	
-      case OP_MFLO:
+      OPCASE(OP_MFLO):
 	registers[instr->rd] = registers[LoReg];
-	break;
+	NEXT;
 	
-      case OP_MTHI:
+      OPCASE(OP_MTHI):
 	registers[HiReg] = registers[instr->rs];
-	break;
+	NEXT;
 	
-      case OP_MTLO:
+      OPCASE(OP_MTLO):
 	registers[LoReg] = registers[instr->rs];
-	break;
+	NEXT;
 	
-      case OP_MULT:
+      OPCASE(OP_MULT):
 	Mult(registers[instr->rs], registers[instr->rt], TRUE,
 	     &registers[HiReg], &registers[LoReg]);
-	break;
+	NEXT;
 	
-      case OP_MULTU:
+      OPCASE(OP_MULTU):
 	Mult(registers[instr->rs], registers[instr->rt], FALSE,
 	     &registers[HiReg], &registers[LoReg]);
-	break;
+	NEXT;
 	
-      case OP_NOR:
+      OPCASE(OP_NOR):
 	registers[instr->rd] = ~(registers[instr->rs] | registers[instr->rt]);
-	break;
+	NEXT;
 	
-      case OP_OR:
+      OPCASE(OP_OR):
 	registers[instr->rd] = registers[instr->rs] | registers[instr->rt];
-	break;
+	NEXT;
 	
-      case OP_ORI:
+      OPCASE(OP_ORI):
 	registers[instr->rt] = registers[instr->rs] | (instr->extra & 0xffff);
-	break;
+	NEXT;
 	
-      case OP_SB:
+      OPCASE(OP_SB):
 	if (!WriteMem((unsigned) 
 		(registers[instr->rs] + instr->extra), 1, registers[instr->rt]))
-	    return;
-	break;
+	    return done;
+	NEXT;
 	
-      case OP_SH:
+      OPCASE(OP_SH):
 	if (!WriteMem((unsigned) 
 		(registers[instr->rs] + instr->extra), 2, registers[instr->rt]))
-	    return;
-	break;
+	    return done;
+	NEXT;
 	
-      case OP_SLL:
+      OPCASE(OP_SLL):
 	registers[instr->rd] = registers[instr->rt] << instr->extra;
-	break;
+	NEXT;
 	
-      case OP_SLLV:
+      OPCASE(OP_SLLV):
 	registers[instr->rd] = registers[instr->rt] <<
 	    (registers[instr->rs] & 0x1f);
-	break;
+	NEXT;
 	
-      case OP_SLT:
+      OPCASE(OP_SLT):
 	if (registers[instr->rs] < registers[instr->rt])
 	    registers[instr->rd] = 1;
 	else
 	    registers[instr->rd] = 0;
-	break;
+	NEXT;
 	
-      case OP_SLTI:
+      OPCASE(OP_SLTI):
 	if (registers[instr->rs] < instr->extra)
 	    registers[instr->rt] = 1;
 	else
 	    registers[instr->rt] = 0;
-	break;
+	NEXT;
 	
-      case OP_SLTIU:	  
+      OPCASE(OP_SLTIU):	  
 	rs = registers[instr->rs];
 	imm = instr->extra;
 	if (rs < imm)
 	    registers[instr->rt] = 1;
 	else
 	    registers[instr->rt] = 0;
-	break;
+	NEXT;
       	
-      case OP_SLTU:	  
+      OPCASE(OP_SLTU):	  
 	rs = registers[instr->rs];
 	rt = registers[instr->rt];
 	if (rs < rt)
 	    registers[instr->rd] = 1;
 	else
 	    registers[instr->rd] = 0;
-	break;
+	NEXT;
       	
-      case OP_SRA:
+      OPCASE(OP_SRA):
 	registers[instr->rd] = registers[instr->rt] >> instr->extra;
-	break;
+	NEXT;
 	
-      case OP_SRAV:
+      OPCASE(OP_SRAV):
 	registers[instr->rd] = registers[instr->rt] >>
 	    (registers[instr->rs] & 0x1f);
-	break;
+	NEXT;
 	
-      case OP_SRL:
+      OPCASE(OP_SRL):
 	tmp = registers[instr->rt];
 	tmp >>= instr->extra;
 	registers[instr->rd] = tmp;
-	break;
+	NEXT;
 	
-      case OP_SRLV:
+      OPCASE(OP_SRLV):
 	tmp = registers[instr->rt];
 	tmp >>= (registers[instr->rs] & 0x1f);
 	registers[instr->rd] = tmp;
-	break;
+	NEXT;
 	
-      case OP_SUB:	  
+      OPCASE(OP_SUB):	  
 	diff = registers[instr->rs] - registers[instr->rt];
 	if (((registers[instr->rs] ^ registers[instr->rt]) & SIGN_BIT) &&
 	    ((registers[instr->rs] ^ diff) & SIGN_BIT)) {
 	    RaiseException(OverflowException, 0);
-	    return;
+	    return done;
 	}
 	registers[instr->rd] = diff;
-	break;
+	NEXT;
       	
-      case OP_SUBU:
+      OPCASE(OP_SUBU):
 	registers[instr->rd] = registers[instr->rs] - registers[instr->rt];
-	break;
+	NEXT;
 	
-      case OP_SW:
+      OPCASE(OP_SW):
 	if (!WriteMem((unsigned) 
 		(registers[instr->rs] + instr->extra), 4, registers[instr->rt]))
-	    return;
-	break;
+	    return done;
+	NEXT;
 	
-      case OP_SWL:	  
+      OPCASE(OP_SWL):	  
 	tmp = registers[instr->rs] + instr->extra;
 
 #ifdef SIM_FIX
@@ -562,7 +754,7 @@ Machine::OneInstruction(Instruction *instr)
         byte = tmp & 0x3;
         // DEBUG('P', "Addr 0x%X\n",tmp-byte);
         if (!ReadMem(tmp-byte, 4, &value))
-            return;
+            return done;
 
         // DEBUG('P', "Value 0x%X\n",value);
 #else
@@ -572,7 +764,7 @@ Machine::OneInstruction(Instruction *instr)
 	ASSERT((tmp & 0x3) == 0);  
 
 	if (!ReadMem((tmp & ~0x3), 4, &value))
-	    return;
+	    return done;
 #endif
 
 #ifdef SIM_FIX
@@ -599,16 +791,16 @@ Machine::OneInstruction(Instruction *instr)
 	}
 #ifndef SIM_FIX
         if (!WriteMem((tmp & ~0x3), 4, value))
-            return;
+            return done;
 #else
         // DEBUG('P', "Value 0x%X\n",value);
 
         if (!WriteMem((tmp - byte), 4, value))
-            return;
+            return done;
 #endif // SIM_FIX
-	break;
+	NEXT;
     	
-      case OP_SWR:	  
+      OPCASE(OP_SWR):	  
 	tmp = registers[instr->rs] + instr->extra;
 
 #ifndef SIM_FIX
@@ -617,7 +809,7 @@ Machine::OneInstruction(Instruction *instr)
         ASSERT((tmp & 0x3) == 0);  
 
         if (!ReadMem((tmp & ~0x3), 4, &value))
-            return;
+            return done;
 #else
         // The only difference between this code and the BIG ENDIAN code
         // is that the ReadMem call is guaranteed an aligned access as 
@@ -630,7 +822,7 @@ Machine::OneInstruction(Instruction *instr)
         // DEBUG('P', "Addr 0x%X\n",tmp-byte);
 
         if (!ReadMem(tmp-byte, 4, &value))
-            return;
+            return done;
         // DEBUG('P', "Value 0x%X\n",value);
 #endif // SIM_FIX
 
@@ -656,48 +848,41 @@ Machine::OneInstruction(Instruction *instr)
 
 #ifndef SIM_FIX
         if (!WriteMem((tmp & ~0x3), 4, value))
-            return;
+            return done;
 #else
         // DEBUG('P', "Value 0x%X\n",value);
 
         if (!WriteMem((tmp - byte), 4, value))
-            return;
+            return done;
 #endif // SIM_FIX
 
 
-	break;
+	NEXT;
     	
-      case OP_SYSCALL:
+      OPCASE(OP_SYSCALL):
 	RaiseException(SyscallException, 0);
-	return; 
+	return done;
 	
-      case OP_XOR:
+      OPCASE(OP_XOR):
 	registers[instr->rd] = registers[instr->rs] ^ registers[instr->rt];
-	break;
+	NEXT;
 	
-      case OP_XORI:
+      OPCASE(OP_XORI):
 	registers[instr->rt] = registers[instr->rs] ^ (instr->extra & 0xffff);
-	break;
+	NEXT;
 	
-      case OP_RES:
-      case OP_UNIMP:
+      OPCASE(OP_RES):
+      OPCASE(OP_UNIMP):
 	RaiseException(IllegalInstrException, 0);
-	return;
+	return done;
 	
       default:
 	ASSERT(FALSE);
     }
     
     // Now we have successfully executed the instruction.
-    
-    // Do any delayed load operation
-    DelayedLoad(nextLoadReg, nextLoadValue);
-    
-    // Advance program counters.
-    registers[PrevPCReg] = registers[PCReg];	// for debugging, in case we
-						// are jumping into lala-land
-    registers[PCReg] = registers[NextPCReg];
-    registers[NextPCReg] = pcAfter;
+    FINISH_INSTRUCTION;
+    goto dispatch;
 }
 
 //----------------------------------------------------------------------
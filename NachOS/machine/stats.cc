@@ -19,9 +19,15 @@
 Statistics::Statistics()
 {
     totalTicks = idleTicks = systemTicks = userTicks = 0;
-    numDiskReads = numDiskWrites = 0;
+    numDiskReads = numDiskWrites = numDiskSeekTicks = 0;
+    numCacheHits = numCacheMisses = 0;
+    numCacheEvictions = numCacheWriteBacks = numCacheReadAheads = 0;
     numConsoleCharsRead = numConsoleCharsWritten = 0;
     numPageFaults = numPacketsSent = numPacketsRecvd = 0;
+    numTLBHits = numTLBMisses = 0;
+    numDecodeHits = numDecodeMisses = 0;
+    numBlocksRun = numBlocksBuilt = 0;
+    startTime = WallClock();
 }
 
 //----------------------------------------------------------------------
@@ -36,10 +42,27 @@ Statistics::Print()
     cout << "Ticks: total " << totalTicks << ", idle " << idleTicks;
 		cout << ", system " << systemTicks << ", user " << userTicks <<"\n";
     cout << "Disk I/O: reads " << numDiskReads;
-		cout << ", writes " << numDiskWrites << "\n";
+		cout << ", writes " << numDiskWrites;
+		cout << ", seek ticks " << numDiskSeekTicks << "\n";
+    cout << "Buffer cache: hits " << numCacheHits;
+		cout << ", misses " << numCacheMisses;
+		cout << ", evictions " << numCacheEvictions;
+		cout << ", write-backs " << numCacheWriteBacks;
+		cout << ", read-ahead " << numCacheReadAheads << "\n";
 		cout << "Console I/O: reads " << numConsoleCharsRead;
     cout << ", writes " << numConsoleCharsWritten << "\n";
     cout << "Paging: faults " << numPageFaults << "\n";
+    cout << "TLB: hits " << numTLBHits;
+		cout << ", misses " << numTLBMisses << "\n";
     cout << "Network I/O: packets received " << numPacketsRecvd;
 		cout << ", sent " << numPacketsSent << "\n";
+    cout << "Decoded instructions: hits " << numDecodeHits;
+		cout << ", misses " << numDecodeMisses << "\n";
+    cout << "Basic blocks: run " << numBlocksRun;
+		cout << ", built " << numBlocksBuilt << "\n";
+    cout << "Host time: " << (int)((WallClock() - startTime) * 1000);
+		cout << " ms, user instructions/second ";
+		cout << (int)(userTicks / max(WallClock() - startTime, 1e-6));
+		cout << ", host ns/instruction ";
+		cout << (WallClock() - startTime) * 1e9 / max(userTicks, 1) << "\n";
 }
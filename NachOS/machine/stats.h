@@ -30,11 +30,24 @@ class Statistics {
 
     int numDiskReads;		// number of disk read requests
     int numDiskWrites;		// number of disk write requests
+    int numDiskSeekTicks;	// time the disk head spent seeking
+    int numCacheHits;		// sector requests found in the buffer cache
+    int numCacheMisses;		// sector requests that had to go to disk
+    int numCacheEvictions;	// sectors replaced in the buffer cache
+    int numCacheWriteBacks;	// dirty sectors written back to disk
+    int numCacheReadAheads;	// sectors read into the cache ahead of use
     int numConsoleCharsRead;	// number of characters read from the keyboard
     int numConsoleCharsWritten; // number of characters written to the display
     int numPageFaults;		// number of virtual memory page faults
+    int numTLBHits;		// translations found in the TLB
+    int numTLBMisses;		// translations the kernel had to load
     int numPacketsSent;		// number of packets sent over the network
     int numPacketsRecvd;	// number of packets received over the network
+    int numDecodeHits;		// instructions found already decoded
+    int numDecodeMisses;	// instructions fetched and decoded
+    int numBlocksRun;		// basic blocks run in one go
+    int numBlocksBuilt;		// basic blocks found and decoded
+    double startTime;		// host time at startup, in seconds
 
     Statistics(); 		// initialize everything to zero
 
@@ -32,47 +32,12 @@
 #include "copyright.h"
 #include "main.h"
 
-// Routines for converting Words and Short Words to and from the
-// simulated machine's format of little endian.  These end up
-// being NOPs when the host machine is also little endian (DEC and Intel).
-
-unsigned int
-WordToHost(unsigned int word) {
-#ifdef HOST_IS_BIG_ENDIAN
-	 register unsigned long result;
-	 result = (word >> 24) & 0x000000ff;
-	 result |= (word >> 8) & 0x0000ff00;
-	 result |= (word << 8) & 0x00ff0000;
-	 result |= (word << 24) & 0xff000000;
-	 return result;
-#else 
-	 return word;
-#endif /* HOST_IS_BIG_ENDIAN */
-}
-
-unsigned short
-ShortToHost(unsigned short shortword) {
-#ifdef HOST_IS_BIG_ENDIAN
-	 register unsigned short result;
-	 result = (shortword << 8) & 0xff00;
-	 result |= (shortword >> 8) & 0x00ff;
-	 return result;
-#else 
-	 return shortword;
-#endif /* HOST_IS_BIG_ENDIAN */
-}
-
-unsigned int
-WordToMachine(unsigned int word) { return WordToHost(word); }
-
-unsigned short
-ShortToMachine(unsigned short shortword) { return ShortToHost(shortword); }
-
-
 //----------------------------------------------------------------------
-// Machine::ReadMem
+// Machine::SlowReadMem
 //      Read "size" (1, 2, or 4) bytes of virtual memory at "addr" into 
-//	the location pointed to by "value".
+//	the location pointed to by "value".  This is ReadMem when the
+//	page's translation isn't cached; once it has been checked, it is
+//	cached, so the next read can skip all this.
 //
 //   	Returns FALSE if the translation step from virtual to physical memory
 //   	failed.
@@ -83,11 +48,12 @@ ShortToMachine(unsigned short shortword) { return ShortToHost(shortword); }
 //----------------------------------------------------------------------
 
 bool
-Machine::ReadMem(int addr, int size, int *value)
+Machine::SlowReadMem(int addr, int size, int *value)
 {
     int data;
     ExceptionType exception;
     int physicalAddress;
+    FastTranslation *fast;
     
     DEBUG(dbgAddr, "Reading VA " << addr << ", size " << size);
     
@@ -96,6 +62,13 @@ Machine::ReadMem(int addr, int size, int *value)
 	RaiseException(exception, addr);
 	return FALSE;
     }
+    if (fastTranslate && !debug->IsEnabled(dbgAddr)) {
+	fast = &fastTLB[((unsigned) addr / PageSize) % FastTranslations];
+	if (fast->virtualPage != (int) ((unsigned) addr / PageSize))
+	    fast->writable = FALSE;	// stores still need checking
+	fast->virtualPage = (unsigned) addr / PageSize;
+	fast->frame = &mainMemory[physicalAddress - (unsigned) addr % PageSize];
+    }
     switch (size) {
       case 1:
 	data = mainMemory[physicalAddress];
@@ -120,9 +93,11 @@ Machine::ReadMem(int addr, int size, int *value)
 }
 
 //----------------------------------------------------------------------
-// Machine::WriteMem
+// Machine::SlowWriteMem
 //      Write "size" (1, 2, or 4) bytes of the contents of "value" into
-//	virtual memory at location "addr".
+//	virtual memory at location "addr".  This is WriteMem when the
+//	page's translation isn't cached for stores; Translate has marked
+//	the page dirty, so later stores can skip all this.
 //
 //   	Returns FALSE if the translation step from virtual to physical memory
 //   	failed.
@@ -133,10 +108,11 @@ Machine::ReadMem(int addr, int size, int *value)
 //----------------------------------------------------------------------
 
 bool
-Machine::WriteMem(int addr, int size, int value)
+Machine::SlowWriteMem(int addr, int size, int value)
 {
     ExceptionType exception;
     int physicalAddress;
+    FastTranslation *fast;
      
     DEBUG(dbgAddr, "Writing VA " << addr << ", size " << size << ", value " << value);
 
@@ -145,6 +121,13 @@ Machine::WriteMem(int addr, int size, int value)
 	RaiseException(exception, addr);
 	return FALSE;
     }
+    if (fastTranslate && !debug->IsEnabled(dbgAddr)) {
+	fast = &fastTLB[((unsigned) addr / PageSize) % FastTranslations];
+	fast->virtualPage = (unsigned) addr / PageSize;
+	fast->frame = &mainMemory[physicalAddress - (unsigned) addr % PageSize];
+	fast->writable = TRUE;
+    }
+    Overwritten(physicalAddress);	// the word may have been an instruction
     switch (size) {
       case 1:
 	mainMemory[physicalAddress] = (unsigned char) (value & 0xff);
@@ -166,6 +149,106 @@ Machine::WriteMem(int addr, int size, int value)
     return TRUE;
 }
 
+//----------------------------------------------------------------------
+// Machine::FlushTranslations
+// 	Forget every translation cached for ReadMem and WriteMem.
+//
+//	A cached page skips Translate, including its use and dirty bits;
+//	that is only safe while the entry it was checked against is left
+//	alone.  So the kernel must call this after switching page tables
+//	(AddrSpace::RestoreState does), and after changing any entry in
+//	the page table or TLB -- including clearing use or dirty bits.
+//	Every return from an exception flushes too, since the handler may
+//	have done any of these.
+//----------------------------------------------------------------------
+
+void
+Machine::FlushTranslations()
+{
+    for (int i = 0; i < FastTranslations; i++)
+	fastTLB[i].virtualPage = -1;
+}
+
+//----------------------------------------------------------------------
+// Machine::UseTLB
+// 	Switch the machine from a linear page table to a software-loaded
+//	TLB, empty to begin with, so that the kernel must load every
+//	translation the user program uses, on a PageFaultException.
+//
+//	Neither shortcut the simulator takes past Translate is taken then,
+//	so every fetch, load and store is a TLB hit or miss, as on the
+//	real thing: the translations ReadMem and WriteMem cache, and whole
+//	basic blocks, which are translated once.
+//
+//	"entries" -- the number of TLB entries
+//	"ways" -- the number of entries in each set; "entries" for a
+//		fully associative TLB.  It must be at least 2: a load or
+//		store needs its own page and the page of the instruction
+//		at once, and if both went to the one entry, each would
+//		keep replacing the other and the instruction never finish.
+//	"policy" -- which entry of a full set to replace
+//----------------------------------------------------------------------
+
+void
+Machine::UseTLB(int entries, int ways, TLBPolicy policy)
+{
+    ASSERT(ways >= 2 && entries % ways == 0);
+    delete [] tlb;
+    delete [] tlbAsid;
+    delete [] tlbStamp;
+    tlb = new TranslationEntry[entries];
+    tlbAsid = new int[entries];
+    tlbStamp = new unsigned int[entries];
+    for (int i = 0; i < entries; i++) {
+	tlb[i].valid = FALSE;
+	tlbAsid[i] = -1;
+	tlbStamp[i] = 0;
+    }
+    tlbEntries = entries;
+    tlbWays = ways;
+    tlbPolicy = policy;
+    pageTable = NULL;
+
+    fastTranslate = FALSE;
+    FlushTranslations();
+    delete [] blockLength;
+    delete [] pageBlocks;
+    blockLength = NULL;
+    pageBlocks = NULL;
+}
+
+//----------------------------------------------------------------------
+// Machine::TLBVictim
+// 	Choose the TLB entry that a translation of virtual page "vpn" in
+//	the current address space should be loaded into: a free entry in
+//	the page's set, if there is one, or else the one the replacement
+//	policy picks.  The kernel is expected to save what it needs of
+//	the old contents, then load the entry and tag it with "asid".
+//----------------------------------------------------------------------
+
+int
+Machine::TLBVictim(int vpn)
+{
+    int first = (vpn % (tlbEntries / tlbWays)) * tlbWays;
+    int victim = -1;
+    int i;
+
+    for (i = first; i < first + tlbWays && victim < 0; i++)
+	if (!tlb[i].valid)
+	    victim = i;
+    if (victim < 0 && tlbPolicy == TLBRandom)
+	victim = first + RandomNumber() % tlbWays;
+    else if (victim < 0) {		// FIFO or LRU: the oldest stamp
+	victim = first;
+	for (i = first + 1; i < first + tlbWays; i++)
+	    if (tlbStamp[i] < tlbStamp[victim])
+		victim = i;
+    }
+    tlbStamp[victim] = ++tlbClock;	// loaded (and so used) now
+    DEBUG(dbgAddr, "TLB entry " << victim << " for virtual page " << vpn);
+    return victim;
+}
+
 //----------------------------------------------------------------------
 // Machine::Translate
 // 	Translate a virtual address into a physical address, using 
@@ -214,18 +297,25 @@ Machine::Translate(int virtAddr, int* physAddr, int size, bool writing)
 	    return PageFaultException;
 	}
 	entry = &pageTable[vpn];
-    } else {
-        for (entry = NULL, i = 0; i < TLBSize; i++)
-    	    if (tlb[i].valid && (tlb[i].virtualPage == ((int)vpn))) {
+    } else {			// => TLB => search vpn's set
+	int first = (vpn % (tlbEntries / tlbWays)) * tlbWays;
+
+        for (entry = NULL, i = first; i < first + tlbWays; i++)
+    	    if (tlb[i].valid && (tlb[i].virtualPage == ((int)vpn))
+			&& tlbAsid[i] == asid) {
 		entry = &tlb[i];			// FOUND!
+		if (tlbPolicy == TLBLRU)
+		    tlbStamp[i] = ++tlbClock;
 		break;
 	    }
 	if (entry == NULL) {				// not found
+	    kernel->stats->numTLBMisses++;
     	    DEBUG(dbgAddr, "Invalid TLB entry for this virtual page!");
     	    return PageFaultException;		// really, this is a TLB fault,
 						// the page may be in memory,
 						// but not in the TLB
 	}
+	kernel->stats->numTLBHits++;
     }
 
     if (entry->readOnly && writing) {	// trying to write to a read-only page
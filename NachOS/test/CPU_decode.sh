@@ -0,0 +1,13 @@
+make sort matmult
+../build.linux/nachos -f
+../build.linux/nachos -cp sort /sort
+../build.linux/nachos -cp matmult /matmult
+../build.linux/nachos -d S -e /sort
+../build.linux/nachos -d S -nb -e /sort
+../build.linux/nachos -d S -nd -e /sort
+../build.linux/nachos -d S -nt -e /sort
+echo "========================================="
+../build.linux/nachos -d S -e /matmult
+../build.linux/nachos -d S -nb -e /matmult
+../build.linux/nachos -d S -nd -e /matmult
+../build.linux/nachos -d S -nt -e /matmult
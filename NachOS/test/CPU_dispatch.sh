@@ -0,0 +1,29 @@
+make sort matmult
+# build each variant in a scratch directory next to build.linux, so the
+# tree's own nachos (unoptimized, switch dispatch) is left as it was
+for variant in switch threaded
+do
+	rm -rf ../build.$variant
+	mkdir ../build.$variant
+	cp ../build.linux/Makefile ../build.linux/Makefile.dep ../build.$variant
+done
+make -C ../build.switch OPTFLAGS=-O2 DEFINES="-DRDATA -DSIM_FIX"
+make -C ../build.threaded OPTFLAGS=-O2 DEFINES="-DRDATA -DSIM_FIX -DTHREADED_DISPATCH"
+../build.switch/nachos -f
+../build.switch/nachos -cp sort /sort
+../build.switch/nachos -cp matmult /matmult
+for program in /sort /matmult
+do
+	for variant in switch threaded
+	do
+		echo "========================================="
+		echo "$variant $program"
+		if which perf > /dev/null 2>&1
+		then
+			perf stat -e instructions,branches,branch-misses ../build.$variant/nachos -d S -e $program
+		else
+			../build.$variant/nachos -d S -e $program
+		fi
+	done
+done
+rm -rf ../build.switch ../build.threaded
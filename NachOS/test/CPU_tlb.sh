@@ -0,0 +1,17 @@
+make sort matmult
+../build.linux/nachos -f
+../build.linux/nachos -cp sort /sort
+../build.linux/nachos -cp matmult /matmult
+for program in /sort /matmult
+do
+	for policy in fifo lru random
+	do
+		for tlb in "4 2" "4 4" "8 2" "8 8" "16 4" "32 32"
+		do
+			set -- $tlb
+			echo "========================================="
+			echo "$program: $1 entries, $2-way, $policy"
+			../build.linux/nachos -d S -tlb $1 -tw $2 -tp $policy -e $program | grep "TLB\|Ticks"
+		done
+	done
+done
@@ -0,0 +1,13 @@
+../build.linux/nachos -f
+../build.linux/nachos -mkdir /t0
+../build.linux/nachos -cp num_100.txt /t0/f1
+echo "========================================="
+../build.linux/nachos -jc 1 -cp num_1000.txt /t0/f2
+../build.linux/nachos -lr /
+echo "========================================="
+../build.linux/nachos -jc 2 -cp num_1000.txt /t0/f3
+../build.linux/nachos -lr /
+echo "========================================="
+../build.linux/nachos -jc 1 -rr /t0
+../build.linux/nachos -lr /
+../build.linux/nachos -p /t0/f1
@@ -0,0 +1,5 @@
+../build.linux/nachos -f
+../build.linux/nachos -LB
+echo "========================================="
+../build.linux/nachos -rs 7 -LB
+../build.linux/nachos -l /
@@ -0,0 +1,14 @@
+../build.linux/nachos -f
+../build.linux/nachos -mkdir /t0
+../build.linux/nachos -mt /t0/tree 3 3
+../build.linux/nachos -cp num_100.txt /t0/tree/d1/f9
+../build.linux/nachos -lr /
+echo "========================================="
+../build.linux/nachos -rr /t0/tree/d1/d2
+../build.linux/nachos -lr /t0/tree/d1
+echo "========================================="
+../build.linux/nachos -rr /t0/tree
+../build.linux/nachos -lr /
+echo "========================================="
+../build.linux/nachos -mt /t0/tree 3 3
+../build.linux/nachos -l /t0/tree
@@ -15,6 +15,9 @@
 #include "libtest.h"
 #include "string.h"
 #include "synchdisk.h"
+#ifndef FILESYS_STUB
+#include "journal.h"
+#endif
 #include "post.h"
 #include "synchconsole.h"
 
@@ -28,10 +31,20 @@ Kernel::Kernel(int argc, char **argv)
 {
     randomSlice = FALSE;
     debugUserProg = FALSE;
+    decodeCache = TRUE;
+    runBlocks = TRUE;
+    fastTranslate = TRUE;
+    tlbEntries = 0;
+    tlbWays = 0;
+    tlbPolicy = TLBFIFO;
     consoleIn = NULL;  // default is stdin
     consoleOut = NULL; // default is stdout
+    cacheSectors = DefaultCacheSectors;
+    diskPolicy = DiskCLOOK;
+    mapDisk = FALSE;
 #ifndef FILESYS_STUB
     formatFlag = FALSE;
+    journalCrash = 0;
 #endif
     reliability = 1; // network reliability, default is 1.0
     hostName = 0;    // machine id, also UNIX socket name
@@ -75,8 +88,76 @@ Kernel::Kernel(int argc, char **argv)
         else if (strcmp(argv[i], "-f") == 0)
         {
             formatFlag = TRUE;
+        }
+        else if (strcmp(argv[i], "-jc") == 0)
+        {
+            ASSERT(i + 1 < argc); // next argument is int
+            journalCrash = atoi(argv[i + 1]);
+            i++;
 #endif
         }
+        else if (strcmp(argv[i], "-cs") == 0)
+        {
+            ASSERT(i + 1 < argc); // next argument is int
+            cacheSectors = atoi(argv[i + 1]);
+            i++;
+        }
+        else if (strcmp(argv[i], "-ds") == 0)
+        {
+            ASSERT(i + 1 < argc); // next argument is a policy name
+            if (strcmp(argv[i + 1], "fcfs") == 0)
+                diskPolicy = DiskFCFS;
+            else if (strcmp(argv[i + 1], "sstf") == 0)
+                diskPolicy = DiskSSTF;
+            else if (strcmp(argv[i + 1], "scan") == 0)
+                diskPolicy = DiskSCAN;
+            else if (strcmp(argv[i + 1], "clook") == 0)
+                diskPolicy = DiskCLOOK;
+            else
+                cout << "Unknown disk policy " << argv[i + 1] << "\n";
+            i++;
+        }
+        else if (strcmp(argv[i], "-mmap") == 0)
+        {
+            mapDisk = TRUE;
+        }
+        else if (strcmp(argv[i], "-nd") == 0)
+        {
+            decodeCache = FALSE;
+        }
+        else if (strcmp(argv[i], "-nb") == 0)
+        {
+            runBlocks = FALSE;
+        }
+        else if (strcmp(argv[i], "-nt") == 0)
+        {
+            fastTranslate = FALSE;
+        }
+        else if (strcmp(argv[i], "-tlb") == 0)
+        {
+            ASSERT(i + 1 < argc); // next argument is int
+            tlbEntries = atoi(argv[i + 1]);
+            i++;
+        }
+        else if (strcmp(argv[i], "-tw") == 0)
+        {
+            ASSERT(i + 1 < argc); // next argument is int
+            tlbWays = atoi(argv[i + 1]);
+            i++;
+        }
+        else if (strcmp(argv[i], "-tp") == 0)
+        {
+            ASSERT(i + 1 < argc);
+            if (strcmp(argv[i + 1], "fifo") == 0)
+                tlbPolicy = TLBFIFO;
+            else if (strcmp(argv[i + 1], "lru") == 0)
+                tlbPolicy = TLBLRU;
+            else if (strcmp(argv[i + 1], "random") == 0)
+                tlbPolicy = TLBRandom;
+            else
+                cout << "Unknown TLB policy " << argv[i + 1] << "\n";
+            i++;
+        }
         else if (strcmp(argv[i], "-n") == 0)
         {
             ASSERT(i + 1 < argc); // next argument is float
@@ -96,8 +177,14 @@ Kernel::Kernel(int argc, char **argv)
             cout << "Partial usage: nachos [-ci consoleIn] [-co consoleOut]\n";
 #ifndef FILESYS_STUB
             cout << "Partial usage: nachos [-nf]\n";
+            cout << "Partial usage: nachos [-jc #]\n";
 #endif
             cout << "Partial usage: nachos [-n #] [-m #]\n";
+            cout << "Partial usage: nachos [-cs #]\n";
+            cout << "Partial usage: nachos [-ds fcfs|sstf|scan|clook]\n";
+            cout << "Partial usage: nachos [-mmap]\n";
+            cout << "Partial usage: nachos [-nd] [-nb] [-nt]\n";
+            cout << "Partial usage: nachos [-tlb #] [-tw #] [-tp fifo|lru|random]\n";
         }
     }
 }
@@ -122,16 +209,20 @@ void Kernel::Initialize()
     interrupt = new Interrupt;      // start up interrupt handling
     scheduler = new Scheduler();    // initialize the ready queue
     alarm = new Alarm(randomSlice); // start up time slicing
-    machine = new Machine(debugUserProg);
+    machine = new Machine(debugUserProg, decodeCache, runBlocks,
+                          fastTranslate);
+    if (tlbEntries > 0)
+        machine->UseTLB(tlbEntries, tlbWays > 0 ? tlbWays : tlbEntries,
+                        (TLBPolicy)tlbPolicy);
     synchConsoleIn = new SynchConsoleInput(consoleIn);    // input from stdin
     synchConsoleOut = new SynchConsoleOutput(consoleOut); // output to stdout
 
-    synchDisk = new SynchDisk();   
-                       //
+    synchDisk = new SynchDisk(cacheSectors, (DiskPolicy)diskPolicy, mapDisk);
 #ifdef FILESYS_STUB
     fileSystem = new FileSystem();
 #else
     fileSystem = new FileSystem(formatFlag);
+    fileSystem->GetJournal()->CrashAfter(journalCrash);
 #endif // FILESYS_STUB
 
     // MP4 mod tag
@@ -361,35 +452,51 @@ int Kernel::CreateFile(char *filename, int size)
     return fileSystem->Create(filename, size);
 }
 
+// Files are opened into the descriptor table of the running program's
+// address space, and the id returned is the descriptor.  Opening a file
+// that is open already (by any program) shares its in-core inode, so
+// the header is not read again.
 int Kernel::Open(char *filename)
 {
-    OPENFILE = fileSystem->Open(filename);
-    if (OPENFILE != NULL)
-        return (int)&OPENFILE;
-    else
+    OpenFile *file = fileSystem->Open(filename);
+    if (file == NULL)
         return -1;
+    int id = currentThread->space->AddFile(file);
+    if (id == -1)
+        delete file; // too many open files
+    return id;
 }
-int Kernel::WriteFile(char *buffer, int size, int ID)
+int Kernel::WriteFile(int buffer, int size, int ID)
 {
-    if (ID == (int)&OPENFILE)
-        return OPENFILE->Write(buffer, size);
+    OpenFile *file = currentThread->space->GetFile(ID);
+    if (file != NULL)
+        return currentThread->space->WriteFile(file, buffer, size);
     else
         return -1;
 }
-int Kernel::ReadFile(char *buffer, int size, int ID)
+int Kernel::ReadFile(int buffer, int size, int ID)
 {
-    if (ID == (int)&OPENFILE)
-        return OPENFILE->Read(buffer, size);
+    OpenFile *file = currentThread->space->GetFile(ID);
+    if (file != NULL)
+        return currentThread->space->ReadFile(file, buffer, size);
     else
         return -1;
 }
-int Kernel::CloseFile(int ID)
+int Kernel::SeekFile(int position, int ID)
 {
-    if (ID == (int)&OPENFILE)
+    OpenFile *file = currentThread->space->GetFile(ID);
+    if (file != NULL && position >= 0)
     {
-        delete OPENFILE;
+        file->Seek(position);
         return 1;
     }
+    else
+        return -1;
+}
+int Kernel::CloseFile(int ID)
+{
+    if (currentThread->space->CloseFile(ID))
+        return 1;
     else
         return 0;
 }
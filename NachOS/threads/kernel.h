@@ -52,8 +52,9 @@ public:
 #endif
     int CreateFile(char *, int);
     int Open(char *);
-    int WriteFile(char *, int, int);
-    int ReadFile(char *, int, int);
+    int WriteFile(int, int, int); // buffers are user virtual addresses
+    int ReadFile(int, int, int);
+    int SeekFile(int, int);
     int CloseFile(int);
 
     // These are public for notational convenience; really,
@@ -71,7 +72,6 @@ public:
     FileSystem *fileSystem;
     PostOfficeInput *postOfficeIn;
     PostOfficeOutput *postOfficeOut;
-    OpenFile *OPENFILE;
     int hostName; // machine identifier
 
 private:
@@ -81,11 +81,21 @@ private:
     int threadNum;
     bool randomSlice;   // enable pseudo-random time slicing
     bool debugUserProg; // single step user program
+    bool decodeCache;   // keep user instructions decoded
+    bool runBlocks;     // run user code a basic block at a time
+    bool fastTranslate; // cache translations of user loads and stores
+    int tlbEntries;     // size of the TLB, or 0 to use page tables
+    int tlbWays;        // TLB entries per set, or 0 for all of them
+    int tlbPolicy;      // TLB replacement policy (a TLBPolicy)
     double reliability; // likelihood messages are dropped
     char *consoleIn;    // file to read console input from
     char *consoleOut;   // file to send console output to
+    int cacheSectors;   // size of the disk buffer cache, in sectors
+    int diskPolicy;     // disk scheduling policy (a DiskPolicy)
+    bool mapDisk;       // access the disk image through mmap
 #ifndef FILESYS_STUB
     bool formatFlag; // format the disk if this is true
+    int journalCrash; // journal group to crash in, or 0
 #endif
 };
 
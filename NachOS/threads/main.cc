@@ -7,7 +7,10 @@
 //              -f -cp <unix file> <nachos file>
 //              -p <nachos file> -r <nachos file> -l -D
 //              -n <network reliability> -m <machine id>
-//              -z -K -C -N
+//              -z -K -C -N -DB -cs <cache sectors> -ds <disk policy>
+//              -mmap -BB -jc <journal group> -nd -nb -nt
+//              -tlb <entries> -tw <ways> -tp <TLB policy>
+//              -mt <nachos dir> <depth> <fanout> -LB
 //
 //    -d causes certain debugging messages to be printed (see debug.h)
 //    -rs causes Yield to occur at random (but repeatable) spots
@@ -21,6 +24,22 @@
 //    -K run a simple self test of kernel threads and synchronization
 //    -C run an interactive console test
 //    -N run a two-machine network test (see Kernel::NetworkTest)
+//    -DB run a benchmark of the disk scheduling policies
+//    -BB run a benchmark of free sector allocation from the bitmap
+//    -cs sets the number of sectors in the disk buffer cache (0 disables it)
+//    -ds sets the disk scheduling policy: fcfs, sstf, scan or clook
+//    -mmap accesses the disk's UNIX file through a memory mapping
+//    -nd decodes every user instruction as it is fetched, instead of
+//        keeping the decoded instructions (for comparison)
+//    -nb runs user programs an instruction at a time, instead of a
+//        basic block at a time (for comparison)
+//    -nt translates every user load and store through the page table,
+//        instead of caching recent translations (for comparison)
+//    -tlb translates user addresses through a software-loaded TLB of
+//        this many entries, instead of the page table
+//    -tw sets the TLB's associativity: entries per set, at least 2
+//        (default: all of them)
+//    -tp sets the TLB replacement policy: fifo, lru or random
 //
 //    Filesystem-related flags:
 //    -f forces the Nachos disk to be formatted
@@ -29,6 +48,12 @@
 //    -r removes a Nachos file from the file system
 //    -l lists the contents of the Nachos directory
 //    -D prints the contents of the entire file system
+//    -mt makes a test tree: a directory with <fanout> files and, for
+//        <depth> levels, <fanout> subdirectories in every directory
+//    -jc crashes Nachos halfway through writing the given journal
+//        group (counting from 1), to test recovery
+//    -LB runs a benchmark of concurrent file reads and writes, under
+//        the per-file locks and under one global lock
 //
 //  Note: the file system flags are not used if the stub filesystem
 //        is being used
@@ -44,6 +69,8 @@
 #include "main.h"
 #include "filesys.h"
 #include "openfile.h"
+#include "synchdisk.h"
+#include "bitmap.h"
 #include "sysdep.h"
 
 // global variables
@@ -65,9 +92,10 @@ Cleanup(int x)
 //-------------------------------------------------------------------
 // Constant used by "Copy" and "Print"
 //   It is the number of bytes read from the Unix file (for Copy)
-//   or the Nachos file (for Print) by each read operation
+//   or the Nachos file (for Print) by each read operation.  Large
+//   chunks let each one go to the disk as a few multi-sector requests.
 //-------------------------------------------------------------------
-static const int TransferSize = 128;
+static const int TransferSize = 4096;
 
 #ifndef FILESYS_STUB
 //----------------------------------------------------------------------
@@ -182,6 +210,8 @@ int main(int argc, char **argv)
     bool threadTestFlag = false;
     bool consoleTestFlag = false;
     bool networkTestFlag = false;
+    bool diskBenchmarkFlag = false;
+    bool bitmapBenchmarkFlag = false;
 #ifndef FILESYS_STUB
     char *copyUnixFileName = NULL;   // UNIX file to be copied into Nachos
     char *copyNachosFileName = NULL; // name of copied file in Nachos
@@ -195,6 +225,9 @@ int main(int argc, char **argv)
     bool mkdirFlag = false;
     bool recursiveListFlag = false;
     bool recursiveRemoveFlag = false;
+    char *treeName = NULL; // test tree to create
+    int treeDepth = 0, treeFanout = 0;
+    bool lockBenchmarkFlag = false;
 #endif //FILESYS_STUB
 
     // some command line arguments are handled here.
@@ -230,6 +263,14 @@ int main(int argc, char **argv)
         {
             networkTestFlag = TRUE;
         }
+        else if (strcmp(argv[i], "-DB") == 0)
+        {
+            diskBenchmarkFlag = TRUE;
+        }
+        else if (strcmp(argv[i], "-BB") == 0)
+        {
+            bitmapBenchmarkFlag = TRUE;
+        }
 #ifndef FILESYS_STUB
         else if (strcmp(argv[i], "-cp") == 0)
         {
@@ -284,6 +325,18 @@ int main(int argc, char **argv)
             mkdirFlag = true;
             i++;
         }
+        else if (strcmp(argv[i], "-mt") == 0)
+        {
+            ASSERT(i + 3 < argc);
+            treeName = argv[i + 1];
+            treeDepth = atoi(argv[i + 2]);
+            treeFanout = atoi(argv[i + 3]);
+            i += 3;
+        }
+        else if (strcmp(argv[i], "-LB") == 0)
+        {
+            lockBenchmarkFlag = true;
+        }
         else if (strcmp(argv[i], "-D") == 0)
         {
             dumpFlag = true;
@@ -293,11 +346,13 @@ int main(int argc, char **argv)
         {
             cout << "Partial usage: nachos [-z -d debugFlags]\n";
             cout << "Partial usage: nachos [-x programName]\n";
-            cout << "Partial usage: nachos [-K] [-C] [-N]\n";
+            cout << "Partial usage: nachos [-K] [-C] [-N] [-DB] [-BB]\n";
 #ifndef FILESYS_STUB
             cout << "Partial usage: nachos [-cp UnixFile NachosFile]\n";
             cout << "Partial usage: nachos [-p fileName] [-r fileName]\n";
             cout << "Partial usage: nachos [-l] [-D]\n";
+            cout << "Partial usage: nachos [-mt dirName depth fanout]\n";
+            cout << "Partial usage: nachos [-LB]\n";
 #endif //FILESYS_STUB
         }
     }
@@ -324,6 +379,14 @@ int main(int argc, char **argv)
     {
         kernel->NetworkTest(); // two-machine test of the network
     }
+    if (diskBenchmarkFlag)
+    {
+        kernel->synchDisk->Benchmark(); // compare disk scheduling policies
+    }
+    if (bitmapBenchmarkFlag)
+    {
+        Bitmap::Benchmark(NumSectors); // time free sector allocation
+    }
 
 #ifndef FILESYS_STUB
     if (recursiveRemoveFlag)
@@ -358,12 +421,25 @@ int main(int argc, char **argv)
         // MP4 mod tag
         CreateDirectory(createDirectoryName);
     }
+    if (treeName != NULL)
+    {
+        if (!kernel->fileSystem->CreateTree(treeName, treeDepth, treeFanout))
+            printf("Couldn't create tree %s\n", treeName);
+    }
     if (printFileName != NULL)
     {
         Print(printFileName);
     }
+    if (lockBenchmarkFlag)
+    {
+        kernel->fileSystem->LockBenchmark(); // file locks vs. a global lock
+    }
 #endif // FILESYS_STUB
 
+    // push the results of the file system commands above out of the
+    // disk buffer cache before any user program gets to run
+    kernel->synchDisk->Sync();
+
     // finally, run an initial user program if requested to do so
 
     kernel->ExecAll();
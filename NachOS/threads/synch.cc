@@ -28,6 +28,9 @@
 // The implementation of condition variables using semaphores is
 // a bit trickier, as explained below under Condition::Wait.
 //
+// Reader/writer locks, in turn, are built from a lock and two
+// condition variables.
+//
 // Copyright (c) 1992-1996 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation 
 // of liability and disclaimer of warranty provisions.
@@ -295,3 +298,127 @@ void Condition::Broadcast(Lock* conditionLock)
         Signal(conditionLock);
     }
 }
+
+//----------------------------------------------------------------------
+// RWLock::RWLock
+// 	Initialize a reader/writer lock, so that it can be used for
+//	synchronization.  Initially, no one holds it.
+//
+//	"debugName" is an arbitrary name, useful for debugging.
+//----------------------------------------------------------------------
+
+RWLock::RWLock(char* debugName)
+{
+    name = debugName;
+    lock = new Lock("rwlock");
+    readable = new Condition("rwlock readable");
+    writable = new Condition("rwlock writable");
+    readers = new List<Thread *>;
+    writer = NULL;
+    writeDepth = 0;
+    waitingWriters = 0;
+}
+
+//----------------------------------------------------------------------
+// RWLock::~RWLock
+// 	Deallocate a reader/writer lock.  No one may be holding it.
+//----------------------------------------------------------------------
+
+RWLock::~RWLock()
+{
+    ASSERT(writer == NULL && readers->IsEmpty());
+    delete readers;
+    delete writable;
+    delete readable;
+    delete lock;
+}
+
+//----------------------------------------------------------------------
+// RWLock::AcquireRead
+//	Wait until there are no writers, then join the readers.  A thread
+//	that already holds the lock gets it again at once: waiting behind
+//	a writer that is itself waiting for this thread would deadlock.
+//----------------------------------------------------------------------
+
+void RWLock::AcquireRead()
+{
+    Thread *current = kernel->currentThread;
+
+    lock->Acquire();
+    if (writer == current) {
+	writeDepth++;
+    } else {
+	if (!readers->IsInList(current)) {
+	    while (writer != NULL || waitingWriters > 0)
+		readable->Wait(lock);
+	}
+	readers->Append(current);
+    }
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// RWLock::ReleaseRead
+//	Leave the readers; the last one out lets a writer in.
+//----------------------------------------------------------------------
+
+void RWLock::ReleaseRead()
+{
+    Thread *current = kernel->currentThread;
+
+    lock->Acquire();
+    if (writer == current) {
+	ASSERT(writeDepth > 1);
+	writeDepth--;
+    } else {
+	ASSERT(readers->IsInList(current));
+	readers->Remove(current);
+	if (readers->IsEmpty())
+	    writable->Signal(lock);
+    }
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// RWLock::AcquireWrite
+//	Wait until no thread holds the lock, then take it for this one.
+//----------------------------------------------------------------------
+
+void RWLock::AcquireWrite()
+{
+    Thread *current = kernel->currentThread;
+
+    lock->Acquire();
+    if (writer == current) {
+	writeDepth++;
+    } else {
+	ASSERT(!readers->IsInList(current));	// can't upgrade
+	waitingWriters++;
+	while (writer != NULL || !readers->IsEmpty())
+	    writable->Wait(lock);
+	waitingWriters--;
+	writer = current;
+	writeDepth = 1;
+    }
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// RWLock::ReleaseWrite
+//	Give up the lock, once released as many times as it was acquired:
+//	to the next writer, if one is waiting, or else to all the readers.
+//----------------------------------------------------------------------
+
+void RWLock::ReleaseWrite()
+{
+    lock->Acquire();
+    ASSERT(IsWrittenByCurrentThread());
+    if (--writeDepth == 0) {
+	writer = NULL;
+	if (waitingWriters > 0)
+	    writable->Signal(lock);
+	else
+	    readable->Broadcast(lock);
+    }
+    lock->Release();
+}
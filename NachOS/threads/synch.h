@@ -5,7 +5,8 @@
 //	locks, and condition variables.  The implementation for
 //	semaphores is given; for the latter two, only the procedure
 //	interface is given -- they are to be implemented as part of 
-//	the first assignment.
+//	the first assignment.  Reader/writer locks, defined last, are
+//	built out of the other kinds.
 //
 //	Note that all the synchronization objects take a "name" as
 //	part of the initialization.  This is solely for debugging purposes.
@@ -141,4 +142,50 @@ class Condition {
     char* name;
     List<Semaphore *> *waitQueue;	// list of waiting threads
 };
+
+// The following class defines a "reader/writer lock".  Any number of
+// threads may hold it for reading at the same time, or one thread may
+// hold it for writing, alone:
+//
+//	AcquireRead -- wait until no thread is writing, or waiting to
+//		write, then join the readers
+//
+//	AcquireWrite -- wait until no thread holds the lock at all,
+//		then take it
+//
+// Waiting writers go ahead of threads that come to read, so a steady
+// stream of readers cannot keep a writer out forever.
+//
+// A thread holding the lock may acquire it again, and then releases
+// it once for each time it acquired it.  While writing, it may also
+// acquire it for reading (which counts as writing again); but a
+// reader cannot become a writer without releasing the lock first.
+
+class RWLock {
+  public:
+    RWLock(char* debugName);		// initialize lock to be FREE
+    ~RWLock();				// deallocate lock
+    char* getName() { return name; }	// debugging assist
+
+    void AcquireRead();			// share the lock with other readers
+    void ReleaseRead();
+    void AcquireWrite();		// hold the lock alone
+    void ReleaseWrite();
+
+    bool IsWrittenByCurrentThread() {
+		return writer == kernel->currentThread; }
+    bool IsReadByCurrentThread() {
+		return readers->IsInList(kernel->currentThread); }
+
+  private:
+    char *name;				// debugging assist
+    Lock *lock;				// protects the fields below
+    Condition *readable;		// signalled when readers may go
+    Condition *writable;		// signalled when a writer may go
+    List<Thread *> *readers;		// threads reading, once for each
+					// time they acquired the lock
+    Thread *writer;			// thread writing, or NULL
+    int writeDepth;			// times the writer acquired the lock
+    int waitingWriters;			// threads waiting to write
+};
 #endif // SYNCH_H
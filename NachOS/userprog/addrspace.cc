@@ -21,6 +21,8 @@
 #include "machine.h"
 #include "noff.h"
 
+static int nextAsid = 0;		// address space ID of the next AddrSpace
+
 //----------------------------------------------------------------------
 // SwapHeader
 // 	Do little endian to big endian conversion on the bytes in the 
@@ -79,18 +81,181 @@ AddrSpace::AddrSpace()
     
     // zero out the entire address space
     bzero(kernel->machine->mainMemory, MemorySize);
+    kernel->machine->FlushDecoded(0, MemorySize);
+
+    for (int i = 0; i < MaxOpenFiles; i++)
+	openFiles[i] = NULL;
+    asid = nextAsid++;
 }
 
 //----------------------------------------------------------------------
 // AddrSpace::~AddrSpace
-// 	Dealloate an address space.
+// 	Dealloate an address space, closing the files it left open, and
+//	dropping its entries from the TLB.
 //----------------------------------------------------------------------
 
 AddrSpace::~AddrSpace()
 {
+   Machine *machine = kernel->machine;
+
+   CloseFiles();
+   for (int i = 0; machine->tlb != NULL && i < machine->tlbEntries; i++)
+	if (machine->tlbAsid[i] == asid)
+	    machine->tlb[i].valid = FALSE;
    delete pageTable;
 }
 
+//----------------------------------------------------------------------
+// AddrSpace::AddFile
+// 	Enter an open file in the descriptor table, and return its
+//	descriptor: the lowest one free, or -1 if there is none (the
+//	caller still owns the file then).
+//----------------------------------------------------------------------
+
+int
+AddrSpace::AddFile(OpenFile *file)
+{
+    for (int i = FirstFileDescriptor; i < MaxOpenFiles; i++) {
+	if (openFiles[i] == NULL) {
+	    openFiles[i] = file;
+	    return i;
+	}
+    }
+    return -1;
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::GetFile
+// 	Return the file open as descriptor "id", or NULL if there is none.
+//----------------------------------------------------------------------
+
+OpenFile *
+AddrSpace::GetFile(int id)
+{
+    if (id < FirstFileDescriptor || id >= MaxOpenFiles)
+	return NULL;
+    return openFiles[id];
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::CloseFile
+// 	Close the file open as descriptor "id", freeing the descriptor.
+//	Return FALSE if there was no such file, or if what was written to
+//	it and left buffered could not all be written to the disk.
+//----------------------------------------------------------------------
+
+bool
+AddrSpace::CloseFile(int id)
+{
+    OpenFile *file = GetFile(id);
+    bool success;
+
+    if (file == NULL)
+	return FALSE;
+    success = file->Flush();
+    delete file;
+    openFiles[id] = NULL;
+    return success;
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::CloseFiles
+// 	Close every file the program still has open, so that what it
+//	wrote and left buffered reaches the disk.  Called when the
+//	program exits, or halts the machine.
+//----------------------------------------------------------------------
+
+void
+AddrSpace::CloseFiles()
+{
+    for (int i = FirstFileDescriptor; i < MaxOpenFiles; i++)
+	CloseFile(i);
+}
+
+
+//----------------------------------------------------------------------
+// AddrSpace::ReadFile
+// 	Read "size" bytes from "file" into the user buffer at virtual
+//	address "vaddr".  Return the number of bytes read, or -1 if the
+//	buffer is not mapped writable.
+//----------------------------------------------------------------------
+
+int
+AddrSpace::ReadFile(OpenFile *file, int vaddr, int size)
+{
+    return Transfer(file, vaddr, size, 1);
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::WriteFile
+// 	Write "size" bytes from the user buffer at virtual address "vaddr"
+//	to "file".  Return the number of bytes written, or -1 if the
+//	buffer is not mapped.
+//----------------------------------------------------------------------
+
+int
+AddrSpace::WriteFile(OpenFile *file, int vaddr, int size)
+{
+    return Transfer(file, vaddr, size, 0);
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::Transfer
+// 	Move data between "file" and the user buffer at "vaddr" without
+//	copying it through the kernel.  The buffer is split, through the
+//	page table, into runs of physically contiguous pages, translating
+//	each page once; each run is handed straight to the file, which
+//	copies between it and the disk's sector buffers.  With pages
+//	mapped one-to-one a buffer is a single run.
+//
+//	"mode" is 1 if the file is read into the buffer (so its pages are
+//	written), and 0 if the buffer is written to the file.  Stop early
+//	at the end of the file or at the first unmapped page; return -1
+//	if the buffer does not start on a mapped page.
+//----------------------------------------------------------------------
+
+int
+AddrSpace::Transfer(OpenFile *file, int vaddr, int size, int mode)
+{
+    char *memory = kernel->machine->mainMemory;
+    unsigned int paddr, next;
+    int done = 0, length, moved;
+    bool more;
+
+    if (size <= 0)
+	return 0;
+    if (vaddr < 0 || Translate(vaddr, &paddr, mode) != NoException)
+	return -1;
+
+    while (done < size) {
+	// extend the run while the next page follows on in physical
+	// memory; "more" is set if it is mapped somewhere else instead
+	length = min(size - done, PageSize - (int) (paddr % PageSize));
+	more = FALSE;
+	while (done + length < size) {
+	    if (Translate(vaddr + done + length, &next, mode) != NoException)
+		break;
+	    if (next != paddr + length) {
+		more = TRUE;
+		break;
+	    }
+	    length += min(size - done - length, PageSize);
+	}
+
+	if (mode) {
+	    moved = file->Read(&memory[paddr], length);
+	    kernel->machine->FlushDecoded(paddr, moved);
+	} else
+	    moved = file->Write(&memory[paddr], length);
+	DEBUG(dbgAddr, "Transferred " << moved << " bytes at physical " << paddr);
+	done += moved;
+	if (moved < length || !more)
+	    break;
+	paddr = next;
+    }
+    return done;
+}
+
 
 //----------------------------------------------------------------------
 // AddrSpace::Load
@@ -150,6 +315,7 @@ AddrSpace::Load(char *fileName)
         executable->ReadAt(
 		&(kernel->machine->mainMemory[noffH.code.virtualAddr]), 
 			noffH.code.size, noffH.code.inFileAddr);
+	kernel->machine->FlushDecoded(noffH.code.virtualAddr, noffH.code.size);
     }
     if (noffH.initData.size > 0) {
         DEBUG(dbgAddr, "Initializing data segment.");
@@ -157,6 +323,7 @@ AddrSpace::Load(char *fileName)
         executable->ReadAt(
 		&(kernel->machine->mainMemory[noffH.initData.virtualAddr]),
 			noffH.initData.size, noffH.initData.inFileAddr);
+	kernel->machine->FlushDecoded(noffH.initData.virtualAddr, noffH.initData.size);
     }
 
 #ifdef RDATA
@@ -166,6 +333,7 @@ AddrSpace::Load(char *fileName)
         executable->ReadAt(
 		&(kernel->machine->mainMemory[noffH.readonlyData.virtualAddr]),
 			noffH.readonlyData.size, noffH.readonlyData.inFileAddr);
+	kernel->machine->FlushDecoded(noffH.readonlyData.virtualAddr, noffH.readonlyData.size);
     }
 #endif
 
@@ -240,24 +408,85 @@ AddrSpace::InitRegisters()
 // 	On a context switch, save any machine state, specific
 //	to this address space, that needs saving.
 //
-//	For now, don't need to save anything!
+//	With a TLB, that is the use and dirty bits the hardware has set
+//	in our entries.  The entries themselves stay: they are tagged
+//	with our address space ID, so only we can use them, and they are
+//	still good when we next run, unless another space replaces them.
 //----------------------------------------------------------------------
 
 void AddrSpace::SaveState() 
-{}
+{
+    Machine *machine = kernel->machine;
+
+    for (int i = 0; machine->tlb != NULL && i < machine->tlbEntries; i++)
+	if (machine->tlbAsid[i] == asid)
+	    SaveTLB(i);
+}
 
 //----------------------------------------------------------------------
 // AddrSpace::RestoreState
 // 	On a context switch, restore the machine state so that
 //	this address space can run.
 //
-//      For now, tell the machine where to find the page table.
+//      For now, tell the machine where to find the page table (or,
+//	with a TLB, which of its entries are ours), and to forget the
+//	translations it cached from the last one.
 //----------------------------------------------------------------------
 
 void AddrSpace::RestoreState() 
 {
-    kernel->machine->pageTable = pageTable;
-    kernel->machine->pageTableSize = numPages;
+    if (kernel->machine->tlb != NULL) {
+	kernel->machine->asid = asid;
+    } else {
+	kernel->machine->pageTable = pageTable;
+	kernel->machine->pageTableSize = numPages;
+    }
+    kernel->machine->FlushTranslations();
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::LoadTLB
+// 	Handle a TLB miss at user address "vaddr": load the translation
+//	from our page table into the entry the machine picks, after saving
+//	the bits of the translation it replaces, if that was ours (another
+//	space's were saved when it last stopped running).
+//
+//	Return FALSE if our page table has no valid translation for
+//	"vaddr" either, so that it is a real page fault.
+//----------------------------------------------------------------------
+
+bool
+AddrSpace::LoadTLB(unsigned int vaddr)
+{
+    Machine *machine = kernel->machine;
+    unsigned int vpn = vaddr / PageSize;
+    int i;
+
+    if (machine->tlb == NULL || vpn >= numPages || !pageTable[vpn].valid)
+	return FALSE;
+    i = machine->TLBVictim(vpn);
+    if (machine->tlbAsid[i] == asid)
+	SaveTLB(i);
+    machine->tlb[i] = pageTable[vpn];
+    machine->tlbAsid[i] = asid;
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::SaveTLB
+// 	Copy the use and dirty bits the hardware set in our TLB entry "i"
+//	back into the page table entry it was loaded from.
+//----------------------------------------------------------------------
+
+void
+AddrSpace::SaveTLB(int i)
+{
+    TranslationEntry *entry = &kernel->machine->tlb[i];
+
+    if (!entry->valid)
+	return;
+    pageTable[entry->virtualPage].use |= entry->use;
+    pageTable[entry->virtualPage].dirty |= entry->dirty;
 }
 
 
@@ -18,6 +18,12 @@
 
 #define UserStackSize		1024 	// increase this as necessary!
 
+// Each address space has its own table of open file descriptors.  The
+// first two (SysConsoleInput and SysConsoleOutput, see syscall.h) stand
+// for the console, so files get descriptors from FirstFileDescriptor up.
+#define MaxOpenFiles		20
+#define FirstFileDescriptor	2
+
 class AddrSpace {
   public:
     AddrSpace();			// Create an address space.
@@ -34,20 +40,47 @@ class AddrSpace {
     void SaveState();			// Save/restore address space-specific
     void RestoreState();		// info on a context switch 
 
+    bool LoadTLB(unsigned int vaddr);	// Load the translation of "vaddr"
+					// into the TLB, after a miss; FALSE
+					// if there is none to load
+
     // Translate virtual address _vaddr_
     // to physical address _paddr_. _mode_
     // is 0 for Read, 1 for Write.
     ExceptionType Translate(unsigned int vaddr, unsigned int *paddr, int mode);
 
+    int AddFile(OpenFile *file);	// Give "file" a descriptor; -1 if
+					// the table is full
+    OpenFile *GetFile(int id);		// File open as "id", or NULL
+    bool CloseFile(int id);		// Close "id"; FALSE if not open,
+					// or its buffered writes were lost
+    void CloseFiles();			// Close every file left open
+
+    int ReadFile(OpenFile *file, int vaddr, int size);
+					// Read from "file" into user memory
+    int WriteFile(OpenFile *file, int vaddr, int size);
+					// Write user memory to "file"
+
   private:
     TranslationEntry *pageTable;	// Assume linear page table translation
 					// for now!
     unsigned int numPages;		// Number of pages in the virtual 
 					// address space
+    int asid;				// Tags our entries in the TLB
+    OpenFile *openFiles[MaxOpenFiles];	// Open files, by descriptor; each
+					// keeps its own seek position
+
+    int Transfer(OpenFile *file, int vaddr, int size, int mode);
+					// Move data between "file" and the
+					// user buffer at "vaddr", a page at
+					// a time
 
     void InitRegisters();		// Initialize user-level CPU registers,
 					// before jumping to user code
 
+    void SaveTLB(int i);		// Copy the use and dirty bits of our
+					// TLB entry "i" into the page table
+
 };
 
 #endif // ADDRSPACE_H
@@ -107,10 +107,9 @@ ExceptionHandler(ExceptionType which)
 		case SC_Write:
 			val = kernel->machine->ReadRegister(4);
 			{
-			char *buffer = &(kernel->machine->mainMemory[val]);
 			int size = kernel->machine->ReadRegister(5);
 			int FileId = kernel->machine->ReadRegister(6);
-			status = SysWrite(buffer, size, FileId);
+			status = SysWrite(val, size, FileId);
 			kernel->machine->WriteRegister(2, (int) status);
 			}
 			kernel->machine->WriteRegister(PrevPCReg, kernel->machine->ReadRegister(PCReg));
@@ -123,9 +122,8 @@ ExceptionHandler(ExceptionType which)
 			val = kernel->machine->ReadRegister(4);
 			{
 			int size = kernel->machine->ReadRegister(5);
-			char *buffer = &(kernel->machine->mainMemory[val]);
 			int FileId = kernel->machine->ReadRegister(6);
-			status = SysRead(buffer, size, FileId);
+			status = SysRead(val, size, FileId);
 			kernel->machine->WriteRegister(2,  status);	
 			}
 			kernel->machine->WriteRegister(PrevPCReg, kernel->machine->ReadRegister(PCReg));
@@ -134,6 +132,19 @@ ExceptionHandler(ExceptionType which)
 			return;
 			ASSERTNOTREACHED();
 			break;
+		case SC_Seek:
+			{
+			int position = kernel->machine->ReadRegister(4);
+			int FileId = kernel->machine->ReadRegister(5);
+			status = SysSeek(position, FileId);
+			kernel->machine->WriteRegister(2,  status);
+			}
+			kernel->machine->WriteRegister(PrevPCReg, kernel->machine->ReadRegister(PCReg));
+			kernel->machine->WriteRegister(PCReg, kernel->machine->ReadRegister(PCReg)+4);
+			kernel->machine->WriteRegister(NextPCReg, kernel->machine->ReadRegister(PCReg)+4);
+			return;
+			ASSERTNOTREACHED();
+			break;
 		case SC_Close:
 			{
 			int FileId = kernel->machine->ReadRegister(4);
@@ -175,6 +186,8 @@ ExceptionHandler(ExceptionType which)
 			DEBUG(dbgAddr, "Program exit\n");
             val=kernel->machine->ReadRegister(4);
             cout << "return value:" << val << endl;
+			kernel->currentThread->space->CloseFiles();
+			kernel->synchDisk->Sync();
 			kernel->currentThread->Finish();
             break;
       	default:
@@ -182,6 +195,13 @@ ExceptionHandler(ExceptionType which)
 			break;
 		}
 		break;
+	case PageFaultException:
+		val = kernel->machine->ReadRegister(BadVAddrReg);
+		if (kernel->currentThread->space->LoadTLB(val))
+			return;		// a TLB miss; run the instruction again
+		kernel->stats->numPageFaults++;
+		cerr << "Page fault at " << val << "\n";
+		break;
 	default:
 		cerr << "Unexpected user mode exception " << (int)which << "\n";
 		break;
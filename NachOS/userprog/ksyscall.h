@@ -14,9 +14,13 @@
 #include "kernel.h"
 
 #include "synchconsole.h"
+#include "synchdisk.h"
 
 void SysHalt()
 {
+	if (kernel->currentThread->space != NULL)
+		kernel->currentThread->space->CloseFiles();
+	kernel->synchDisk->Sync();
 	kernel->interrupt->Halt();
 }
 
@@ -42,7 +46,7 @@ int SysOpen(char *filename)
 {
 	return kernel->interrupt->Open(filename);
 }
-int SysWrite(char *buffer, int size, int ID)
+int SysWrite(int buffer, int size, int ID)
 {
 	return kernel->interrupt->Write(buffer, size, ID);
 }
@@ -50,9 +54,13 @@ int SysClose(int ID)
 {
 	return kernel->interrupt->Close(ID);
 }
-int SysRead(char *buffer, int size, int ID)
+int SysRead(int buffer, int size, int ID)
 {
 	return kernel->interrupt->Read(buffer, size, ID);
 }
+int SysSeek(int position, int ID)
+{
+	return kernel->interrupt->Seek(position, ID);
+}
 
 #endif /* ! __USERPROG_KSYSCALL_H__ */